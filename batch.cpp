@@ -0,0 +1,206 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <atomic>
+#include <mutex>
+#include <limits>
+#include <algorithm>
+#include "batch.h"
+#include "renderer.h"
+#include "threadpool.h"
+#include "hiz.h"
+#include "profile.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double seconds_since(Clock::time_point &t0) {
+    Clock::time_point t1 = Clock::now();
+    double s = std::chrono::duration<double>(t1 - t0).count();
+    t0 = t1;
+    return s;
+}
+
+// per-thread state, replaced only when a job changes the frame size; the
+// frame buffers go back to the renderer's pool for the next job of the
+// old size
+struct RenderContext {
+    int width;
+    int height;
+    RenderTargetPool *targets;
+    RenderTarget *target;
+    HiZBuffer *hiz;
+    TileRasterizer *rasterizer;
+    ScreenVerts screen_verts;
+
+    RenderContext() : width(0), height(0), targets(NULL), target(NULL), hiz(NULL), rasterizer(NULL), screen_verts() {}
+    ~RenderContext() {
+        if (targets) targets->release(target);
+        delete hiz;
+        delete rasterizer;
+    }
+    void resize(int w, int h, DepthFormat format, int samples) {
+        if (!target || target->width() != w || target->height() != h || target->depth_format() != format || target->samples() != samples) {
+            if (target) targets->release(target);
+            target = targets->acquire(w, h, format, samples);
+        }
+        if (w == width && h == height) return;
+        width = w;
+        height = h;
+        delete hiz;
+        delete rasterizer;
+        hiz = new HiZBuffer(w, h);
+        // jobs run one per thread, so each renders on its own thread
+        rasterizer = new TileRasterizer(w, h, 64, 1);
+    }
+};
+
+}
+
+BatchRenderer::BatchRenderer() : optimize_(true), use_hiz_(true), cull_backfaces_(true), deferred_(false), depth_format_(DEPTH_FLOAT), samples_(1), resolve_(RESOLVE_BOX), mode_(best_raster_mode()), filter_(Texture::TRILINEAR), layout_(Texture::ROW_MAJOR), shader_(SHADER_GOURAUD) {
+}
+
+BatchRenderer::~BatchRenderer() {
+    unload();
+}
+
+void BatchRenderer::unload() {
+    for (size_t i = 0; i < models_.size(); i++) delete models_[i];
+    for (size_t i = 0; i < textures_.size(); i++) delete textures_[i];
+    models_.clear();
+    textures_.clear();
+}
+
+int BatchRenderer::asset_index(std::vector<std::string> &paths, const std::string &path) {
+    std::vector<std::string>::iterator it = std::find(paths.begin(), paths.end(), path);
+    if (it != paths.end()) return (int)(it - paths.begin());
+    paths.push_back(path);
+    return (int)paths.size() - 1;
+}
+
+bool BatchRenderer::load_manifest(const char *filename) {
+    std::ifstream in(filename);
+    if (!in.is_open()) {
+        std::cerr << "can't open manifest " << filename << std::endl;
+        return false;
+    }
+    int width = 800, height = 800;
+    std::string line;
+    for (int lineno = 1; std::getline(in, line); lineno++) {
+        std::istringstream iss(line.substr(0, line.find('#')));
+        std::string directive;
+        if (!(iss >> directive)) continue;
+        if (directive == "size") {
+            if (!(iss >> width >> height) || width <= 0 || height <= 0) {
+                std::cerr << filename << ":" << lineno << ": bad size" << std::endl;
+                return false;
+            }
+        } else if (directive == "job") {
+            std::string model, texture;
+            BatchJob job;
+            if (!(iss >> model >> texture >> job.output)) {
+                std::cerr << filename << ":" << lineno << ": job needs a model, a texture and an output" << std::endl;
+                return false;
+            }
+            job.model = asset_index(model_paths_, model);
+            job.texture = asset_index(texture_paths_, texture);
+            job.width = width;
+            job.height = height;
+            job.camera = Mat4::identity();
+            float m;
+            int n = 0;
+            for (; n < 16 && iss >> m; n++) job.camera[n / 4][n % 4] = m;
+            if (n != 0 && n != 16) {
+                std::cerr << filename << ":" << lineno << ": camera needs 16 values, got " << n << std::endl;
+                return false;
+            }
+            jobs_.push_back(job);
+        } else {
+            std::cerr << filename << ":" << lineno << ": unknown directive " << directive << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool BatchRenderer::run(int nthreads, BatchTiming &timing) {
+    timing = BatchTiming();
+    Clock::time_point start = Clock::now();
+    Clock::time_point t0 = start;
+
+    unload();
+    for (size_t i = 0; i < model_paths_.size(); i++) {
+        Model *model = new Model(model_paths_[i].c_str());
+        models_.push_back(model);
+        if (model->nfaces() == 0) {
+            std::cerr << "can't load model " << model_paths_[i] << std::endl;
+            return false;
+        }
+        if (optimize_ && !model->indexed()) model->optimize();
+    }
+    for (size_t i = 0; i < texture_paths_.size(); i++) {
+        TGAImage image;
+        if (!image.read_tga_file(texture_paths_[i].c_str())) {
+            std::cerr << "can't load texture " << texture_paths_[i] << std::endl;
+            return false;
+        }
+        image.flip_vertically();
+        Texture *texture = new Texture(image, layout_);
+        texture->set_filter(filter_);
+        textures_.push_back(texture);
+    }
+    timing.load = seconds_since(t0);
+
+    ThreadPool pool(nthreads);
+    std::vector<RenderContext> contexts(pool.size());
+    for (size_t i = 0; i < contexts.size(); i++) contexts[i].targets = &targets_;
+    std::atomic<int> next(0);
+    std::mutex timing_mutex;
+    // one item per thread, each pulling jobs until none are left, so a
+    // thread's buffers stay with it
+    pool.parallel_for(pool.size(), [&](int worker) {
+        RenderContext &ctx = contexts[worker];
+        BatchTiming local = BatchTiming();
+        Clock::time_point t = Clock::now();
+        for (int j; (j = next++) < (int)jobs_.size();) {
+            PROFILE_SCOPE("job");
+            const BatchJob &job = jobs_[j];
+            Model &model = *models_[job.model];
+            ctx.resize(job.width, job.height, depth_format_, samples_);
+            ctx.target->set_resolve_filter(resolve_);
+            ctx.target->clear();
+            ctx.hiz->clear(-std::numeric_limits<float>::max());
+            ctx.rasterizer->set_mode(mode_);
+            ctx.rasterizer->set_cull_backfaces(cull_backfaces_);
+            ctx.rasterizer->set_deferred(deferred_);
+            local.clear += seconds_since(t);
+
+            transform_model(model, ctx.screen_verts, job.width, job.height, &job.camera);
+            local.transform += seconds_since(t);
+
+            RasterStats stats;
+            ShaderUniforms uniforms = {textures_[job.texture], NULL, job.camera.inverse_transpose(), Vec3f(0, 0, 1)};
+            with_shader(shader_, uniforms, [&](const auto &shader) {
+                rasterize_model(model, *ctx.rasterizer, ctx.screen_verts, true, *ctx.target, use_hiz_ ? ctx.hiz : NULL, shader, stats);
+            });
+            local.stats.add(stats);
+            local.raster += seconds_since(t);
+
+            if (!ctx.target->color().write_tga_file(job.output.c_str(), true, true)) local.failed++;
+            local.write += seconds_since(t);
+            local.jobs++;
+        }
+        std::lock_guard<std::mutex> lock(timing_mutex);
+        timing.clear += local.clear;
+        timing.transform += local.transform;
+        timing.raster += local.raster;
+        timing.write += local.write;
+        timing.jobs += local.jobs;
+        timing.failed += local.failed;
+        timing.stats.add(local.stats);
+    });
+    timing.wall = seconds_since(start);
+    return timing.failed == 0;
+}
@@ -0,0 +1,85 @@
+#ifndef __BATCH_H__
+#define __BATCH_H__
+
+#include <vector>
+#include <string>
+#include "geometry.h"
+#include "model.h"
+#include "texture.h"
+#include "rasterizer.h"
+#include "rendertarget.h"
+
+// A job manifest is a text file with one directive per line ('#' starts a
+// comment):
+//   size <width> <height>
+//   job <model.obj|.lmesh> <texture.tga> <output.tga> [m00 m01 ... m33]
+// The optional 16 numbers are the row-major camera matrix taking model
+// space to clip space (identity when omitted); size applies to the jobs
+// after it (800x800 by default). Every distinct model and texture path is
+// loaded once and shared by all jobs.
+struct BatchJob {
+	int model;
+	int texture;
+	int width;
+	int height;
+	std::string output;
+	Mat4 camera;
+};
+
+// seconds per stage, summed over the worker threads
+struct BatchTiming {
+	double load;
+	double clear;
+	double transform;
+	double raster;
+	double write;
+	double wall;
+	int jobs;
+	int failed;
+	RasterStats stats;
+};
+
+class BatchRenderer {
+private:
+	std::vector<std::string> model_paths_;
+	std::vector<std::string> texture_paths_;
+	std::vector<Model *> models_;
+	std::vector<Texture *> textures_;
+	std::vector<BatchJob> jobs_;
+	bool optimize_;
+	bool use_hiz_;
+	bool cull_backfaces_;
+	bool deferred_;
+	DepthFormat depth_format_;
+	int samples_;
+	ResolveFilter resolve_;
+	RasterMode mode_;
+	Texture::Filter filter_;
+	Texture::Layout layout_;
+	ShaderKind shader_;
+	RenderTargetPool targets_;
+
+	static int asset_index(std::vector<std::string> &paths, const std::string &path);
+	void unload();
+public:
+	BatchRenderer();
+	~BatchRenderer();
+	void set_optimize(bool optimize) { optimize_ = optimize; }
+	void set_hiz(bool use_hiz) { use_hiz_ = use_hiz; }
+	void set_mode(RasterMode mode) { mode_ = mode; }
+	void set_cull_backfaces(bool cull) { cull_backfaces_ = cull; }
+	void set_deferred(bool deferred) { deferred_ = deferred; }
+	void set_depth_format(DepthFormat format) { depth_format_ = format; }
+	void set_msaa(int samples, ResolveFilter resolve) { samples_ = samples; resolve_ = resolve; }
+	void set_filter(Texture::Filter filter) { filter_ = filter; }
+	void set_layout(Texture::Layout layout) { layout_ = layout; }
+	void set_shader(ShaderKind shader) { shader_ = shader; }
+	bool load_manifest(const char *filename);
+	int njobs() const { return (int)jobs_.size(); }
+	// loads the assets, then renders the jobs on nthreads threads (<=0: one
+	// per hardware thread); frame buffers are pooled and reused by later jobs
+	// and runs of the same size
+	bool run(int nthreads, BatchTiming &timing);
+};
+
+#endif //__BATCH_H__
@@ -0,0 +1,67 @@
+#include <iostream>
+#include <cstdlib>
+#include <limits>
+#include <atomic>
+#include <new>
+#include "../model.h"
+#include "../renderer.h"
+
+// Counts heap allocations made while drawing a frame. The first frame grows
+// the rasterizer's triangle and bin arrays (and, with packed depth, each
+// worker's scratch tile); every frame after it should not touch the heap at
+// all.
+//   alloc_bench [file.obj] [frames] [threads]
+
+static std::atomic<unsigned long> g_allocs(0);
+static std::atomic<unsigned long> g_bytes(0);
+
+void *operator new(size_t size) {
+    g_allocs++;
+    g_bytes += size;
+    void *p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    free(p);
+}
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : "obj/african_head/african_head.obj";
+    int frames = argc > 2 ? atoi(argv[2]) : 5;
+    int nthreads = argc > 3 ? atoi(argv[3]) : 0;
+    const int width = 800, height = 800;
+
+    Model model(path);
+    TGAImage texture(1024, 1024, TGAImage::RGB);
+    texture.read_tga_file("obj/african_head/african_head_diffuse.tga");
+    Texture sampler(texture);
+    HiZBuffer hiz(width, height);
+    TileRasterizer rasterizer(width, height, 64, nthreads);
+    RasterStats stats;
+    ScreenVerts screen_verts;
+
+    int status = 0;
+    const DepthFormat formats[] = {DEPTH_FLOAT, DEPTH_UNORM16};
+    for (int f = 0; f < 2; f++) {
+        RenderTarget target(width, height, formats[f]);
+        for (int serial = 0; serial < 2; serial++) {
+            for (int frame = 0; frame < frames; frame++) {
+                target.clear();
+                hiz.clear(-std::numeric_limits<float>::max());
+                unsigned long allocs = g_allocs, bytes = g_bytes;
+                draw_model(model, rasterizer, screen_verts, serial, target, &hiz, GouraudShader(sampler, Vec3f(0, 0, 1)), stats);
+                allocs = g_allocs - allocs;
+                bytes = g_bytes - bytes;
+                std::cout << depth_format_name(formats[f]) << " depth, " << (serial ? "serial" : "tiled") << " frame " << frame << ": " << allocs << " allocations, " << bytes << " bytes" << std::endl;
+                if (frame > 0 && allocs) status = 1;
+            }
+        }
+    }
+    return status;
+}
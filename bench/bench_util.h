@@ -0,0 +1,26 @@
+#ifndef __BENCH_UTIL_H__
+#define __BENCH_UTIL_H__
+
+#include <chrono>
+#include <limits>
+#include <algorithm>
+
+// timing helpers shared by the benchmark programs
+
+inline double seconds_since(std::chrono::steady_clock::time_point t0) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// the fastest of frames calls of f, in seconds
+template <class F>
+double best_of(int frames, F f) {
+	double best = std::numeric_limits<double>::max();
+	for (int i = 0; i < frames; i++) {
+		std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+		f();
+		best = std::min(best, seconds_since(t0));
+	}
+	return best;
+}
+
+#endif //__BENCH_UTIL_H__
@@ -0,0 +1,194 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include "../model.h"
+#include "../renderer.h"
+
+// Golden-image check for the optimized paths. Renders a fixed set of scenes
+// through every raster variant (the three raster modes, the serial path and
+// deferred shading) and compares each against the scene's golden TGA,
+// which is rendered with RASTER_REFERENCE. Reports the largest channel
+// error, PSNR and the number of differing pixels; a variant fails when its
+// max error or PSNR is outside the tolerance listed for it in
+// <dir>/tolerances.txt ("variant max_error min_psnr" per line). For every
+// result that is not identical an error heatmap is written to <heatmaps>.
+// Exits non-zero if anything fails.
+//   golden_check [--dir bench/golden] [--heatmaps dir] [--update]
+
+const int WIDTH = 400;
+const int HEIGHT = 400;
+
+struct Scene {
+    const char *name;
+    ShaderKind shader;
+    Mat4 camera;
+};
+
+struct Variant {
+    const char *name;
+    RasterMode mode;
+    bool serial;
+    bool deferred;
+    DepthFormat depth;
+};
+
+struct Tolerance {
+    int max_error;
+    double min_psnr;
+};
+
+struct Diff {
+    int max_error;
+    double psnr;
+    unsigned long differing;
+};
+
+static Diff compare(TGAImage &a, TGAImage &b, TGAImage *heatmap) {
+    Diff d = {0, std::numeric_limits<double>::infinity(), 0};
+    double sum = 0;
+    int w = a.get_width(), h = a.get_height(), bpp = a.get_bytespp();
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            TGAColor ca = a.get(x, y), cb = b.get(x, y);
+            int err = 0;
+            for (int c = 0; c < bpp; c++) {
+                int e = std::abs((int)ca.raw[c] - (int)cb.raw[c]);
+                err = std::max(err, e);
+                sum += (double)e * e;
+            }
+            d.max_error = std::max(d.max_error, err);
+            d.differing += err > 0;
+            if (heatmap) {
+                // black where equal, then red to yellow as the error grows
+                int v = err ? std::min(255, 64 + err * 8) : 0;
+                heatmap->set(x, y, TGAColor(v, v > 191 ? (v - 192) * 4 : 0, 0, 255));
+            }
+        }
+    }
+    if (sum > 0) d.psnr = 10 * std::log10(255. * 255. / (sum / ((double)w * h * bpp)));
+    return d;
+}
+
+static bool read_tolerances(const std::string &filename, std::map<std::string, Tolerance> &tolerances) {
+    std::ifstream in(filename.c_str());
+    if (!in.is_open()) {
+        std::cerr << "can't open file " << filename << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream iss(line);
+        std::string name;
+        Tolerance t;
+        if (line.empty() || line[0] == '#') continue;
+        if (!(iss >> name >> t.max_error >> t.min_psnr)) {
+            std::cerr << filename << ": bad line " << line << std::endl;
+            return false;
+        }
+        tolerances[name] = t;
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    std::string dir = "bench/golden";
+    std::string heatmaps = "/tmp";
+    bool update = false;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--dir") && i + 1 < argc) dir = argv[++i];
+        else if (!strcmp(argv[i], "--heatmaps") && i + 1 < argc) heatmaps = argv[++i];
+        else if (!strcmp(argv[i], "--update")) update = true;
+        else {
+            std::cerr << "unknown argument " << argv[i] << std::endl;
+            return 2;
+        }
+    }
+
+    Model model("obj/african_head/african_head.obj");
+    if (model.nfaces() == 0) return 2;
+    model.optimize();
+    TGAImage texture_image;
+    if (!texture_image.read_tga_file("obj/african_head/african_head_diffuse.tga")) return 2;
+    texture_image.flip_vertically();
+    Texture texture(texture_image);
+
+    Mat4 orbit = Mat4::projection(3.f) * Mat4::lookat(Vec3f(1, .5f, 3), Vec3f(0, 0, 0), Vec3f(0, 1, 0));
+    // the eye sits inside the head, so faces cross the near plane
+    Mat4 near = Mat4::identity();
+    near[3][2] = -2.5f;
+    const Scene scenes[] = {
+        {"front", SHADER_GOURAUD, Mat4::identity()},
+        {"orbit", SHADER_GOURAUD, orbit},
+        {"phong", SHADER_PHONG, orbit},
+        {"flat", SHADER_FLAT, Mat4::identity()},
+        {"near", SHADER_GOURAUD, near},
+    };
+    std::vector<Variant> variants;
+    variants.push_back(Variant{"reference", RASTER_REFERENCE, true, false, DEPTH_FLOAT});
+    variants.push_back(Variant{"scalar", RASTER_SCALAR, false, false, DEPTH_FLOAT});
+    if (best_raster_mode() == RASTER_AVX2) variants.push_back(Variant{"avx2", RASTER_AVX2, false, false, DEPTH_FLOAT});
+    variants.push_back(Variant{"serial", best_raster_mode(), true, false, DEPTH_FLOAT});
+    variants.push_back(Variant{"deferred", best_raster_mode(), false, true, DEPTH_FLOAT});
+    variants.push_back(Variant{"depth24", best_raster_mode(), false, false, DEPTH_UNORM24});
+    variants.push_back(Variant{"depth16", best_raster_mode(), false, false, DEPTH_UNORM16});
+
+    std::map<std::string, Tolerance> tolerances;
+    if (!update && !read_tolerances(dir + "/tolerances.txt", tolerances)) return 2;
+
+    RenderTargetPool targets;
+    TGAImage heatmap(WIDTH, HEIGHT, TGAImage::RGB);
+    HiZBuffer hiz(WIDTH, HEIGHT);
+    TileRasterizer rasterizer(WIDTH, HEIGHT);
+    ScreenVerts screen_verts;
+    RasterStats stats;
+    int failures = 0;
+    std::cout << "scene\tvariant\t\tmax err\tpsnr\tpixels\tresult" << std::endl;
+    for (size_t s = 0; s < sizeof(scenes) / sizeof(scenes[0]); s++) {
+        const Scene &scene = scenes[s];
+        std::string golden_path = dir + "/" + scene.name + ".tga";
+        TGAImage golden;
+        if (!update && !golden.read_tga_file(golden_path.c_str())) return 2;
+        for (size_t v = 0; v < variants.size(); v++) {
+            const Variant &variant = variants[v];
+            if (update && variant.mode != RASTER_REFERENCE) continue;
+            RenderTarget *target = targets.acquire(WIDTH, HEIGHT, variant.depth);
+            TGAImage &image = target->color();
+            target->clear();
+            hiz.clear(-std::numeric_limits<float>::max());
+            rasterizer.set_mode(variant.mode);
+            rasterizer.set_deferred(variant.deferred);
+            transform_model(model, screen_verts, WIDTH, HEIGHT, &scene.camera);
+            ShaderUniforms uniforms = {&texture, NULL, scene.camera.inverse_transpose(), Vec3f(0, 0, 1)};
+            with_shader(scene.shader, uniforms, [&](const auto &shader) {
+                rasterize_model(model, rasterizer, screen_verts, variant.serial, *target, &hiz, shader, stats);
+            });
+            if (update) {
+                if (!image.write_tga_file(golden_path.c_str())) return 2;
+                std::cout << scene.name << "\twrote " << golden_path << std::endl;
+                targets.release(target);
+                continue;
+            }
+            Diff d = compare(golden, image, &heatmap);
+            targets.release(target);
+            std::map<std::string, Tolerance>::iterator t = tolerances.find(variant.name);
+            bool pass = t != tolerances.end() && d.max_error <= t->second.max_error && d.psnr >= t->second.min_psnr;
+            failures += !pass;
+            std::cout << scene.name << "\t" << variant.name << (strlen(variant.name) < 8 ? "\t\t" : "\t") << d.max_error << "\t" << d.psnr
+                      << "\t" << d.differing << "\t" << (pass ? "ok" : t == tolerances.end() ? "FAIL (no tolerance)" : "FAIL") << std::endl;
+            if (d.differing) {
+                std::string path = heatmaps + "/golden_" + scene.name + "_" + variant.name + ".tga";
+                heatmap.write_tga_file(path.c_str());
+            }
+        }
+    }
+    if (!update) std::cout << "# " << failures << " failure(s)" << std::endl;
+    return failures ? 1 : 0;
+}
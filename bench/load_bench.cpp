@@ -0,0 +1,64 @@
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <chrono>
+#include <functional>
+#include "../model.h"
+
+// Compares the three Model load paths: the istringstream parser, the mmap'ed
+// parallel tokenizer and the .lmesh binary cache.
+//   load_bench [file.obj] [iterations]
+
+static double run(const char *name, int iterations, const std::function<bool(Model &)> &load) {
+    double best = 1e30, total = 0;
+    for (int i = 0; i < iterations; i++) {
+        Model m;
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        if (!load(m)) {
+            std::cerr << name << ": load failed" << std::endl;
+            exit(1);
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        best = std::min(best, ms);
+        total += ms;
+    }
+    std::cout << name << "\tmin " << best << " ms\tmean " << total / iterations << " ms" << std::endl;
+    return best;
+}
+
+static bool same(Model &a, Model &b) {
+    if (a.nverts() != b.nverts() || a.nuv_verts() != b.nuv_verts() || a.nvn_verts() != b.nvn_verts() || a.nfaces() != b.nfaces()) return false;
+    for (int i = 0; i < a.nverts(); i++) {
+        Vec3f u = a.vert(i), v = b.vert(i);
+        if (u.x != v.x || u.y != v.y || u.z != v.z) return false;
+    }
+    for (int i = 0; i < a.nfaces(); i++) {
+        for (int j = 0; j < 3; j++) {
+            if (a.face_verts(i)[j] != b.face_verts(i)[j] || a.face_uvs(i)[j] != b.face_uvs(i)[j] || a.face_norms(i)[j] != b.face_norms(i)[j]) return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv) {
+    std::string obj = argc > 1 ? argv[1] : "obj/african_head/african_head.obj";
+    int iterations = argc > 2 ? atoi(argv[2]) : 20;
+    std::string cache = obj.substr(0, obj.rfind('.')) + ".lmesh";
+
+    Model reference;
+    if (!reference.load_obj_stream(obj.c_str()) || !reference.write_cache(cache.c_str())) return 1;
+    Model fast, cached;
+    fast.load_obj(obj.c_str());
+    cached.load_cache(cache.c_str());
+    if (!same(reference, fast) || !same(reference, cached)) {
+        std::cerr << "load paths disagree" << std::endl;
+        return 1;
+    }
+
+    std::cout << obj << ": " << reference.nverts() << " verts, " << reference.nfaces() << " faces" << std::endl;
+    double stream = run("istream", iterations, [&](Model &m) { return m.load_obj_stream(obj.c_str()); });
+    double mmap = run("mmap", iterations, [&](Model &m) { return m.load_obj(obj.c_str()); });
+    double lmesh = run("lmesh", iterations, [&](Model &m) { return m.load_cache(cache.c_str()); });
+    std::cout << "speedup mmap x" << stream / mmap << ", lmesh x" << stream / lmesh << std::endl;
+    return 0;
+}
@@ -0,0 +1,71 @@
+#include <iostream>
+#include <cstdlib>
+#include <chrono>
+#include "../geometry.h"
+#include "bench_util.h"
+
+// Heap-backed Matrix against the generic mat<4,4,float> template and Mat4:
+// ns per 4x4 product and per point transform, and the worst relative error
+// of Mat4::inverse against mat::invert on random well-conditioned matrices.
+//   mat_bench [iterations]
+
+static Matrix point_matrix(const Vec4f &v) {
+    Matrix m(4, 1);
+    for (int i = 0; i < 4; i++) m[i][0] = v[i];
+    return m;
+}
+
+int main(int argc, char **argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 1 << 20;
+
+    Mat4 a = Mat4::viewport(0, 0, 800, 800, 255) * Mat4::projection(3.f) * Mat4::lookat(Vec3f(1, 1, 3), Vec3f(0, 0, 0), Vec3f(0, 1, 0));
+    Mat4 b = a.inverse_transpose();
+    mat<4, 4, float> ga = a, gb = b;
+    Matrix ha(4, 4), hb(4, 4);
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            ha[i][j] = a[i][j];
+            hb[i][j] = b[i][j];
+        }
+    }
+    Vec4f v = embed<4>(Vec3f(.3f, -.2f, .5f));
+
+    const char *names[] = {"Matrix", "mat<4,4>", "Mat4"};
+    std::cout << "ns/op\tproduct\ttransform" << std::endl;
+    for (int impl = 0; impl < 3; impl++) {
+        float sink = 0;
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < n; i++) {
+            // the product feeds the next one so the loop cannot be hoisted
+            if (impl == 0) { ha[0][0] += 1e-9f; Matrix p = ha * hb; sink += p[1][1]; }
+            else if (impl == 1) { ga[0][0] += 1e-9f; sink += (ga * gb)[1][1]; }
+            else { a[0][0] += 1e-9f; sink += (a * b)[1][1]; }
+        }
+        double product = seconds_since(t0) / n * 1e9;
+        t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < n; i++) {
+            v[0] += 1e-9f;
+            if (impl == 0) { Matrix p = ha * point_matrix(v); sink += p[3][0]; }
+            else if (impl == 1) sink += (ga * v)[3];
+            else sink += (a * v)[3];
+        }
+        double transform = seconds_since(t0) / n * 1e9;
+        std::cout << names[impl] << "\t" << product << "\t" << transform << "\t(" << sink << ")" << std::endl;
+    }
+
+    srand(1);
+    float worst = 0;
+    for (int t = 0; t < 10000; t++) {
+        Mat4 m;
+        for (int i = 0; i < 16; i++) m.data()[i] = rand() / (float)RAND_MAX * 2 - 1;
+        mat<4, 4, float> g = m;
+        if (std::abs(g.det()) < 1e-2f) continue;
+        Mat4 inv = m.inverse();
+        mat<4, 4, float> ref = g.invert();
+        for (int i = 0; i < 4; i++)
+            for (int j = 0; j < 4; j++)
+                worst = std::max(worst, std::abs(inv[i][j] - ref[i][j]) / (1 + std::abs(ref[i][j])));
+    }
+    std::cout << "# inverse max rel error " << worst << std::endl;
+    return 0;
+}
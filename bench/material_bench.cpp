@@ -0,0 +1,127 @@
+#include <iostream>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <chrono>
+#include <algorithm>
+#include "../model.h"
+#include "../renderer.h"
+#include "bench_util.h"
+
+// The material path against the diffuse-only frame. The tangent frames of
+// the model are checked first (unit, orthogonal to their normal, and how
+// many agree with the uv gradient of the faces around them), then frames of
+// african_head are timed per shader. The repo ships no normal or specular
+// map, so the material run packs generated ones of the diffuse map's size:
+// a grid of tangent-space bumps and an exponent ramp. Exits non-zero if a
+// frame is not orthonormal.
+//   material_bench [size] [frames]
+
+// bumps of height sin(2 pi k u) * sin(2 pi k v), normals encoded as rgb
+static TGAImage bump_map(int w, int h, int k) {
+    TGAImage image(w, h, TGAImage::RGB);
+    const float a = .15f * 2 * (float)M_PI * k;
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            float u = 2 * (float)M_PI * k * x / w, v = 2 * (float)M_PI * k * y / h;
+            Vec3f n(-a * std::cos(u) * std::sin(v), -a * std::sin(u) * std::cos(v), 1);
+            n.normalize();
+            image.set(x, y, TGAColor((n.x + 1) * 127.5f, (n.y + 1) * 127.5f, (n.z + 1) * 127.5f, 255));
+        }
+    }
+    return image;
+}
+
+static TGAImage exponent_ramp(int w, int h) {
+    TGAImage image(w, h, TGAImage::GRAYSCALE);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) image.set(x, y, TGAColor(x * 40 / w, 1));
+    }
+    return image;
+}
+
+// largest deviation from an orthonormal frame; counts the corners whose
+// tangent points along their face's +u direction
+static float check_frames(Model &model, int &agree, int &corners) {
+    float worst = 0;
+    for (int i = 0; i < model.nvn_verts(); i++) {
+        Vec3f n = model.vn_vert(i), t = proj<3>(model.tangent(i));
+        n.normalize();
+        worst = std::max(worst, std::max(std::abs(t.norm() - 1), std::abs(t * n)));
+        worst = std::max(worst, std::abs(std::abs(model.tangent(i)[3]) - 1));
+    }
+    agree = corners = 0;
+    for (int f = 0; f < model.nfaces(); f++) {
+        Vec3f e1 = model.vert(f, 1) - model.vert(f, 0), e2 = model.vert(f, 2) - model.vert(f, 0);
+        Vec3f d1 = model.uv_vert(f, 1) - model.uv_vert(f, 0), d2 = model.uv_vert(f, 2) - model.uv_vert(f, 0);
+        float det = d1.x * d2.y - d2.x * d1.y;
+        if (std::abs(det) < 1e-12f) continue;
+        Vec3f tf = (e1 * d2.y - e2 * d1.y) * (1.f / det);
+        for (int k = 0; k < 3; k++, corners++) agree += proj<3>(model.tangent(model.face_norms(f)[k])) * tf > 0;
+    }
+    return worst;
+}
+
+static double render(Model &model, ShaderKind kind, const ShaderUniforms &uniforms, int size, int frames) {
+    RenderTarget target(size, size);
+    HiZBuffer hiz(size, size);
+    TileRasterizer rasterizer(size, size);
+    ScreenVerts screen_verts;
+    RasterStats stats;
+    double best = std::numeric_limits<double>::max();
+    for (int f = 0; f < frames; f++) {
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        target.clear();
+        hiz.clear(-std::numeric_limits<float>::max());
+        with_shader(kind, uniforms, [&](const auto &s) {
+            draw_model(model, rasterizer, screen_verts, false, target, &hiz, s, stats);
+        });
+        best = std::min(best, seconds_since(t0));
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    int size = argc > 1 ? atoi(argv[1]) : 800;
+    int frames = argc > 2 ? atoi(argv[2]) : 20;
+
+    Model model("obj/african_head/african_head.obj");
+    model.optimize();
+    int agree, corners;
+    float worst = check_frames(model, agree, corners);
+    std::cout << "tangent frames: max error " << worst << ", " << agree << "/" << corners << " corners along their face's +u" << std::endl;
+
+    TGAImage diffuse;
+    if (!diffuse.read_tga_file("obj/african_head/african_head_diffuse.tga")) return 1;
+    diffuse.flip_vertically();
+    Texture texture(diffuse);
+    TGAImage bumps = bump_map(diffuse.get_width(), diffuse.get_height(), 16);
+    TGAImage exponents = exponent_ramp(diffuse.get_width(), diffuse.get_height());
+    TGAImage surface;
+    pack_surface_map(&bumps, &exponents, 10.f, surface);
+    Texture surface_map(surface);
+
+    struct Config {
+        const char *name;
+        ShaderKind kind;
+        bool maps;
+    };
+    const Config configs[] = {
+        {"gouraud", SHADER_GOURAUD, false},
+        {"phong", SHADER_PHONG, false},
+        {"material, no maps", SHADER_MATERIAL, false},
+        {"material, surface map", SHADER_MATERIAL, true},
+    };
+    std::cout << size << "x" << size << ", best of " << frames << " frames" << std::endl;
+    std::cout << "shader\t\t\tms/frame" << std::endl;
+    double base = 0;
+    for (size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); i++) {
+        const Config &c = configs[i];
+        ShaderUniforms uniforms = {&texture, c.maps ? &surface_map : NULL, Mat4::identity(), Vec3f(0, 0, 1)};
+        double s = render(model, c.kind, uniforms, size, frames);
+        if (!i) base = s;
+        std::cout << c.name << (strlen(c.name) < 16 ? "\t\t" : "\t") << s * 1e3 << "\t(" << s / base << "x)" << std::endl;
+    }
+    return worst > 1e-3f ? 1 : 0;
+}
@@ -0,0 +1,116 @@
+#include <iostream>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <chrono>
+#include <algorithm>
+#include "../model.h"
+#include "../renderer.h"
+#include "bench_util.h"
+
+// Cost and quality of anti-aliasing african_head at one resolution: MSAA
+// (4x/8x, box and tent resolve) against brute-force supersampling, i.e.
+// rendering at 2x2 or 3x3 the size and shrinking with TGAImage::scale.
+// Times are the best frame of several and include clear and resolve/scale.
+// Quality is PSNR against a 4x4 supersampled frame averaged down, over the
+// whole image; scale() picks pixels rather than averaging them, so the
+// supersampled rows mostly show what that costs.
+//   msaa_bench [size] [frames] [threads]
+
+// best time over frames of drawing into target and resolving it to size x size
+static double render(Model &model, const Texture &texture, RenderTarget &target, int size, int frames, int nthreads, TGAImage &out) {
+    HiZBuffer hiz(target.width(), target.height());
+    TileRasterizer rasterizer(target.width(), target.height(), 64, nthreads);
+    ScreenVerts screen_verts;
+    RasterStats stats;
+    double best = std::numeric_limits<double>::max();
+    for (int f = 0; f < frames; f++) {
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        target.clear();
+        hiz.clear(-std::numeric_limits<float>::max());
+        draw_model(model, rasterizer, screen_verts, false, target, &hiz, GouraudShader(texture, Vec3f(0, 0, 1)), stats);
+        out = target.color();
+        if (target.width() != size) out.scale(size, size);
+        best = std::min(best, seconds_since(t0));
+    }
+    return best;
+}
+
+// n x n box average of a frame rendered at n times the size
+static TGAImage downsample(TGAImage &big, int n) {
+    int w = big.get_width() / n, h = big.get_height() / n;
+    TGAImage out(w, h, TGAImage::RGB);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            int sum[3] = {0, 0, 0};
+            for (int j = 0; j < n * n; j++) {
+                TGAColor c = big.get(x * n + j % n, y * n + j / n);
+                for (int i = 0; i < 3; i++) sum[i] += c.raw[i];
+            }
+            TGAColor c(0, 0, 0, 255);
+            for (int i = 0; i < 3; i++) c.raw[i] = (sum[i] + n * n / 2) / (n * n);
+            out.set(x, y, c);
+        }
+    }
+    return out;
+}
+
+static double psnr(TGAImage &a, TGAImage &b) {
+    double se = 0;
+    int n = a.get_width() * a.get_height() * 3;
+    for (int i = 0; i < n; i++) {
+        double d = a.buffer()[i] - b.buffer()[i];
+        se += d * d;
+    }
+    return se ? 10 * std::log10(255. * 255. * n / se) : std::numeric_limits<double>::infinity();
+}
+
+int main(int argc, char **argv) {
+    int size = argc > 1 ? atoi(argv[1]) : 800;
+    int frames = argc > 2 ? atoi(argv[2]) : 10;
+    int nthreads = argc > 3 ? atoi(argv[3]) : 0;
+
+    Model model("obj/african_head/african_head.obj");
+    TGAImage diffuse;
+    if (!diffuse.read_tga_file("obj/african_head/african_head_diffuse.tga")) return 1;
+    diffuse.flip_vertically();
+    Texture texture(diffuse);
+
+    TGAImage reference;
+    {
+        RenderTarget big(size * 4, size * 4);
+        TGAImage frame;
+        render(model, texture, big, size * 4, 1, nthreads, frame);
+        reference = downsample(frame, 4);
+    }
+
+    struct Config {
+        const char *name;
+        int scale;
+        int samples;
+        ResolveFilter filter;
+    };
+    const Config configs[] = {
+        {"1x", 1, 1, RESOLVE_BOX},
+        {"msaa 4x box", 1, 4, RESOLVE_BOX},
+        {"msaa 4x tent", 1, 4, RESOLVE_TENT},
+        {"msaa 8x box", 1, 8, RESOLVE_BOX},
+        {"msaa 8x tent", 1, 8, RESOLVE_TENT},
+        {"ssaa 2x2 scale", 2, 1, RESOLVE_BOX},
+        {"ssaa 3x3 scale", 3, 1, RESOLVE_BOX},
+    };
+    std::cout << size << "x" << size << ", best of " << frames << " frames" << std::endl;
+    std::cout << "config\t\tms/frame\tpsnr" << std::endl;
+    double base = 0;
+    for (size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); i++) {
+        const Config &c = configs[i];
+        RenderTarget target(size * c.scale, size * c.scale, DEPTH_FLOAT, c.samples);
+        target.set_resolve_filter(c.filter);
+        TGAImage out;
+        double s = render(model, texture, target, size, frames, nthreads, out);
+        if (!i) base = s;
+        std::cout << c.name << (strlen(c.name) < 8 ? "\t\t" : "\t") << s * 1e3 << "\t" << psnr(out, reference) << "\t(" << s / base << "x)" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <chrono>
+#include <algorithm>
+#include "../model.h"
+#include "../renderer.h"
+#include "bench_util.h"
+
+// The ray backend against the rasterizer. Reports the BVH build, then per
+// view (orthographic, and a perspective camera from the side) the primary
+// ray throughput of each trace mode on one thread without shading, whose
+// hits must match bit for bit, and a full Gouraud frame from both backends
+// with how many pixels they disagree on: coverage, and color differing by
+// more than 8 in some channel. Exits non-zero on a hit mismatch.
+//   ray_bench [file.obj] [frames]
+
+int main(int argc, char **argv) {
+    const char *obj = argc > 1 ? argv[1] : "obj/african_head/african_head.obj";
+    int frames = argc > 2 ? std::max(1, atoi(argv[2])) : 10;
+    const int size = 800;
+
+    Model model(obj);
+    if (model.nfaces() == 0) return 1;
+    model.optimize();
+    TGAImage diffuse;
+    if (!diffuse.read_tga_file("obj/african_head/african_head_diffuse.tga")) return 1;
+    diffuse.flip_vertically();
+    Texture texture(diffuse);
+
+    BVH bvh;
+    double build = best_of(frames, [&] { bvh.build(model); });
+    std::cout << obj << ": " << model.nfaces() << " faces, bvh " << bvh.nnodes() << " nodes, depth " << bvh.depth() << ", sah cost " << bvh.sah_cost() << ", built in " << build * 1e3 << " ms" << std::endl;
+
+    const int npackets = (size / CameraRays::PACKET_W) * (size / CameraRays::PACKET_H);
+    std::vector<PacketHits> hits[2];
+    hits[0].resize(npackets);
+    hits[1].resize(npackets);
+    TraceMode modes[2] = {TRACE_SCALAR, TRACE_AVX2};
+    int nmodes = best_trace_mode() == TRACE_AVX2 ? 2 : 1;
+    unsigned long mismatched = 0;
+
+    RenderTarget target(size, size), raster(size, size);
+    TileRasterizer rasterizer(size, size);
+    RayCaster caster(size, size);
+    HiZBuffer hiz(size, size);
+    ScreenVerts screen_verts;
+    RasterStats raster_stats;
+    RayStats ray_stats;
+    Vec3f eye(2, .5f, 2);
+    Mat4 cameras[2] = {Mat4::identity(), Mat4::projection(eye.norm()) * Mat4::lookat(eye, Vec3f(0, 0, 0), Vec3f(0, 1, 0))};
+    const char *names[2] = {"ortho", "perspective"};
+    for (int c = 0; c < 2; c++) {
+        CameraRays rays(cameras[c], size, size);
+        std::vector<RayPacket> packets(npackets);
+        for (int i = 0; i < npackets; i++) {
+            int x = (i % (size / CameraRays::PACKET_W)) * CameraRays::PACKET_W;
+            int y = (i / (size / CameraRays::PACKET_W)) * CameraRays::PACKET_H;
+            rays.packet(x, y, size, size, packets[i]);
+        }
+        std::cout << names[c] << " " << size << "x" << size << ", best of " << frames << std::endl;
+        for (int m = 0; m < nmodes; m++) {
+            TraceStats stats;
+            double trace = best_of(frames, [&] {
+                stats = TraceStats();
+                for (int i = 0; i < npackets; i++) bvh.intersect(modes[m], packets[i], hits[m][i], true, &stats);
+            });
+            std::cout << "  trace " << trace_mode_name(modes[m]) << ": " << trace * 1e3 << " ms, " << size * size / trace * 1e-6 << " Mrays/s on one thread, "
+                      << stats.nodes / (double)npackets << " nodes " << stats.triangles / (double)npackets << " triangles per packet" << std::endl;
+        }
+        if (nmodes == 2) {
+            for (int i = 0; i < npackets; i++) {
+                for (int l = 0; l < RAY_PACKET; l++) {
+                    const PacketHits &a = hits[0][i], &b = hits[1][i];
+                    mismatched += a.face[l] != b.face[l] || memcmp(&a.t[l], &b.t[l], sizeof(float)) || memcmp(&a.u[l], &b.u[l], sizeof(float)) || memcmp(&a.v[l], &b.v[l], sizeof(float));
+                }
+            }
+        }
+
+        Vec3f light_dir(0, 0, 1);
+        GouraudShader gouraud(texture, light_dir);
+        const Mat4 *camera = c ? &cameras[c] : NULL;
+        double ray_frame = best_of(frames, [&] {
+            target.clear();
+            raycast_model(model, bvh, caster, screen_verts, target, camera, gouraud, ray_stats);
+        });
+        double raster_frame = best_of(frames, [&] {
+            raster.clear();
+            hiz.clear(-std::numeric_limits<float>::max());
+            transform_model(model, screen_verts, size, size, camera);
+            rasterize_model(model, rasterizer, screen_verts, false, raster, &hiz, gouraud, raster_stats);
+        });
+        unsigned long coverage = 0, color = 0, covered = 0;
+        const float empty = -std::numeric_limits<float>::max();
+        for (int y = 0; y < size; y++) {
+            for (int x = 0; x < size; x++) {
+                bool a = target.depth(x, y) != empty, b = raster.depth(x, y) != empty;
+                covered += a;
+                if (a != b) {
+                    coverage++;
+                    continue;
+                }
+                TGAColor ca = target.color().get(x, y), cb = raster.color().get(x, y);
+                for (int k = 0; k < 3; k++) {
+                    if (std::abs(ca.raw[k] - cb.raw[k]) > 8) {
+                        color++;
+                        break;
+                    }
+                }
+            }
+        }
+        std::cout << "  frame on " << caster.nthreads() << " threads: ray " << ray_frame * 1e3 << " ms (" << size * size / ray_frame * 1e-6 << " Mrays/s), raster " << raster_frame * 1e3 << " ms" << std::endl;
+        std::cout << "  of " << covered << " covered pixels: coverage differs on " << coverage << ", color on " << color << std::endl;
+    }
+    std::cout << "hit mismatches: " << mismatched << std::endl;
+    return mismatched ? 1 : 0;
+}
@@ -0,0 +1,93 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <chrono>
+#include <algorithm>
+#include "../model.h"
+#include "../renderer.h"
+#include "bench_util.h"
+
+// The depth-only pass against the full raster path. Both render
+// african_head from the same light into a map of the same size, per raster
+// mode: render_shadow_map() through triangle_depth(), and rasterize_model()
+// with the Gouraud shader into a float RenderTarget. The two depth buffers
+// must match bit for bit. Then an 800x800 frame is timed without shadows
+// and with them (shadow pass included). Exits non-zero on a depth mismatch.
+//   shadow_bench [map size] [frames]
+
+int main(int argc, char **argv) {
+    int size = argc > 1 ? std::max(8, atoi(argv[1])) : 1024;
+    int frames = argc > 2 ? std::max(1, atoi(argv[2])) : 20;
+    const int frame_size = 800;
+
+    Model model("obj/african_head/african_head.obj");
+    if (model.nfaces() == 0) return 1;
+    model.optimize();
+    TGAImage diffuse;
+    if (!diffuse.read_tga_file("obj/african_head/african_head_diffuse.tga")) return 1;
+    diffuse.flip_vertically();
+    Texture texture(diffuse);
+    float radius = 0;
+    for (int i = 0; i < model.nverts(); i++) radius = std::max(radius, std::sqrt(model.vert(i) * model.vert(i)));
+    Vec3f light(.3f, 1, .6f);
+
+    ShadowMap map(size);
+    map.set_light(light, radius * 1.01f);
+    TileRasterizer rasterizer(size, size);
+    HiZBuffer hiz(size, size);
+    RenderTarget target(size, size);
+    ScreenVerts screen_verts;
+    RasterStats stats;
+    Vec3f light_dir = light;
+    light_dir.normalize();
+    GouraudShader gouraud(texture, light_dir);
+
+    RasterMode modes[2] = {RASTER_SCALAR, RASTER_AVX2};
+    int nmodes = best_raster_mode() == RASTER_AVX2 ? 2 : 1;
+    unsigned long mismatched = 0;
+    std::cout << size << "x" << size << " map, best of " << frames << " frames" << std::endl;
+    std::cout << "mode\tdepth-only ms\tfull ms\tspeedup" << std::endl;
+    for (int m = 0; m < nmodes; m++) {
+        rasterizer.set_mode(modes[m]);
+        double depth_only = best_of(frames, [&] {
+            render_shadow_map(model, rasterizer, screen_verts, false, map, &hiz, stats);
+        });
+        double full = best_of(frames, [&] {
+            target.clear();
+            hiz.clear(-std::numeric_limits<float>::max());
+            transform_model(model, screen_verts, size, size, &map.light());
+            rasterize_model(model, rasterizer, screen_verts, false, target, &hiz, gouraud, stats);
+        });
+        DepthView depth = map.depth();
+        for (int y = 0; y < size; y++) {
+            for (int x = 0; x < size; x++) {
+                float a = depth.at(x, y), b = target.depth(x, y);
+                mismatched += memcmp(&a, &b, sizeof(float)) != 0;
+            }
+        }
+        std::cout << raster_mode_name(modes[m]) << "\t" << depth_only * 1e3 << "\t\t" << full * 1e3 << "\t" << full / depth_only << "x" << std::endl;
+    }
+    std::cout << "depth mismatches: " << mismatched << std::endl;
+
+    // the frame: light from the same direction, viewer on +z
+    RenderTarget frame(frame_size, frame_size);
+    TileRasterizer frame_rasterizer(frame_size, frame_size);
+    HiZBuffer frame_hiz(frame_size, frame_size);
+    Mat4 lookup = map.from_screen(Mat4::identity(), frame_size, frame_size);
+    rasterizer.set_mode(best_raster_mode());
+    double plain = best_of(frames, [&] {
+        frame.clear();
+        frame_hiz.clear(-std::numeric_limits<float>::max());
+        draw_model(model, frame_rasterizer, screen_verts, false, frame, &frame_hiz, gouraud, stats);
+    });
+    double shadowed = best_of(frames, [&] {
+        render_shadow_map(model, rasterizer, screen_verts, false, map, &hiz, stats);
+        frame.clear();
+        frame_hiz.clear(-std::numeric_limits<float>::max());
+        draw_model(model, frame_rasterizer, screen_verts, false, frame, &frame_hiz, ShadowedShader<GouraudShader>(gouraud, map, lookup), stats);
+    });
+    std::cout << frame_size << "x" << frame_size << " frame: " << plain * 1e3 << " ms, with shadows " << shadowed * 1e3 << " ms (" << shadowed / plain << "x)" << std::endl;
+    return mismatched ? 1 : 0;
+}
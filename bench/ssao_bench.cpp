@@ -0,0 +1,59 @@
+#include <iostream>
+#include <cstdlib>
+#include <limits>
+#include <chrono>
+#include <algorithm>
+#include "../model.h"
+#include "../renderer.h"
+#include "../ssao.h"
+#include "bench_util.h"
+
+// Cost of the ssao post-pass against the raster pass that feeds it, at a
+// few resolutions. The pass only reads the depth buffer, so its time per
+// pixel should stay flat across sizes and meshes while the raster time
+// follows the geometry; the mean occlusion of the covered pixels is
+// printed as a sanity check.
+//   ssao_bench [file.obj] [frames]
+
+int main(int argc, char **argv) {
+    const char *obj = argc > 1 ? argv[1] : "obj/african_head/african_head.obj";
+    int frames = argc > 2 ? std::max(1, atoi(argv[2])) : 10;
+
+    Model model(obj);
+    if (model.nfaces() == 0) return 1;
+    model.optimize();
+    std::cout << obj << ": " << model.nfaces() << " faces, best of " << frames << " frames" << std::endl;
+    std::cout << "size\traster ms\tssao ms\tns/pixel\tmean ao" << std::endl;
+    const int sizes[] = {400, 800, 1600};
+    for (int s = 0; s < 3; s++) {
+        int size = sizes[s];
+        RenderTarget target(size, size);
+        TileRasterizer rasterizer(size, size);
+        HiZBuffer hiz(size, size);
+        AmbientOcclusion ao(size, size);
+        ScreenVerts screen_verts;
+        RasterStats stats;
+        double raster = std::numeric_limits<double>::max(), pass = raster;
+        for (int f = 0; f < frames; f++) {
+            std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+            target.clear();
+            hiz.clear(-std::numeric_limits<float>::max());
+            draw_model(model, rasterizer, screen_verts, false, target, &hiz, FlatShader(Vec3f(0, 0, 1)), stats);
+            raster = std::min(raster, seconds_since(t0));
+            t0 = std::chrono::steady_clock::now();
+            ao.apply(target);
+            pass = std::min(pass, seconds_since(t0));
+        }
+        double sum = 0;
+        unsigned long covered = 0;
+        for (int y = 0; y < size; y++) {
+            for (int x = 0; x < size; x++) {
+                if (target.depth(x, y) == -std::numeric_limits<float>::max()) continue;
+                sum += ao.occlusion(x, y);
+                covered++;
+            }
+        }
+        std::cout << size << "\t" << raster * 1e3 << "\t\t" << pass * 1e3 << "\t" << pass * 1e9 / ((double)size * size) << "\t\t" << sum / std::max(covered, 1UL) << std::endl;
+    }
+    return 0;
+}
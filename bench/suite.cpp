@@ -0,0 +1,330 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+#include <limits>
+#include <vector>
+#include <string>
+#include <map>
+#include <algorithm>
+#include <functional>
+#include "../model.h"
+#include "../renderer.h"
+#include "bench_util.h"
+
+// Benchmark suite with a regression gate, run by `make bench`. Every
+// benchmark runs a fixed number of iterations per repetition, after one
+// warmup repetition, and reports min / median / mean / stddev of the time
+// per iteration over the repetitions. With --baseline the minimum of each
+// benchmark is compared against the stored one (the minimum is the least
+// noisy of the four); any gated benchmark slower by more than the threshold
+// fails the run.
+//   suite [--filter substring] [--repetitions n] [--json out.json]
+//         [--baseline baseline.json] [--threshold fraction]
+
+static volatile float g_sink;
+
+struct Benchmark {
+    std::string name;
+    int iterations;
+    std::function<void()> body;
+    // reported against the baseline but never counted as a regression
+    bool gated = true;
+};
+
+struct Summary {
+    std::string name;
+    int iterations;
+    int repetitions;
+    double min_ns, median_ns, mean_ns, stddev_ns;
+};
+
+static Summary run_benchmark(const Benchmark &b, int repetitions) {
+    std::vector<double> samples;
+    for (int rep = -1; rep < repetitions; rep++) {
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < b.iterations; i++) b.body();
+        double ns = seconds_since(t0) / b.iterations * 1e9;
+        if (rep >= 0) samples.push_back(ns);
+    }
+    std::sort(samples.begin(), samples.end());
+    Summary s = {b.name, b.iterations, repetitions, samples.front(), 0, 0, 0};
+    size_t n = samples.size();
+    s.median_ns = n % 2 ? samples[n / 2] : (samples[n / 2 - 1] + samples[n / 2]) / 2;
+    for (size_t i = 0; i < n; i++) s.mean_ns += samples[i] / n;
+    for (size_t i = 0; i < n; i++) s.stddev_ns += (samples[i] - s.mean_ns) * (samples[i] - s.mean_ns) / n;
+    s.stddev_ns = std::sqrt(s.stddev_ns);
+    return s;
+}
+
+// one benchmark per line, so the baseline can be read back line by line
+static bool write_json(const char *filename, const std::vector<Summary> &results) {
+    std::ofstream out(filename);
+    if (!out.is_open()) {
+        std::cerr << "can't open file " << filename << std::endl;
+        return false;
+    }
+    out << "{\"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        const Summary &s = results[i];
+        out << "  {\"name\": \"" << s.name << "\", \"iterations\": " << s.iterations << ", \"repetitions\": " << s.repetitions
+            << ", \"min_ns\": " << s.min_ns << ", \"median_ns\": " << s.median_ns << ", \"mean_ns\": " << s.mean_ns
+            << ", \"stddev_ns\": " << s.stddev_ns << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "]}\n";
+    return out.good();
+}
+
+static bool read_baseline(const char *filename, std::map<std::string, double> &min_ns) {
+    std::ifstream in(filename);
+    if (!in.is_open()) {
+        std::cerr << "can't open file " << filename << std::endl;
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t name = line.find("\"name\": \"");
+        size_t min = line.find("\"min_ns\": ");
+        if (name == std::string::npos || min == std::string::npos) continue;
+        name += 9;
+        min_ns[line.substr(name, line.find('"', name) - name)] = atof(line.c_str() + min + 10);
+    }
+    return true;
+}
+
+// runs the shader over every weight, begin() again every 256 as a
+// rasterizer would per triangle; returns a sum of the colors
+template <class Shader>
+static float shade_fragments(Shader &shader, const TriangleSetup &setup, const std::vector<Vec3f> &bary) {
+    unsigned sum = 0;
+    for (size_t i = 0; i < bary.size(); i++) {
+        if (!(i & 255)) shader.begin(setup);
+        TGAColor c;
+        shader.fragment(bary[i], c);
+        sum += c.val;
+    }
+    return sum;
+}
+
+// everything the frame benchmarks need for one resolution and depth format
+struct Frame {
+    int width, height;
+    RenderTarget target;
+    HiZBuffer hiz;
+    TileRasterizer rasterizer;
+    ScreenVerts screen_verts;
+    RasterStats stats;
+
+    Frame(int w, int h, DepthFormat format = DEPTH_FLOAT) : width(w), height(h), target(w, h, format), hiz(w, h), rasterizer(w, h), screen_verts(), stats() {}
+    void draw(Model &model, const Texture &texture) {
+        hiz.clear(-std::numeric_limits<float>::max());
+        target.clear();
+        draw_model(model, rasterizer, screen_verts, false, target, &hiz, GouraudShader(texture, Vec3f(0, 0, 1)), stats);
+    }
+};
+
+int main(int argc, char **argv) {
+    const char *filter = "";
+    const char *json = NULL;
+    const char *baseline = NULL;
+    int repetitions = 5;
+    double threshold = .2;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--filter") && i + 1 < argc) filter = argv[++i];
+        else if (!strcmp(argv[i], "--repetitions") && i + 1 < argc) repetitions = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--json") && i + 1 < argc) json = argv[++i];
+        else if (!strcmp(argv[i], "--baseline") && i + 1 < argc) baseline = argv[++i];
+        else if (!strcmp(argv[i], "--threshold") && i + 1 < argc) threshold = atof(argv[++i]);
+        else {
+            std::cerr << "unknown argument " << argv[i] << std::endl;
+            return 2;
+        }
+    }
+
+    const char *obj = "obj/african_head/african_head.obj";
+    const char *diffuse = "obj/african_head/african_head_diffuse.tga";
+    TGAImage texture_image;
+    if (!texture_image.read_tga_file(diffuse)) return 2;
+    texture_image.flip_vertically();
+    Texture texture(texture_image);
+    Model model(obj);
+    if (model.nfaces() == 0) return 2;
+    model.optimize();
+    int tw = texture_image.get_width(), th = texture_image.get_height(), bpp = texture_image.get_bytespp();
+    std::vector<unsigned char> rle(TGAImage::max_rle_size(tw, bpp) * th);
+
+    // 256 small triangles at random depths in a 512x512 target
+    const int tri_size = 512;
+    std::vector<Triangle> tris(256);
+    srand(1);
+    for (size_t i = 0; i < tris.size(); i++) {
+        Vec3f c(rand() % (tri_size - 40) + 20, rand() % (tri_size - 40) + 20, rand() % 255);
+        for (int j = 0; j < 3; j++) {
+            tris[i].pts[j] = Vec3f(c.x + rand() % 41 - 20, c.y + rand() % 41 - 20, c.z);
+            tris[i].uv[j] = Vec3f(0, 0, 0);
+            tris[i].vn[j] = Vec3f(0, 0, 1);
+            tris[i].tn[j] = embed<4>(Vec3f(1, 0, 0), 1.f);
+            tris[i].rhw[j] = 1;
+        }
+    }
+    std::vector<float> tri_zbuffer(tri_size * tri_size);
+    DepthView tri_depth = {&tri_zbuffer[0], tri_size, 0, 0};
+    TGAImage tri_image(tri_size, tri_size, TGAImage::RGB);
+    Vec3f bary_pts[3] = {Vec3f(10, 10, 0), Vec3f(500, 40, 0), Vec3f(200, 480, 0)};
+    // one face of the head for the per-fragment cost of the shaders: 64k
+    // weights spread over it, begin() once per 256
+    Triangle face;
+    for (int j = 0; j < 3; j++) {
+        face.pts[j] = bary_pts[j];
+        face.uv[j] = Vec3f(.2f + .1f * j, .3f + .05f * j, 0);
+        face.vn[j] = Vec3f(.1f * j, .2f, 1).normalize();
+        face.tn[j] = embed<4>(Vec3f(1, 0, 0), 1.f);
+        face.rhw[j] = 1;
+    }
+    TriangleSetup face_setup = {&face, {-1, 1, 0}, {-1, 0, 1}, 1.f / 1024};
+    std::vector<Vec3f> face_bary(1 << 16);
+    for (size_t i = 0; i < face_bary.size(); i++) {
+        float b1 = rand() / (float)RAND_MAX, b2 = rand() / (float)RAND_MAX * (1 - b1);
+        face_bary[i] = Vec3f(1 - b1 - b2, b1, b2);
+    }
+
+    Mat4 a = Mat4::viewport(0, 0, 800, 800, 255) * Mat4::projection(3.f) * Mat4::lookat(Vec3f(1, 1, 3), Vec3f(0, 0, 0), Vec3f(0, 1, 0));
+    Mat4 b = a.inverse_transpose();
+    Matrix ha(4, 4), hb(4, 4);
+    for (int i = 0; i < 4; i++) {
+        for (int j = 0; j < 4; j++) {
+            ha[i][j] = a[i][j];
+            hb[i][j] = b[i][j];
+        }
+    }
+    Vec4f v = embed<4>(Vec3f(.3f, -.2f, .5f));
+
+    // the primary rays of an orthographic 512x512 frame, for the ray backend
+    const int ray_size = 512;
+    BVH bvh;
+    bvh.build(model);
+    CameraRays rays(Mat4::identity(), ray_size, ray_size);
+    std::vector<RayPacket> packets;
+    for (int y = 0; y < ray_size; y += CameraRays::PACKET_H) {
+        for (int x = 0; x < ray_size; x += CameraRays::PACKET_W) {
+            packets.push_back(RayPacket());
+            rays.packet(x, y, ray_size, ray_size, packets.back());
+        }
+    }
+
+    const int sizes[] = {256, 512, 1024, 2048};
+    std::vector<Frame *> frames;
+    for (int i = 0; i < 4; i++) frames.push_back(new Frame(sizes[i], sizes[i]));
+    frames.push_back(new Frame(1024, 1024, DEPTH_UNORM24));
+    frames.push_back(new Frame(1024, 1024, DEPTH_UNORM16));
+
+    std::vector<Benchmark> benchmarks;
+    // mostly allocation and page faults, which swing by well over the
+    // threshold between runs of the same build however long the sample is
+    benchmarks.push_back(Benchmark{"obj_parse", 100, [&] { Model m; m.load_obj(obj); g_sink = m.nverts(); }, false});
+    benchmarks.push_back(Benchmark{"tga_decode", 20, [&] { TGAImage img; img.read_tga_file(diffuse); g_sink = img.buffer()[0]; }});
+    benchmarks.push_back(Benchmark{"tga_encode", 20, [&] {
+        unsigned long size = 0;
+        for (int y = 0; y < th; y++) size += TGAImage::encode_rle(texture_image.buffer() + (unsigned long)y * tw * bpp, tw, bpp, &rle[size]);
+        g_sink = size;
+    }});
+    benchmarks.push_back(Benchmark{"barycentric_64k", 20, [&] {
+        float sum = 0;
+        for (int i = 0; i < 1 << 16; i++) sum += barycentric(bary_pts, Vec3f(i & 511, (i >> 7) & 511, 0)).x;
+        g_sink = sum;
+    }});
+    RasterMode modes[] = {RASTER_REFERENCE, RASTER_SCALAR, RASTER_AVX2};
+    for (int m = 0; m < 3; m++) {
+        if (modes[m] == RASTER_AVX2 && best_raster_mode() != RASTER_AVX2) continue;
+        RasterMode mode = modes[m];
+        benchmarks.push_back(Benchmark{std::string("triangle_256_") + raster_mode_name(mode), mode == RASTER_REFERENCE ? 20 : 200, [&, mode] {
+            std::fill(tri_zbuffer.begin(), tri_zbuffer.end(), -std::numeric_limits<float>::max());
+            FlatShader shader(Vec3f(0, 0, 1));
+            for (size_t i = 0; i < tris.size(); i++) triangle(mode, tris[i], tri_depth, tri_image, shader, 0, 0, tri_size, tri_size);
+        }});
+    }
+    benchmarks.push_back(Benchmark{"triangle_256_depth", 200, [&] {
+        std::fill(tri_zbuffer.begin(), tri_zbuffer.end(), -std::numeric_limits<float>::max());
+        for (size_t i = 0; i < tris.size(); i++) triangle_depth(best_raster_mode(), tris[i], tri_depth, 0, 0, tri_size, tri_size);
+    }});
+    benchmarks.push_back(Benchmark{"fragment_gouraud_64k", 100, [&] {
+        GouraudShader shader(texture, Vec3f(0, 0, 1));
+        g_sink = shade_fragments(shader, face_setup, face_bary);
+    }});
+    benchmarks.push_back(Benchmark{"fragment_phong_64k", 100, [&] {
+        PhongShader shader(texture, Vec3f(0, 0, 1));
+        g_sink = shade_fragments(shader, face_setup, face_bary);
+    }});
+    // the diffuse map stands in for a surface map, only the cost matters
+    benchmarks.push_back(Benchmark{"fragment_material_64k", 100, [&] {
+        MaterialShader shader(texture, &texture, Mat4::identity(), Vec3f(0, 0, 1));
+        g_sink = shade_fragments(shader, face_setup, face_bary);
+    }});
+    for (size_t i = 0; i < frames.size(); i++) {
+        Frame *f = frames[i];
+        std::ostringstream name;
+        name << "frame_" << f->width;
+        if (f->target.depth_format() != DEPTH_FLOAT) name << "_depth" << depth_format_name(f->target.depth_format());
+        benchmarks.push_back(Benchmark{name.str(), f->width <= 512 ? 40 : 10, [&, f] { f->draw(model, texture); }});
+    }
+    benchmarks.push_back(Benchmark{"bvh_build", 20, [&] { BVH b; b.build(model); g_sink = b.nnodes(); }});
+    benchmarks.push_back(Benchmark{"trace_512", 10, [&] {
+        PacketHits hits;
+        int n = 0;
+        for (size_t i = 0; i < packets.size(); i++) {
+            bvh.intersect(best_trace_mode(), packets[i], hits, true);
+            n += hits.face[0] >= 0;
+        }
+        g_sink = n;
+    }});
+    benchmarks.push_back(Benchmark{"mat4_product_1k", 200, [&] {
+        for (int i = 0; i < 1000; i++) { a[0][0] += 1e-9f; g_sink = (a * b)[1][1]; }
+    }});
+    benchmarks.push_back(Benchmark{"mat4_transform_1k", 200, [&] {
+        for (int i = 0; i < 1000; i++) { v[0] += 1e-9f; g_sink = (a * v)[3]; }
+    }});
+    benchmarks.push_back(Benchmark{"matrix_product_1k", 20, [&] {
+        for (int i = 0; i < 1000; i++) { ha[0][0] += 1e-9f; Matrix p = ha * hb; g_sink = p[1][1]; }
+    }});
+
+    std::map<std::string, double> base;
+    if (baseline && !read_baseline(baseline, base)) return 2;
+
+    std::vector<Summary> results;
+    int regressions = 0;
+    // the loaders report every file they read on stderr
+    std::streambuf *cerr_buf = std::cerr.rdbuf(NULL);
+    std::cout << "benchmark\t\titers\tmin us\tmedian\tmean\tstddev" << (baseline ? "\tbaseline\tchange" : "") << std::endl;
+    for (size_t i = 0; i < benchmarks.size(); i++) {
+        if (!strstr(benchmarks[i].name.c_str(), filter)) continue;
+        Summary s = run_benchmark(benchmarks[i], repetitions);
+        std::cerr.clear();
+        results.push_back(s);
+        std::cout << s.name << (s.name.size() < 16 ? "\t\t" : "\t") << s.iterations << "\t" << s.min_ns * 1e-3 << "\t" << s.median_ns * 1e-3
+                  << "\t" << s.mean_ns * 1e-3 << "\t" << s.stddev_ns * 1e-3;
+        std::map<std::string, double>::iterator it = base.find(s.name);
+        if (it != base.end()) {
+            double change = s.min_ns / it->second - 1;
+            std::cout << "\t" << it->second * 1e-3 << "\t" << (change >= 0 ? "+" : "") << change * 100 << "%";
+            if (!benchmarks[i].gated) {
+                std::cout << "\tnot gated";
+            } else if (change > threshold) {
+                std::cout << "\tREGRESSION";
+                regressions++;
+            }
+        } else if (baseline) {
+            std::cout << "\t-\tnew";
+        }
+        std::cout << std::endl;
+    }
+    std::cerr.rdbuf(cerr_buf);
+    for (size_t i = 0; i < frames.size(); i++) delete frames[i];
+    if (json && !write_json(json, results)) return 2;
+    if (baseline) {
+        std::cout << "# " << regressions << " regression(s) beyond " << threshold * 100 << "% against " << baseline << std::endl;
+    }
+    return regressions ? 1 : 0;
+}
@@ -0,0 +1,110 @@
+#include <iostream>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+#include <vector>
+#include "../texture.h"
+
+// Row-major against block-linear and Morton texel layouts for three uv
+// walks over the diffuse map: random, horizontal (along u, row after row)
+// and vertical (along v, column after column), with nearest and bilinear
+// filtering. Best of three runs. Beforehand every texel of every mip level
+// and a set of filtered samples of the block and Morton layouts are checked
+// against row-major, for the diffuse map and for an odd-sized, non-square
+// image; exits non-zero if any differs.
+//   swizzle_bench [samples]
+
+// texels and nearest / bilinear / trilinear samples at the n uv pairs
+// (spread over the levels) that differ between each layout and row-major
+static unsigned long compare_layouts(TGAImage &img, const std::vector<float> &uv, int n) {
+    Texture ref(img), other(img);
+    unsigned long mismatches = 0;
+    for (int layout = Texture::BLOCK_LINEAR; layout <= Texture::MORTON; layout++) {
+        other.set_layout((Texture::Layout)layout);
+        for (int l = 0; l < ref.nlevels(); l++) {
+            const Texture::Level &a = ref.level(l), &b = other.level(l);
+            if (a.width != b.width || a.height != b.height) {
+                mismatches++;
+                continue;
+            }
+            for (int y = 0; y < a.height; y++) {
+                for (int x = 0; x < a.width; x++) mismatches += ref.texel(a, x, y) != other.texel(b, x, y);
+            }
+        }
+        for (int filter = Texture::NEAREST; filter <= Texture::TRILINEAR; filter++) {
+            ref.set_filter((Texture::Filter)filter);
+            other.set_filter((Texture::Filter)filter);
+            for (int i = 0; i < n; i++) {
+                float lod = (i % 16) * ref.nlevels() / 16.f;
+                mismatches += ref.sample(uv[2 * i], uv[2 * i + 1], lod).val != other.sample(uv[2 * i], uv[2 * i + 1], lod).val;
+            }
+        }
+    }
+    return mismatches;
+}
+
+int main(int argc, char **argv) {
+    int nsamples = argc > 1 ? atoi(argv[1]) : 1 << 22;
+
+    TGAImage diffuse;
+    if (!diffuse.read_tga_file("obj/african_head/african_head_diffuse.tga")) return 1;
+    Texture texture(diffuse);
+    int w = texture.get_width(), h = texture.get_height();
+
+    const char *walk_names[] = {"random", "horizontal", "vertical"};
+    std::vector<float> walks[3];
+    srand(1);
+    for (int walk = 0; walk < 3; walk++) {
+        std::vector<float> &uv = walks[walk];
+        uv.resize(nsamples * 2);
+        for (int i = 0; i < nsamples; i++) {
+            int a = i % (w * h);
+            if (walk == 0) {
+                uv[2 * i] = rand() / (float)RAND_MAX;
+                uv[2 * i + 1] = rand() / (float)RAND_MAX;
+            } else if (walk == 1) {
+                uv[2 * i] = (a % w + .5f) / w;
+                uv[2 * i + 1] = (a / w + .5f) / h;
+            } else {
+                uv[2 * i] = (a / h + .5f) / w;
+                uv[2 * i + 1] = (a % h + .5f) / h;
+            }
+        }
+    }
+
+    TGAImage odd(37, 13, TGAImage::RGBA);
+    for (int y = 0; y < odd.get_height(); y++) {
+        for (int x = 0; x < odd.get_width(); x++) odd.set(x, y, TGAColor(rand() & 255, rand() & 255, rand() & 255, rand() & 255));
+    }
+    int nchecked = std::min(nsamples, 1 << 16);
+    unsigned long mismatches = compare_layouts(diffuse, walks[0], nchecked) + compare_layouts(odd, walks[0], nchecked);
+    std::cout << "# layout mismatches against row-major: " << mismatches << std::endl;
+
+    const char *layout_names[] = {"row-major", "block", "morton"};
+    const char *filter_names[] = {"nearest", "bilinear"};
+    std::cout << "ns/sample\t";
+    for (int walk = 0; walk < 3; walk++) std::cout << walk_names[walk] << "\t";
+    std::cout << std::endl;
+    for (int filter = Texture::NEAREST; filter <= Texture::BILINEAR; filter++) {
+        texture.set_filter((Texture::Filter)filter);
+        for (int layout = Texture::ROW_MAJOR; layout <= Texture::MORTON; layout++) {
+            texture.set_layout((Texture::Layout)layout);
+            std::cout << layout_names[layout] << "/" << filter_names[filter] << "\t";
+            for (int walk = 0; walk < 3; walk++) {
+                const std::vector<float> &uv = walks[walk];
+                unsigned int sink = 0;
+                double best = 1e30;
+                for (int rep = 0; rep < 3; rep++) {
+                    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+                    for (int i = 0; i < nsamples; i++) {
+                        sink += texture.sample(uv[2 * i], uv[2 * i + 1], 0.f).val;
+                    }
+                    best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+                }
+                std::cout << best * 1e9 / nsamples << (sink == 1 ? "*" : "") << "\t";
+            }
+            std::cout << std::endl;
+        }
+    }
+    return mismatches ? 1 : 0;
+}
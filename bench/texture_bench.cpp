@@ -0,0 +1,64 @@
+#include <iostream>
+#include <cstdlib>
+#include <limits>
+#include <chrono>
+#include "../model.h"
+#include "../renderer.h"
+#include "bench_util.h"
+
+// Cost of the texture paths: the checked get() against the three sampler
+// filters on random uvs, then whole frames of african_head per filter with
+// the time divided by the pixels shaded.
+//   texture_bench [samples] [frames]
+
+int main(int argc, char **argv) {
+    int nsamples = argc > 1 ? atoi(argv[1]) : 1 << 22;
+    int frames = argc > 2 ? atoi(argv[2]) : 20;
+
+    TGAImage diffuse;
+    if (!diffuse.read_tga_file("obj/african_head/african_head_diffuse.tga")) return 1;
+    diffuse.flip_vertically();
+    Texture texture(diffuse);
+    std::cout << texture.get_width() << "x" << texture.get_height() << ", " << texture.nlevels() << " mip levels" << std::endl;
+
+    std::vector<float> uv(nsamples * 3);
+    srand(1);
+    for (int i = 0; i < nsamples * 3; i += 3) {
+        uv[i] = rand() / (float)RAND_MAX;
+        uv[i + 1] = rand() / (float)RAND_MAX;
+        uv[i + 2] = 4.f * rand() / (float)RAND_MAX;
+    }
+    const char *names[] = {"get", "nearest", "bilinear", "trilinear"};
+    for (int mode = 0; mode < 4; mode++) {
+        if (mode > 0) texture.set_filter((Texture::Filter)(mode - 1));
+        unsigned int sink = 0;
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < nsamples * 3; i += 3) {
+            if (mode == 0) sink += texture.get(uv[i] * texture.get_width(), uv[i + 1] * texture.get_height()).val;
+            else sink += texture.sample(uv[i], uv[i + 1], uv[i + 2]).val;
+        }
+        double s = seconds_since(t0);
+        std::cout << names[mode] << "\t" << s * 1e9 / nsamples << " ns/sample\t(" << sink % 10 << ")" << std::endl;
+    }
+
+    const int width = 800, height = 800;
+    Model model("obj/african_head/african_head.obj");
+    RenderTarget target(width, height);
+    HiZBuffer hiz(width, height);
+    TileRasterizer rasterizer(width, height, 64, 1);
+    ScreenVerts screen_verts;
+    RasterStats stats;
+    for (int filter = Texture::NEAREST; filter <= Texture::TRILINEAR; filter++) {
+        texture.set_filter((Texture::Filter)filter);
+        double total = 0;
+        for (int f = 0; f < frames; f++) {
+            target.clear();
+            hiz.clear(-std::numeric_limits<float>::max());
+            std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+            draw_model(model, rasterizer, screen_verts, false, target, &hiz, GouraudShader(texture, Vec3f(0, 0, 1)), stats);
+            total += seconds_since(t0);
+        }
+        std::cout << names[filter + 1] << "\t" << total * 1e3 / frames << " ms/frame\t" << total * 1e9 / frames / stats.pixels_shaded << " ns/shaded pixel" << std::endl;
+    }
+    return 0;
+}
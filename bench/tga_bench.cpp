@@ -0,0 +1,59 @@
+#include <iostream>
+#include <cstdlib>
+#include <chrono>
+#include <vector>
+#include "../tgaimage.h"
+#include "bench_util.h"
+
+// TGA codec throughput in MB/s of decoded pixels, best of N runs: reading
+// the RLE diffuse map and an uncompressed copy of it, encoding it in memory,
+// and writing it back through write_tga_file and TGAWriter.
+//   tga_bench [runs]
+
+static void report(const char *name, double mbytes, double best) {
+    std::cout << name << "\t" << mbytes / best << " MB/s\t(" << best * 1e3 << " ms)" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    int runs = argc > 1 ? atoi(argv[1]) : 10;
+    const char *diffuse = "obj/african_head/african_head_diffuse.tga";
+
+    TGAImage image;
+    if (!image.read_tga_file(diffuse)) return 1;
+    int w = image.get_width(), h = image.get_height(), bpp = image.get_bytespp();
+    double mbytes = (double)w * h * bpp / (1 << 20);
+    image.write_tga_file("/tmp/tga_bench_raw.tga", false);
+
+    const char *names[] = {"read rle", "read raw", "encode rle", "write rle", "write raw", "stream rle"};
+    std::vector<unsigned char> buffer(TGAImage::max_rle_size(w, bpp) * h);
+    unsigned long encoded = 0;
+    for (int test = 0; test < 6; test++) {
+        double best = 1e30;
+        for (int run = 0; run < runs; run++) {
+            std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+            switch (test) {
+                case 0: image.read_tga_file(diffuse); break;
+                case 1: image.read_tga_file("/tmp/tga_bench_raw.tga"); break;
+                case 2:
+                    encoded = 0;
+                    for (int y = 0; y < h; y++) {
+                        encoded += TGAImage::encode_rle(image.buffer() + (unsigned long)y * w * bpp, w, bpp, &buffer[encoded]);
+                    }
+                    break;
+                case 3: image.write_tga_file("/tmp/tga_bench_out.tga", true); break;
+                case 4: image.write_tga_file("/tmp/tga_bench_out.tga", false); break;
+                case 5: {
+                    TGAWriter writer;
+                    writer.open("/tmp/tga_bench_out.tga", image);
+                    for (int y = 64; y <= h; y += 64) writer.rows_ready(y);
+                    writer.close();
+                    break;
+                }
+            }
+            best = std::min(best, seconds_since(t0));
+        }
+        report(names[test], mbytes, best);
+    }
+    std::cout << "# rle ratio " << (double)encoded / (w * h * bpp) << std::endl;
+    return 0;
+}
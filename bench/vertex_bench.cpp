@@ -0,0 +1,90 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <stdint.h>
+#include "../model.h"
+#include "../renderer.h"
+#include "bench_util.h"
+
+// Vertex stage: ns per vertex of the scalar reference and the AVX2 path, on
+// the model's positions and on a large random cloud through a perspective
+// camera, plus the largest difference between the two in ULPs. Exits
+// non-zero if they differ by more than one ULP or in any outcode, or if
+// primitive assembly loses a face whose corners are outside the guard band
+// on different sides but which covers the whole screen.
+//   vertex_bench [obj] [iterations]
+
+static int64_t ulp_distance(float a, float b) {
+    if (a == b) return 0;
+    if (a != a || b != b) return INT64_MAX;
+    int32_t ia, ib;
+    memcpy(&ia, &a, 4);
+    memcpy(&ib, &b, 4);
+    // map the sign-magnitude encoding onto a monotonic integer line
+    int64_t la = ia < 0 ? (int64_t)INT32_MIN - ia : ia;
+    int64_t lb = ib < 0 ? (int64_t)INT32_MIN - ib : ib;
+    return la > lb ? la - lb : lb - la;
+}
+
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : "obj/african_head/african_head.obj";
+    int iterations = argc > 2 ? atoi(argv[2]) : 200;
+    Model model(path);
+    std::vector<Vec3f> cloud(1 << 20);
+    srand(1);
+    for (size_t i = 0; i < cloud.size(); i++) {
+        cloud[i] = Vec3f(rand() / (float)RAND_MAX * 2 - 1, rand() / (float)RAND_MAX * 2 - 1, rand() / (float)RAND_MAX * 2 - 1);
+    }
+    Mat4 camera = Mat4::projection(3.f) * Mat4::lookat(Vec3f(1, 1, 3), Vec3f(0, 0, 0), Vec3f(0, 1, 0));
+
+    const char *set_names[] = {"model", "cloud"};
+    const Vec3f *sets[] = {&model.vert(0), &cloud[0]};
+    int sizes[] = {model.nverts(), (int)cloud.size()};
+    int64_t worst = 0;
+    int outcode_mismatches = 0;
+    std::cout << "ns/vertex\tscalar\tavx2" << std::endl;
+    for (int set = 0; set < 2; set++) {
+        int reps = set == 0 ? iterations * 10 : std::max(1, iterations / 20);
+        ScreenVerts out[2];
+        std::cout << set_names[set] << " (" << sizes[set] << ")";
+        for (int mode = VERTEX_SCALAR; mode <= VERTEX_AVX2; mode++) {
+            if (mode == VERTEX_AVX2 && best_vertex_mode() != VERTEX_AVX2) {
+                std::cout << "\t-";
+                continue;
+            }
+            double best = 1e30;
+            for (int rep = 0; rep < reps; rep++) {
+                std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+                transform_vertices((VertexMode)mode, sets[set], sizes[set], camera, 800, 800, DEPTH, out[mode]);
+                best = std::min(best, seconds_since(t0));
+            }
+            std::cout << "\t" << best / sizes[set] * 1e9;
+        }
+        std::cout << std::endl;
+        if (out[VERTEX_AVX2].size() == 0) continue;
+        for (int i = 0; i < sizes[set]; i++) {
+            worst = std::max(worst, ulp_distance(out[0].x[i], out[1].x[i]));
+            worst = std::max(worst, ulp_distance(out[0].y[i], out[1].y[i]));
+            worst = std::max(worst, ulp_distance(out[0].z[i], out[1].z[i]));
+            worst = std::max(worst, ulp_distance(out[0].rhw[i], out[1].rhw[i]));
+            outcode_mismatches += out[0].outcode[i] != out[1].outcode[i];
+        }
+    }
+
+    Vec3f big[3] = {Vec3f(-10, -10, 0), Vec3f(10, -10, 0), Vec3f(0, 10, 0)};
+    ScreenVerts big_verts;
+    transform_vertices(VERTEX_SCALAR, big, 3, Mat4::identity(), 64, 64, DEPTH, big_verts);
+    Triangle t, clipped[MAX_CLIPPED_TRIANGLES];
+    for (int j = 0; j < 3; j++) {
+        t.pts[j] = big_verts[j];
+        t.uv[j] = Vec3f(0, 0, 0);
+        t.vn[j] = Vec3f(0, 0, 1);
+        t.tn[j] = embed<4>(Vec3f(1, 0, 0), 1.f);
+        t.rhw[j] = big_verts.rhw[j];
+    }
+    RasterStats stats;
+    int big_tris = assemble_triangle(t, big, &big_verts.outcode[0], big_verts, false, clipped, stats);
+    std::cout << "# max difference " << worst << " ulp, " << outcode_mismatches << " outcode mismatches, guard-band face assembled into " << big_tris << " triangle(s)" << std::endl;
+    return worst > 1 || outcode_mismatches || big_tris == 0 ? 1 : 0;
+}
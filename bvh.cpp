@@ -0,0 +1,382 @@
+#include <cfloat>
+#include <algorithm>
+#include "bvh.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TRACE_HAS_AVX2 1
+#endif
+
+TraceMode best_trace_mode() {
+#ifdef TRACE_HAS_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return TRACE_AVX2;
+#endif
+    return TRACE_SCALAR;
+}
+
+const char *trace_mode_name(TraceMode mode) {
+    switch (mode) {
+        case TRACE_SCALAR: return "scalar";
+        case TRACE_AVX2: return "avx2";
+    }
+    return "unknown";
+}
+
+TraceStats::TraceStats() : packets(0), nodes(0), triangles(0) {}
+
+void TraceStats::add(const TraceStats &o) {
+    packets += o.packets;
+    nodes += o.nodes;
+    triangles += o.triangles;
+}
+
+namespace {
+
+// a node test against one triangle test in the heuristic
+const float TRAVERSAL_COST = 1.f;
+
+struct Bounds {
+    Vec3f lo, hi;
+
+    Bounds() : lo(FLT_MAX, FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX, -FLT_MAX) {}
+    void grow(const Vec3f &p) {
+        for (int i = 0; i < 3; i++) {
+            lo[i] = std::min(lo[i], p[i]);
+            hi[i] = std::max(hi[i], p[i]);
+        }
+    }
+    void grow(const Bounds &b) {
+        grow(b.lo);
+        grow(b.hi);
+    }
+    float area() const {
+        if (lo.x > hi.x) return 0.f;
+        Vec3f e = hi - lo;
+        return 2.f * (e.x * e.y + e.y * e.z + e.z * e.x);
+    }
+};
+
+float node_area(const BVH::Node &n) {
+    Bounds b;
+    b.lo = n.lo;
+    b.hi = n.hi;
+    return b.area();
+}
+
+}
+
+struct BVH::BuildContext {
+    std::vector<int> faces;
+    std::vector<Bounds> boxes;
+    std::vector<Vec3f> centroids;
+};
+
+BVH::BVH() : nodes_(), tris_(), depth_(0) {}
+
+void BVH::build(Model &model) {
+    int n = model.nfaces();
+    nodes_.clear();
+    tris_.clear();
+    depth_ = 0;
+    if (n == 0) return;
+    BuildContext ctx;
+    ctx.faces.resize(n);
+    ctx.boxes.resize(n);
+    ctx.centroids.resize(n);
+    for (int i = 0; i < n; i++) {
+        ctx.faces[i] = i;
+        for (int j = 0; j < 3; j++) ctx.boxes[i].grow(model.vert(i, j));
+        ctx.centroids[i] = (ctx.boxes[i].lo + ctx.boxes[i].hi) * .5f;
+    }
+    nodes_.reserve(2 * n);
+    build_node(ctx, 0, n, 0);
+    tris_.resize(n);
+    for (int i = 0; i < n; i++) {
+        int f = ctx.faces[i];
+        Vec3f v0 = model.vert(f, 0);
+        tris_[i].v0 = v0;
+        tris_[i].e1 = model.vert(f, 1) - v0;
+        tris_[i].e2 = model.vert(f, 2) - v0;
+        tris_[i].face = f;
+    }
+}
+
+// Splits faces [begin, end) at the cheapest of the BINS - 1 planes per axis
+// between centroid bins, or makes a leaf when that is cheaper and the run is
+// short enough. Runs whose centroids all coincide are halved.
+void BVH::build_node(BuildContext &ctx, int begin, int end, int depth) {
+    depth_ = std::max(depth_, depth + 1);
+    int index = (int)nodes_.size();
+    nodes_.push_back(Node());
+    Bounds box, cbox;
+    for (int i = begin; i < end; i++) {
+        box.grow(ctx.boxes[ctx.faces[i]]);
+        cbox.grow(ctx.centroids[ctx.faces[i]]);
+    }
+    nodes_[index].lo = box.lo;
+    nodes_[index].hi = box.hi;
+    int n = end - begin;
+    bool at_limit = n == 1 || depth + 1 >= MAX_DEPTH;
+    int axis = -1, split = 0;
+    float best = FLT_MAX;
+    for (int a = 0; a < 3 && !at_limit; a++) {
+        float extent = cbox.hi[a] - cbox.lo[a];
+        if (extent <= 0.f) continue;
+        float scale = BINS / extent;
+        Bounds bins[BINS];
+        int counts[BINS] = {0};
+        for (int i = begin; i < end; i++) {
+            int f = ctx.faces[i];
+            int b = std::min(BINS - 1, (int)((ctx.centroids[f][a] - cbox.lo[a]) * scale));
+            counts[b]++;
+            bins[b].grow(ctx.boxes[f]);
+        }
+        // plane b has bins [0, b) on its left
+        float right_area[BINS];
+        int right_count[BINS];
+        Bounds acc;
+        int count = 0;
+        for (int b = BINS - 1; b > 0; b--) {
+            acc.grow(bins[b]);
+            count += counts[b];
+            right_area[b] = acc.area();
+            right_count[b] = count;
+        }
+        acc = Bounds();
+        count = 0;
+        for (int b = 1; b < BINS; b++) {
+            acc.grow(bins[b - 1]);
+            count += counts[b - 1];
+            if (count == 0 || right_count[b] == 0) continue;
+            float cost = count * acc.area() + right_count[b] * right_area[b];
+            if (cost < best) {
+                best = cost;
+                axis = a;
+                split = b;
+            }
+        }
+    }
+    float split_cost = axis >= 0 ? TRAVERSAL_COST + best / std::max(box.area(), FLT_MIN) : FLT_MAX;
+    if (at_limit || (n <= MAX_LEAF && n <= split_cost)) {
+        nodes_[index].offset = begin;
+        nodes_[index].count = n;
+        return;
+    }
+    int mid;
+    if (axis >= 0) {
+        float lo = cbox.lo[axis], scale = BINS / (cbox.hi[axis] - cbox.lo[axis]);
+        mid = (int)(std::partition(ctx.faces.begin() + begin, ctx.faces.begin() + end, [&](int f) {
+            return std::min(BINS - 1, (int)((ctx.centroids[f][axis] - lo) * scale)) < split;
+        }) - ctx.faces.begin());
+    } else {
+        Vec3f e = box.hi - box.lo;
+        axis = e.x >= e.y && e.x >= e.z ? 0 : (e.y >= e.z ? 1 : 2);
+        mid = begin + n / 2;
+    }
+    nodes_[index].count = -axis;
+    build_node(ctx, begin, mid, depth + 1);
+    nodes_[index].offset = (int)nodes_.size();
+    build_node(ctx, mid, end, depth + 1);
+}
+
+float BVH::sah_cost() const {
+    if (nodes_.empty()) return 0.f;
+    float root = std::max(node_area(nodes_[0]), FLT_MIN);
+    float cost = 0.f;
+    for (size_t i = 0; i < nodes_.size(); i++) {
+        const Node &n = nodes_[i];
+        cost += node_area(n) / root * (n.count > 0 ? (float)n.count : TRAVERSAL_COST);
+    }
+    return cost;
+}
+
+namespace {
+
+// the lane-wise min and max of the AVX2 path, NaN handling included
+inline float lane_min(float a, float b) { return a < b ? a : b; }
+inline float lane_max(float a, float b) { return a > b ? a : b; }
+
+// 1/d for the slab test; a zero component would make 0 * inf on a slab
+// plane, a tiny one keeps the product finite
+inline float slab_inverse(float d) {
+    return 1.f / (d != 0.f ? d : 1e-20f);
+}
+
+// Shared by both modes: the packet, its inverse directions and the closest
+// hits so far (tmax until something is hit).
+struct PacketState {
+    const RayPacket *p;
+    float ix[RAY_PACKET], iy[RAY_PACKET], iz[RAY_PACKET];
+    PacketHits *hits;
+};
+
+// the child to visit first along axis, by the direction of lane 0
+inline int near_child(const BVH::Node &n, int index, const RayPacket &p) {
+    int axis = -n.count;
+    float d = axis == 0 ? p.dx[0] : (axis == 1 ? p.dy[0] : p.dz[0]);
+    return d < 0.f ? n.offset : index + 1;
+}
+
+bool box_scalar(const BVH::Node &n, const PacketState &s) {
+    const RayPacket &p = *s.p;
+    bool any = false;
+    for (int i = 0; i < RAY_PACKET; i++) {
+        float x0 = (n.lo.x - p.ox[i]) * s.ix[i], x1 = (n.hi.x - p.ox[i]) * s.ix[i];
+        float y0 = (n.lo.y - p.oy[i]) * s.iy[i], y1 = (n.hi.y - p.oy[i]) * s.iy[i];
+        float z0 = (n.lo.z - p.oz[i]) * s.iz[i], z1 = (n.hi.z - p.oz[i]) * s.iz[i];
+        float tnear = lane_max(lane_max(lane_max(lane_min(x0, x1), lane_min(y0, y1)), lane_min(z0, z1)), p.tmin[i]);
+        float tfar = lane_min(lane_min(lane_min(lane_max(x0, x1), lane_max(y0, y1)), lane_max(z0, z1)), s.hits->t[i]);
+        any = any || tnear <= tfar;
+    }
+    return any;
+}
+
+// Moller-Trumbore, every lane against one triangle
+void triangle_scalar(const BVH::Triangle &tri, PacketState &s, bool cull) {
+    const RayPacket &p = *s.p;
+    PacketHits &h = *s.hits;
+    for (int i = 0; i < RAY_PACKET; i++) {
+        float px = p.dy[i] * tri.e2.z - p.dz[i] * tri.e2.y;
+        float py = p.dz[i] * tri.e2.x - p.dx[i] * tri.e2.z;
+        float pz = p.dx[i] * tri.e2.y - p.dy[i] * tri.e2.x;
+        float det = tri.e1.x * px + tri.e1.y * py + tri.e1.z * pz;
+        float inv_det = 1.f / det;
+        float sx = p.ox[i] - tri.v0.x, sy = p.oy[i] - tri.v0.y, sz = p.oz[i] - tri.v0.z;
+        float u = (sx * px + sy * py + sz * pz) * inv_det;
+        float qx = sy * tri.e1.z - sz * tri.e1.y;
+        float qy = sz * tri.e1.x - sx * tri.e1.z;
+        float qz = sx * tri.e1.y - sy * tri.e1.x;
+        float v = (p.dx[i] * qx + p.dy[i] * qy + p.dz[i] * qz) * inv_det;
+        float t = (tri.e2.x * qx + tri.e2.y * qy + tri.e2.z * qz) * inv_det;
+        bool facing = cull ? det > 0.f : det != 0.f;
+        if (facing && u >= 0.f && v >= 0.f && u + v <= 1.f && t > p.tmin[i] && t < h.t[i]) {
+            h.t[i] = t;
+            h.u[i] = u;
+            h.v[i] = v;
+            h.face[i] = tri.face;
+        }
+    }
+}
+
+void intersect_scalar(const BVH::Node *nodes, const BVH::Triangle *tris, PacketState &s, bool cull, TraceStats &stats) {
+    int stack[BVH::MAX_DEPTH];
+    int sp = 0, index = 0;
+    for (;;) {
+        const BVH::Node &n = nodes[index];
+        stats.nodes++;
+        if (box_scalar(n, s)) {
+            if (n.count <= 0) {
+                int first = near_child(n, index, *s.p);
+                stack[sp++] = first == index + 1 ? n.offset : index + 1;
+                index = first;
+                continue;
+            }
+            stats.triangles += n.count;
+            for (int i = 0; i < n.count; i++) triangle_scalar(tris[n.offset + i], s, cull);
+        }
+        if (sp == 0) break;
+        index = stack[--sp];
+    }
+}
+
+#ifdef TRACE_HAS_AVX2
+// The scalar loops eight lanes wide: same operations in the same order, so
+// the hits match bit for bit.
+__attribute__((target("avx2")))
+void intersect_avx2(const BVH::Node *nodes, const BVH::Triangle *tris, PacketState &s, bool cull, TraceStats &stats) {
+    const RayPacket &p = *s.p;
+    PacketHits &h = *s.hits;
+    __m256 ox = _mm256_loadu_ps(p.ox), oy = _mm256_loadu_ps(p.oy), oz = _mm256_loadu_ps(p.oz);
+    __m256 dx = _mm256_loadu_ps(p.dx), dy = _mm256_loadu_ps(p.dy), dz = _mm256_loadu_ps(p.dz);
+    __m256 ix = _mm256_loadu_ps(s.ix), iy = _mm256_loadu_ps(s.iy), iz = _mm256_loadu_ps(s.iz);
+    __m256 tmin = _mm256_loadu_ps(p.tmin);
+    __m256 best = _mm256_loadu_ps(h.t), best_u = _mm256_loadu_ps(h.u), best_v = _mm256_loadu_ps(h.v);
+    __m256 best_face = _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i *)h.face));
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.f);
+    int stack[BVH::MAX_DEPTH];
+    int sp = 0, index = 0;
+    for (;;) {
+        const BVH::Node &n = nodes[index];
+        stats.nodes++;
+        __m256 x0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(n.lo.x), ox), ix), x1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(n.hi.x), ox), ix);
+        __m256 y0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(n.lo.y), oy), iy), y1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(n.hi.y), oy), iy);
+        __m256 z0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(n.lo.z), oz), iz), z1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(n.hi.z), oz), iz);
+        __m256 tnear = _mm256_max_ps(_mm256_max_ps(_mm256_max_ps(_mm256_min_ps(x0, x1), _mm256_min_ps(y0, y1)), _mm256_min_ps(z0, z1)), tmin);
+        __m256 tfar = _mm256_min_ps(_mm256_min_ps(_mm256_min_ps(_mm256_max_ps(x0, x1), _mm256_max_ps(y0, y1)), _mm256_max_ps(z0, z1)), best);
+        if (_mm256_movemask_ps(_mm256_cmp_ps(tnear, tfar, _CMP_LE_OQ))) {
+            if (n.count <= 0) {
+                int first = near_child(n, index, p);
+                stack[sp++] = first == index + 1 ? n.offset : index + 1;
+                index = first;
+                continue;
+            }
+            stats.triangles += n.count;
+            for (int i = 0; i < n.count; i++) {
+                const BVH::Triangle &tri = tris[n.offset + i];
+                __m256 e1x = _mm256_set1_ps(tri.e1.x), e1y = _mm256_set1_ps(tri.e1.y), e1z = _mm256_set1_ps(tri.e1.z);
+                __m256 e2x = _mm256_set1_ps(tri.e2.x), e2y = _mm256_set1_ps(tri.e2.y), e2z = _mm256_set1_ps(tri.e2.z);
+                __m256 px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+                __m256 py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+                __m256 pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+                __m256 det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+                __m256 inv_det = _mm256_div_ps(one, det);
+                __m256 sx = _mm256_sub_ps(ox, _mm256_set1_ps(tri.v0.x));
+                __m256 sy = _mm256_sub_ps(oy, _mm256_set1_ps(tri.v0.y));
+                __m256 sz = _mm256_sub_ps(oz, _mm256_set1_ps(tri.v0.z));
+                __m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)), _mm256_mul_ps(sz, pz)), inv_det);
+                __m256 qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+                __m256 qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+                __m256 qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+                __m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)), _mm256_mul_ps(dz, qz)), inv_det);
+                __m256 t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)), _mm256_mul_ps(e2z, qz)), inv_det);
+                __m256 hit = cull ? _mm256_cmp_ps(det, zero, _CMP_GT_OQ) : _mm256_cmp_ps(det, zero, _CMP_NEQ_UQ);
+                hit = _mm256_and_ps(hit, _mm256_cmp_ps(u, zero, _CMP_GE_OQ));
+                hit = _mm256_and_ps(hit, _mm256_cmp_ps(v, zero, _CMP_GE_OQ));
+                hit = _mm256_and_ps(hit, _mm256_cmp_ps(_mm256_add_ps(u, v), one, _CMP_LE_OQ));
+                hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, tmin, _CMP_GT_OQ));
+                hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, best, _CMP_LT_OQ));
+                if (!_mm256_movemask_ps(hit)) continue;
+                best = _mm256_blendv_ps(best, t, hit);
+                best_u = _mm256_blendv_ps(best_u, u, hit);
+                best_v = _mm256_blendv_ps(best_v, v, hit);
+                best_face = _mm256_blendv_ps(best_face, _mm256_castsi256_ps(_mm256_set1_epi32(tri.face)), hit);
+            }
+        }
+        if (sp == 0) break;
+        index = stack[--sp];
+    }
+    _mm256_storeu_ps(h.t, best);
+    _mm256_storeu_ps(h.u, best_u);
+    _mm256_storeu_ps(h.v, best_v);
+    _mm256_storeu_si256((__m256i *)h.face, _mm256_castps_si256(best_face));
+}
+#endif
+
+}
+
+void BVH::intersect(TraceMode mode, const RayPacket &packet, PacketHits &hits, bool cull_backfaces, TraceStats *stats) const {
+    PacketState s;
+    s.p = &packet;
+    s.hits = &hits;
+    for (int i = 0; i < RAY_PACKET; i++) {
+        hits.t[i] = packet.tmax[i];
+        hits.u[i] = 0.f;
+        hits.v[i] = 0.f;
+        hits.face[i] = -1;
+        s.ix[i] = slab_inverse(packet.dx[i]);
+        s.iy[i] = slab_inverse(packet.dy[i]);
+        s.iz[i] = slab_inverse(packet.dz[i]);
+    }
+    if (nodes_.empty()) return;
+    TraceStats local;
+    local.packets = 1;
+#ifdef TRACE_HAS_AVX2
+    if (mode == TRACE_AVX2) {
+        intersect_avx2(nodes_.data(), tris_.data(), s, cull_backfaces, local);
+    } else
+#endif
+    intersect_scalar(nodes_.data(), tris_.data(), s, cull_backfaces, local);
+    (void)mode;
+    if (stats) stats->add(local);
+}
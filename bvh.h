@@ -0,0 +1,95 @@
+#ifndef __BVH_H__
+#define __BVH_H__
+
+#include <vector>
+#include "geometry.h"
+#include "model.h"
+
+enum TraceMode {
+	TRACE_SCALAR, // the packet's rays one lane at a time, the reference
+	TRACE_AVX2    // all eight lanes at once, same operation order
+};
+
+// AVX2 when the CPU has it
+TraceMode best_trace_mode();
+const char *trace_mode_name(TraceMode mode);
+
+// Eight rays traced together, one array per component. A ray covers the
+// points o + t * d with tmin < t < tmax; a lane with tmax <= tmin is
+// inactive and never hits.
+enum { RAY_PACKET = 8 };
+
+struct RayPacket {
+	float ox[RAY_PACKET], oy[RAY_PACKET], oz[RAY_PACKET];
+	float dx[RAY_PACKET], dy[RAY_PACKET], dz[RAY_PACKET];
+	float tmin[RAY_PACKET];
+	float tmax[RAY_PACKET];
+};
+
+// The nearest hit of each ray: face of the model (-1 for a miss), its t and
+// the weights u, v of the face's corners 1 and 2 (corner 0 has 1 - u - v).
+struct PacketHits {
+	float t[RAY_PACKET];
+	float u[RAY_PACKET];
+	float v[RAY_PACKET];
+	int face[RAY_PACKET];
+};
+
+// work done per packet, each node or triangle test counting once for all
+// eight lanes
+struct TraceStats {
+	unsigned long packets;
+	unsigned long nodes;
+	unsigned long triangles;
+
+	TraceStats();
+	void add(const TraceStats &o);
+};
+
+// Bounding volume hierarchy over the triangles of a Model, built with the
+// surface area heuristic over binned centroids and flattened depth first:
+// a node's first child is the next node, so only the second child needs an
+// index, and two 32-byte nodes share a cache line. Leaves own a contiguous
+// run of triangles, each stored as a vertex and two edges (what the ray
+// test reads) with the index of its face.
+class BVH {
+public:
+	struct alignas(32) Node {
+		Vec3f lo;
+		int offset; // leaf: first triangle, interior: the second child
+		Vec3f hi;
+		int count;  // leaf: triangles (> 0), interior: minus the split axis
+	};
+	struct Triangle {
+		Vec3f v0, e1, e2;
+		int face;
+	};
+	enum { BINS = 16, MAX_LEAF = 4, MAX_DEPTH = 64 };
+private:
+	std::vector<Node> nodes_;
+	std::vector<Triangle> tris_;
+	int depth_;
+
+	struct BuildContext;
+	void build_node(BuildContext &ctx, int begin, int end, int depth);
+public:
+	BVH();
+	// replaces the hierarchy with one over model's faces
+	void build(Model &model);
+	bool empty() const { return nodes_.empty(); }
+	int nnodes() const { return (int)nodes_.size(); }
+	int ntriangles() const { return (int)tris_.size(); }
+	int depth() const { return depth_; }
+	const Node &node(int i) const { return nodes_[i]; }
+	// expected cost of a random ray under the heuristic: node and triangle
+	// tests weighed by the area of their box relative to the root's
+	float sah_cost() const;
+	// Nearest hits of a packet. The lanes walk the tree together, a node
+	// being visited while any of them can hit its box, nearer child first
+	// along the split axis (by the direction of lane 0). With cull_backfaces
+	// faces whose corners run clockwise as seen by the ray are skipped. Both
+	// modes give bit-identical hits.
+	void intersect(TraceMode mode, const RayPacket &packet, PacketHits &hits, bool cull_backfaces, TraceStats *stats = NULL) const;
+};
+
+#endif //__BVH_H__
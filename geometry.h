@@ -4,6 +4,11 @@
 #include <vector>
 #include <cassert>
 #include <iostream>
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 template <size_t DimCols, size_t DimRows, typename T>
 class mat;
@@ -11,17 +16,13 @@ class mat;
 template <size_t DIM, typename T>
 struct vec
 {
-	vec()
-	{
-		for (size_t i = DIM; i--; data_[i] = T())
-			;
-	}
-	T &operator[](const size_t i)
+	constexpr vec() : data_() {}
+	constexpr T &operator[](const size_t i)
 	{
 		assert(i < DIM);
 		return data_[i];
 	}
-	const T &operator[](const size_t i) const
+	constexpr const T &operator[](const size_t i) const
 	{
 		assert(i < DIM);
 		return data_[i];
@@ -36,16 +37,16 @@ private:
 template <typename T>
 struct vec<2, T>
 {
-	vec() : x(T()), y(T()) {}
-	vec(T X, T Y) : x(X), y(Y) {}
+	constexpr vec() : x(T()), y(T()) {}
+	constexpr vec(T X, T Y) : x(X), y(Y) {}
 	template <class U>
 	vec<2, T>(const vec<2, U> &v);
-	T &operator[](const size_t i)
+	constexpr T &operator[](const size_t i)
 	{
 		assert(i < 2);
 		return i <= 0 ? x : y;
 	}
-	const T &operator[](const size_t i) const
+	constexpr const T &operator[](const size_t i) const
 	{
 		assert(i < 2);
 		return i <= 0 ? x : y;
@@ -59,16 +60,16 @@ struct vec<2, T>
 template <typename T>
 struct vec<3, T>
 {
-	vec() : x(T()), y(T()), z(T()) {}
-	vec(T X, T Y, T Z) : x(X), y(Y), z(Z) {}
+	constexpr vec() : x(T()), y(T()), z(T()) {}
+	constexpr vec(T X, T Y, T Z) : x(X), y(Y), z(Z) {}
 	template <class U>
 	vec<3, T>(const vec<3, U> &v);
-	T &operator[](const size_t i)
+	constexpr T &operator[](const size_t i)
 	{
 		assert(i < 3);
 		return i <= 0 ? x : (1 == i ? y : z);
 	}
-	const T &operator[](const size_t i) const
+	constexpr const T &operator[](const size_t i) const
 	{
 		assert(i < 3);
 		return i <= 0 ? x : (1 == i ? y : z);
@@ -86,7 +87,7 @@ struct vec<3, T>
 /////////////////////////////////////////////////////////////////////////////////
 
 template <size_t DIM, typename T>
-T operator*(const vec<DIM, T> &lhs, const vec<DIM, T> &rhs)
+constexpr T operator*(const vec<DIM, T> &lhs, const vec<DIM, T> &rhs)
 {
 	T ret = T();
 	for (size_t i = DIM; i--; ret += lhs[i] * rhs[i])
@@ -95,7 +96,7 @@ T operator*(const vec<DIM, T> &lhs, const vec<DIM, T> &rhs)
 }
 
 template <size_t DIM, typename T>
-vec<DIM, T> operator+(vec<DIM, T> lhs, const vec<DIM, T> &rhs)
+constexpr vec<DIM, T> operator+(vec<DIM, T> lhs, const vec<DIM, T> &rhs)
 {
 	for (size_t i = DIM; i--; lhs[i] += rhs[i])
 		;
@@ -103,7 +104,7 @@ vec<DIM, T> operator+(vec<DIM, T> lhs, const vec<DIM, T> &rhs)
 }
 
 template <size_t DIM, typename T>
-vec<DIM, T> operator-(vec<DIM, T> lhs, const vec<DIM, T> &rhs)
+constexpr vec<DIM, T> operator-(vec<DIM, T> lhs, const vec<DIM, T> &rhs)
 {
 	for (size_t i = DIM; i--; lhs[i] -= rhs[i])
 		;
@@ -111,7 +112,7 @@ vec<DIM, T> operator-(vec<DIM, T> lhs, const vec<DIM, T> &rhs)
 }
 
 template <size_t DIM, typename T, typename U>
-vec<DIM, T> operator*(vec<DIM, T> lhs, const U &rhs)
+constexpr vec<DIM, T> operator*(vec<DIM, T> lhs, const U &rhs)
 {
 	for (size_t i = DIM; i--; lhs[i] *= rhs)
 		;
@@ -119,7 +120,7 @@ vec<DIM, T> operator*(vec<DIM, T> lhs, const U &rhs)
 }
 
 template <size_t DIM, typename T, typename U>
-vec<DIM, T> operator/(vec<DIM, T> lhs, const U &rhs)
+constexpr vec<DIM, T> operator/(vec<DIM, T> lhs, const U &rhs)
 {
 	for (size_t i = DIM; i--; lhs[i] /= rhs)
 		;
@@ -127,7 +128,7 @@ vec<DIM, T> operator/(vec<DIM, T> lhs, const U &rhs)
 }
 
 template <size_t LEN, size_t DIM, typename T>
-vec<LEN, T> embed(const vec<DIM, T> &v, T fill = 1)
+constexpr vec<LEN, T> embed(const vec<DIM, T> &v, T fill = 1)
 {
 	vec<LEN, T> ret;
 	for (size_t i = LEN; i--; ret[i] = (i < DIM ? v[i] : fill))
@@ -136,7 +137,7 @@ vec<LEN, T> embed(const vec<DIM, T> &v, T fill = 1)
 }
 
 template <size_t LEN, size_t DIM, typename T>
-vec<LEN, T> proj(const vec<DIM, T> &v)
+constexpr vec<LEN, T> proj(const vec<DIM, T> &v)
 {
 	vec<LEN, T> ret;
 	for (size_t i = LEN; i--; ret[i] = v[i])
@@ -145,7 +146,7 @@ vec<LEN, T> proj(const vec<DIM, T> &v)
 }
 
 template <typename T>
-vec<3, T> cross(vec<3, T> v1, vec<3, T> v2)
+constexpr vec<3, T> cross(vec<3, T> v1, vec<3, T> v2)
 {
 	return vec<3, T>(v1.y * v2.z - v1.z * v2.y, v1.z * v2.x - v1.x * v2.z, v1.x * v2.y - v1.y * v2.x);
 }
@@ -191,15 +192,15 @@ class mat
 	vec<DimCols, T> rows[DimRows];
 
 public:
-	mat() {}
+	constexpr mat() : rows() {}
 
-	vec<DimCols, T> &operator[](const size_t idx)
+	constexpr vec<DimCols, T> &operator[](const size_t idx)
 	{
 		assert(idx < DimRows);
 		return rows[idx];
 	}
 
-	const vec<DimCols, T> &operator[](const size_t idx) const
+	constexpr const vec<DimCols, T> &operator[](const size_t idx) const
 	{
 		assert(idx < DimRows);
 		return rows[idx];
@@ -221,7 +222,7 @@ public:
 			;
 	}
 
-	static mat<DimRows, DimCols, T> identity()
+	static constexpr mat<DimRows, DimCols, T> identity()
 	{
 		mat<DimRows, DimCols, T> ret;
 		for (size_t i = DimRows; i--;)
@@ -330,6 +331,181 @@ typedef vec<4, float> Vec4f;
 
 /////////////////////////////////////////////////////////////////////////////////
 
+// sqrt usable in constant expressions: Newton steps from above, which
+// decrease monotonically until the root is reached
+constexpr float const_sqrt(float x)
+{
+	if (!(x > 0))
+		return 0;
+	double r = x > 1 ? x : 1;
+	for (int i = 0; i < 256; i++)
+	{
+		double next = .5 * (r + x / r);
+		if (next >= r)
+			break;
+		r = next;
+	}
+	return (float)r;
+}
+
+// Row-major 4x4 float matrix for the transform path: no heap storage, rows
+// 16-byte aligned so the products below run on SSE or NEON registers.
+class alignas(16) Mat4 : public mat<4, 4, float>
+{
+	// closed-form inverse through the twelve 2x2 minors of the upper and
+	// lower row pairs; singular matrices give infinities
+	constexpr Mat4 inverse(bool transposed) const
+	{
+		const Mat4 &a = *this;
+		float s0 = a[0][0] * a[1][1] - a[1][0] * a[0][1];
+		float s1 = a[0][0] * a[1][2] - a[1][0] * a[0][2];
+		float s2 = a[0][0] * a[1][3] - a[1][0] * a[0][3];
+		float s3 = a[0][1] * a[1][2] - a[1][1] * a[0][2];
+		float s4 = a[0][1] * a[1][3] - a[1][1] * a[0][3];
+		float s5 = a[0][2] * a[1][3] - a[1][2] * a[0][3];
+		float c5 = a[2][2] * a[3][3] - a[3][2] * a[2][3];
+		float c4 = a[2][1] * a[3][3] - a[3][1] * a[2][3];
+		float c3 = a[2][1] * a[3][2] - a[3][1] * a[2][2];
+		float c2 = a[2][0] * a[3][3] - a[3][0] * a[2][3];
+		float c1 = a[2][0] * a[3][2] - a[3][0] * a[2][2];
+		float c0 = a[2][0] * a[3][1] - a[3][0] * a[2][1];
+		float inv_det = 1.f / (s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0);
+		float b[4][4] = {
+			{a[1][1] * c5 - a[1][2] * c4 + a[1][3] * c3, -a[0][1] * c5 + a[0][2] * c4 - a[0][3] * c3, a[3][1] * s5 - a[3][2] * s4 + a[3][3] * s3, -a[2][1] * s5 + a[2][2] * s4 - a[2][3] * s3},
+			{-a[1][0] * c5 + a[1][2] * c2 - a[1][3] * c1, a[0][0] * c5 - a[0][2] * c2 + a[0][3] * c1, -a[3][0] * s5 + a[3][2] * s2 - a[3][3] * s1, a[2][0] * s5 - a[2][2] * s2 + a[2][3] * s1},
+			{a[1][0] * c4 - a[1][1] * c2 + a[1][3] * c0, -a[0][0] * c4 + a[0][1] * c2 - a[0][3] * c0, a[3][0] * s4 - a[3][1] * s2 + a[3][3] * s0, -a[2][0] * s4 + a[2][1] * s2 - a[2][3] * s0},
+			{-a[1][0] * c3 + a[1][1] * c1 - a[1][2] * c0, a[0][0] * c3 - a[0][1] * c1 + a[0][2] * c0, -a[3][0] * s3 + a[3][1] * s1 - a[3][2] * s0, a[2][0] * s3 - a[2][1] * s1 + a[2][2] * s0}};
+		Mat4 ret;
+		for (size_t i = 4; i--;)
+			for (size_t j = 4; j--;)
+				ret[i][j] = (transposed ? b[j][i] : b[i][j]) * inv_det;
+		return ret;
+	}
+
+public:
+	constexpr Mat4() : mat<4, 4, float>() {}
+	constexpr Mat4(const mat<4, 4, float> &m) : mat<4, 4, float>(m) {}
+
+	const float *data() const { return &(*this)[0][0]; }
+	float *data() { return &(*this)[0][0]; }
+
+	static constexpr Mat4 identity()
+	{
+		return mat<4, 4, float>::identity();
+	}
+
+	// NDC cube to the screen rectangle at (x, y) of size w x h, z to [0, depth]
+	static constexpr Mat4 viewport(float x, float y, float w, float h, float depth)
+	{
+		Mat4 m = identity();
+		m[0][3] = x + w / 2.f;
+		m[1][3] = y + h / 2.f;
+		m[2][3] = depth / 2.f;
+		m[0][0] = w / 2.f;
+		m[1][1] = h / 2.f;
+		m[2][2] = depth / 2.f;
+		return m;
+	}
+
+	// perspective with the camera at distance c on +z looking down -z
+	static constexpr Mat4 projection(float c)
+	{
+		Mat4 m = identity();
+		m[3][2] = -1.f / c;
+		return m;
+	}
+
+	static constexpr Mat4 lookat(Vec3f eye, Vec3f center, Vec3f up)
+	{
+		Vec3f z = eye - center;
+		z = z / const_sqrt(z * z);
+		Vec3f x = cross(up, z);
+		x = x / const_sqrt(x * x);
+		Vec3f y = cross(z, x);
+		Mat4 m = identity();
+		for (size_t i = 3; i--;)
+		{
+			m[0][i] = x[i];
+			m[1][i] = y[i];
+			m[2][i] = z[i];
+		}
+		m[0][3] = -(x * center);
+		m[1][3] = -(y * center);
+		m[2][3] = -(z * center);
+		return m;
+	}
+
+	constexpr Mat4 transpose() const
+	{
+		Mat4 ret;
+		for (size_t i = 4; i--;)
+			for (size_t j = 4; j--; ret[i][j] = (*this)[j][i])
+				;
+		return ret;
+	}
+	constexpr Mat4 inverse() const { return inverse(false); }
+	// for normals: (M^-1)^T without the extra transpose pass
+	constexpr Mat4 inverse_transpose() const { return inverse(true); }
+};
+
+inline Mat4 operator*(const Mat4 &lhs, const Mat4 &rhs)
+{
+	Mat4 ret;
+	const float *a = lhs.data();
+	const float *b = rhs.data();
+	float *r = ret.data();
+#if defined(__SSE__)
+	__m128 b0 = _mm_load_ps(b), b1 = _mm_load_ps(b + 4), b2 = _mm_load_ps(b + 8), b3 = _mm_load_ps(b + 12);
+	for (int i = 0; i < 4; i++)
+	{
+		__m128 row = _mm_mul_ps(_mm_set1_ps(a[4 * i]), b0);
+		row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a[4 * i + 1]), b1));
+		row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a[4 * i + 2]), b2));
+		row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(a[4 * i + 3]), b3));
+		_mm_store_ps(r + 4 * i, row);
+	}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	float32x4_t b0 = vld1q_f32(b), b1 = vld1q_f32(b + 4), b2 = vld1q_f32(b + 8), b3 = vld1q_f32(b + 12);
+	for (int i = 0; i < 4; i++)
+	{
+		float32x4_t row = vmulq_n_f32(b0, a[4 * i]);
+		row = vmlaq_n_f32(row, b1, a[4 * i + 1]);
+		row = vmlaq_n_f32(row, b2, a[4 * i + 2]);
+		row = vmlaq_n_f32(row, b3, a[4 * i + 3]);
+		vst1q_f32(r + 4 * i, row);
+	}
+#else
+	for (int i = 0; i < 4; i++)
+		for (int j = 0; j < 4; j++)
+			r[4 * i + j] = a[4 * i] * b[j] + a[4 * i + 1] * b[4 + j] + a[4 * i + 2] * b[8 + j] + a[4 * i + 3] * b[12 + j];
+#endif
+	return ret;
+}
+
+inline Vec4f operator*(const Mat4 &lhs, const Vec4f &rhs)
+{
+	Vec4f ret;
+	const float *a = lhs.data();
+#if defined(__SSE__)
+	__m128 v = _mm_loadu_ps(&rhs[0]);
+	__m128 r0 = _mm_mul_ps(_mm_load_ps(a), v), r1 = _mm_mul_ps(_mm_load_ps(a + 4), v);
+	__m128 r2 = _mm_mul_ps(_mm_load_ps(a + 8), v), r3 = _mm_mul_ps(_mm_load_ps(a + 12), v);
+	_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+	_mm_storeu_ps(&ret[0], _mm_add_ps(_mm_add_ps(r0, r1), _mm_add_ps(r2, r3)));
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+	float32x4_t v = vld1q_f32(&rhs[0]);
+	float32x4_t r0 = vmulq_f32(vld1q_f32(a), v), r1 = vmulq_f32(vld1q_f32(a + 4), v);
+	float32x4_t r2 = vmulq_f32(vld1q_f32(a + 8), v), r3 = vmulq_f32(vld1q_f32(a + 12), v);
+	vst1q_f32(&ret[0], vpaddq_f32(vpaddq_f32(r0, r1), vpaddq_f32(r2, r3)));
+#else
+	for (int i = 0; i < 4; i++)
+		ret[i] = a[4 * i] * rhs[0] + a[4 * i + 1] * rhs[1] + a[4 * i + 2] * rhs[2] + a[4 * i + 3] * rhs[3];
+#endif
+	return ret;
+}
+
+/////////////////////////////////////////////////////////////////////////////////
+
 const int DEFAULT_ALLOC=4;
 
 class Matrix {
@@ -0,0 +1,65 @@
+#include <algorithm>
+#include <limits>
+#include "hiz.h"
+
+HiZBuffer::HiZBuffer(int width, int height, bool two_level) : width_(width), height_(height), two_level_(two_level), tiles_(), regions_() {
+    tiles_x_ = (width_ + TILE - 1) / TILE;
+    tiles_y_ = (height_ + TILE - 1) / TILE;
+    regions_x_ = (width_ + REGION - 1) / REGION;
+    regions_y_ = (height_ + REGION - 1) / REGION;
+    tiles_.resize(tiles_x_ * tiles_y_);
+    regions_.resize(regions_x_ * regions_y_);
+    clear(-std::numeric_limits<float>::max());
+}
+
+void HiZBuffer::clear(float depth) {
+    std::fill(tiles_.begin(), tiles_.end(), depth);
+    std::fill(regions_.begin(), regions_.end(), depth);
+}
+
+bool HiZBuffer::two_level() {
+    return two_level_;
+}
+
+bool HiZBuffer::rect_occluded(int x0, int y0, int x1, int y1, float zmax) const {
+    if (!two_level_) return false;
+    for (int ry = y0 / REGION; ry <= y1 / REGION; ry++) {
+        for (int rx = x0 / REGION; rx <= x1 / REGION; rx++) {
+            if (!(zmax < regions_[rx + ry * regions_x_])) return false;
+        }
+    }
+    return true;
+}
+
+void HiZBuffer::update_tile(const DepthView &depth, int tx, int ty) {
+    int x0 = tx * TILE;
+    int y0 = ty * TILE;
+    int x1 = std::min(x0 + TILE, width_);
+    int y1 = std::min(y0 + TILE, height_);
+    float farthest = std::numeric_limits<float>::max();
+    for (int y = y0; y < y1; y++) {
+        const float *row = &depth.at(x0, y);
+        for (int x = 0; x < x1 - x0; x++) {
+            farthest = std::min(farthest, row[x]);
+        }
+    }
+    float &tile = tiles_[tx + ty * tiles_x_];
+    if (farthest == tile) return;
+    tile = farthest;
+    if (two_level_) update_region(x0 / REGION, y0 / REGION);
+}
+
+void HiZBuffer::update_region(int rx, int ry) {
+    const int per_region = REGION / TILE;
+    int tx0 = rx * per_region;
+    int ty0 = ry * per_region;
+    int tx1 = std::min(tx0 + per_region, tiles_x_);
+    int ty1 = std::min(ty0 + per_region, tiles_y_);
+    float farthest = std::numeric_limits<float>::max();
+    for (int ty = ty0; ty < ty1; ty++) {
+        for (int tx = tx0; tx < tx1; tx++) {
+            farthest = std::min(farthest, tiles_[tx + ty * tiles_x_]);
+        }
+    }
+    regions_[rx + ry * regions_x_] = farthest;
+}
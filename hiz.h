@@ -0,0 +1,48 @@
+#ifndef __HIZ_H__
+#define __HIZ_H__
+
+#include <vector>
+#include "rendertarget.h"
+
+// Conservative depth pyramid over a float zbuffer where larger z is closer.
+// Level 0 keeps, per 8x8 tile, the farthest (smallest) depth stored in the
+// tile; the optional level 1 keeps the farthest of each 8x8 group of tiles
+// (a 64x64 pixel region). A primitive whose nearest depth is behind that
+// value cannot pass the depth test anywhere in the tile.
+class HiZBuffer {
+private:
+	int width_;
+	int height_;
+	int tiles_x_;
+	int tiles_y_;
+	int regions_x_;
+	int regions_y_;
+	bool two_level_;
+	std::vector<float> tiles_;
+	std::vector<float> regions_;
+
+	void update_region(int rx, int ry);
+public:
+	enum { TILE = 8, REGION = 64 };
+
+	HiZBuffer(int width, int height, bool two_level = true);
+	void clear(float depth);
+	bool two_level();
+	// zmax is the nearest depth of the primitive
+	bool tile_occluded(int tx, int ty, float zmax) const {
+		return zmax < tiles_[tx + ty * tiles_x_];
+	}
+	bool rect_occluded(int x0, int y0, int x1, int y1, float zmax) const;
+	// re-reads the tile from depth (which must cover it) after pixels in it
+	// were written
+	void update_tile(const DepthView &depth, int tx, int ty);
+};
+
+// pads the nearest depth of a triangle so that float error in the
+// interpolated per-pixel depth can never make the hiz test reject a pixel
+// that the exact depth test would have accepted
+inline float hiz_conservative_depth(float zmax) {
+	return zmax + (zmax < 0 ? -zmax : zmax) * 1e-5f + 1e-5f;
+}
+
+#endif //__HIZ_H__
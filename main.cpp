@@ -1,9 +1,19 @@
 #include <vector>
+#include <string>
+#include <type_traits>
 #include <cmath>
 #include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
 #include "tgaimage.h"
 #include "model.h"
 #include "geometry.h"
+#include "rasterizer.h"
+#include "renderer.h"
+#include "batch.h"
+#include "ssao.h"
+#include "profile.h"
 
 const TGAColor white = TGAColor(255, 255, 255, 255);
 const TGAColor red = TGAColor(255, 0, 0, 255);
@@ -13,23 +23,6 @@ const TGAColor yellow = TGAColor(255, 255, 0, 255);
 
 Model *model = NULL;
 
-const int OUTPUT_WIDTH = 800;
-const int OUTPUT_HEIGHT = 800;
-const int TEXTURE_WIDTH = 1024;
-const int TEXTURE_HEIGHT = 1024;
-const int DEPTH = 255;
-
-Vec3f barycentric(Vec3f *pts, Vec3f P)
-{
-    Vec3f u = cross(Vec3f(pts[2][0] - pts[0][0], pts[1][0] - pts[0][0], pts[0][0] - P[0]), Vec3f(pts[2][1] - pts[0][1], pts[1][1] - pts[0][1], pts[0][1] - P[1]));
-    // Vec3f v1 = Vec3f(pts[2][0] - pts[0][0], pts[1][0] - pts[0][0], pts[0][0] - P[0]);
-    // Vec3f v2 = Vec3f(pts[2][1] - pts[0][1], pts[1][1] - pts[0][1], pts[0][1] - P[1]);
-    // Vec3f u = Vec3f(v1.y * v2.z - v1.z * v2.y, v1.z * v2.x - v1.x * v2.z, v1.x * v2.y - v1.y * v2.x);
-    if (std::abs(u.z) <= 1e-2)
-        return Vec3f(-1, 1, 1);
-    return Vec3f(1.f - (u.x + u.y) / u.z, u.y / u.z, u.x / u.z);
-}
-
 void line(Vec2i t1, Vec2i t2, TGAImage &image, TGAColor color)
 {
     int x0 = t1.x;
@@ -80,118 +73,328 @@ void rasterize(Vec2i p0, Vec2i p1, TGAImage &image, TGAColor color, int ybuffer[
     }
 }
 
-Vec3f m2v(Matrix m) {
-    return Vec3f(m[0][0] / m[3][0], m[1][0] / m[3][0], m[2][0] / m[3][0]);
+Vec3f m2v(Vec4f m) {
+    return proj<3>(m / m[3]);
 }
 
-Matrix v2m(Vec3f v) {
-    Matrix m(4, 1);
-    m[0][0] = v.x;
-    m[1][0] = v.y;
-    m[2][0] = v.z;
-    m[3][0] = 1.f;
-    return m;
+Vec4f v2m(Vec3f v) {
+    return embed<4>(v);
 }
 
-Matrix viewport(int x, int y, int w, int h) {
-    Matrix m = Matrix::identity(4);
-    m[0][3] = x + w / 2.f;
-    m[1][3] = y + h / 2.f;
-    m[2][3] = DEPTH / 2.f;
+constexpr Mat4 viewport(int x, int y, int w, int h) {
+    return Mat4::viewport(x, y, w, h, DEPTH);
+}
 
-    m[0][0] = w / 2.f;
-    m[1][1] = h / 2.f;
-    m[2][2] = DEPTH / 2.f;
-    return m;
+void print_stats(const RasterStats &stats) {
+    std::cerr << "# faces passed " << stats.passed << " clipped " << stats.clipped << " culled backface " << stats.culled_backface << " frustum " << stats.culled_frustum << std::endl;
+    std::cerr << "# tiles rejected " << stats.tiles_rejected << " pixels tested " << stats.pixels_tested << " shaded " << stats.pixels_shaded << std::endl;
+    std::cerr << "# shading invocations " << stats.fragments << ", " << stats.fragments / (double)std::max(stats.pixels_visible, 1UL) << " per visible pixel" << std::endl;
 }
 
-Vec3f world2screen(Vec3f v) {
-    // + .5 是为了能四舍五入，不加会统一向下取整
-    return Vec3f(int((v.x + 1.) * OUTPUT_WIDTH / 2. + .5), int((v.y + 1.) * OUTPUT_HEIGHT / 2. + .5), int(v.z * DEPTH + .5));
+// the diffuse map and the optional maps beside it share this prefix
+const char *TEXTURE_BASE = "obj/african_head/african_head";
+
+// reads TEXTURE_BASE + suffix, flipped like the diffuse map; false if there
+// is no such image
+bool read_map(const char *suffix, TGAImage &image) {
+    if (!image.read_tga_file((std::string(TEXTURE_BASE) + suffix).c_str())) return false;
+    image.flip_vertically();
+    return true;
 }
 
-void triangle(Vec3f *pts, float *zbuffer, Vec3f *uv_coords, Vec3f *vn_coords, Vec3f light_dir, TGAImage &image, TGAImage &texture)
-{
-    Vec2f bboxmin(std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
-    Vec2f bboxmax(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
-    Vec2f clamp(image.get_width() - 1, image.get_height() - 1);
-    for (int i = 0; i < 3; i++)
-    {
-        for (int j = 0; j < 2; j++)
-        {
-            bboxmin[j] = std::max(0.f, std::min(bboxmin[j], pts[i][j]));
-            bboxmax[j] = std::min(clamp[j], std::max(bboxmax[j], pts[i][j]));
-        }
-    }
-    Vec3f P;
-    for (P.x = bboxmin.x; P.x <= bboxmax.x; P.x++)
-    {
-        for (P.y = bboxmin.y; P.y <= bboxmax.y; P.y++)
-        {
-            Vec3f bc_screen = barycentric(pts, P);
-            if (bc_screen.x < 0 || bc_screen.y < 0 || bc_screen.z < 0)
-                continue;
-            P.z = 0;
-            
-            for (int i = 0; i < 3; i++) {
-                P.z += pts[i][2] * bc_screen[i];
-            }
-            if (zbuffer[int(P.x + P.y * OUTPUT_WIDTH)] < P.z) {
-                zbuffer[int(P.x + P.y * OUTPUT_WIDTH)] = P.z;
-                Vec3f uv;
-                Vec3f vn;
-                for (int i = 0; i < 3; i++) {
-                    uv = uv + uv_coords[i] * bc_screen[i];
-                    vn = vn + vn_coords[i] * bc_screen[i];
-                }
-                TGAColor color = texture.get(uv[0] * texture.get_width(), uv[1] * texture.get_height());
-                // float intensity = vn[0] * light_dir[0] + vn[1] * light_dir[1] + vn[2] * light_dir[2];
-                float intensity = vn * light_dir;
-                color.r = color.r * intensity;
-                color.g = color.g * intensity;
-                color.b = color.b * intensity;
-                image.set(P.x, P.y, color);
+// writes the profiles asked for on the command line
+void write_profile(const char *json, const char *trace) {
+    if (json) profile_write_json(json);
+    if (trace) profile_write_trace(trace);
+}
+
+void print_usage(const char *argv0) {
+    std::cerr << "usage: " << argv0 << " [options] [model.obj|model.lmesh]\n"
+              << "  --size W H             frame size (800 800)\n"
+              << "  --eye X Y Z            perspective camera looking at the origin\n"
+              << "  --light X Y Z          light direction in model space (headlight)\n"
+              << "  --shader NAME          flat|gouraud|phong|normalmap|material\n"
+              << "  --backend NAME         raster|ray\n"
+              << "  --raster MODE          reference|scalar|avx2\n"
+              << "  --depth FORMAT         float|24|16, without --msaa\n"
+              << "  --msaa N               4|8 samples per pixel\n"
+              << "  --resolve FILTER       box|tent\n"
+              << "  --filter NAME          nearest|bilinear|trilinear\n"
+              << "  --texture-layout NAME  row-major|block|morton\n"
+              << "  --shadows, --shadow-size N\n"
+              << "  --ssao, --ssao-radius R\n"
+              << "  --threads N, --serial, --deferred, --no-hiz, --no-cull, --no-optimize\n"
+              << "  --batch MANIFEST       render the jobs listed in MANIFEST\n"
+              << "  --profile FILE.json, --trace FILE.json" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    const char *model_path = "obj/african_head/african_head.obj";
+    const char *manifest = NULL;
+    bool serial = false;
+    bool use_hiz = true;
+    bool cull = true;
+    bool deferred = false;
+    const char *profile_json = NULL;
+    const char *profile_trace = NULL;
+    bool optimize = true;
+    Texture::Filter filter = Texture::TRILINEAR;
+    Texture::Layout layout = Texture::ROW_MAJOR;
+    int nthreads = 0;
+    int width = 800;
+    int height = 800;
+    DepthFormat depth_format = DEPTH_FLOAT;
+    int samples = 1;
+    ResolveFilter resolve = RESOLVE_BOX;
+    RasterMode mode = best_raster_mode();
+    ShaderKind shader = SHADER_GOURAUD;
+    bool use_camera = false;
+    Vec3f eye(0, 0, 3);
+    Vec3f light(0, 0, 1);
+    bool light_set = false;
+    int shadow_size = 0;
+    bool ssao = false;
+    float ssao_radius = 0;
+    bool ray = false;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "--serial")) {
+            serial = true;
+        } else if (!strcmp(argv[i], "--batch") && i + 1 < argc) {
+            manifest = argv[++i];
+        } else if (!strcmp(argv[i], "--no-optimize")) {
+            optimize = false;
+        } else if (!strcmp(argv[i], "--no-hiz")) {
+            use_hiz = false;
+        } else if (!strcmp(argv[i], "--no-cull")) {
+            cull = false;
+        } else if (!strcmp(argv[i], "--deferred")) {
+            deferred = true;
+        } else if (!strcmp(argv[i], "--profile") && i + 1 < argc) {
+            profile_json = argv[++i];
+        } else if (!strcmp(argv[i], "--trace") && i + 1 < argc) {
+            profile_trace = argv[++i];
+        } else if (!strcmp(argv[i], "--size") && i + 2 < argc) {
+            width = std::max(1, atoi(argv[++i]));
+            height = std::max(1, atoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--depth") && i + 1 < argc) {
+            i++;
+            if (!depth_format_from_name(argv[i], depth_format)) std::cerr << "unknown depth format " << argv[i] << ", using " << depth_format_name(depth_format) << std::endl;
+        } else if (!strcmp(argv[i], "--msaa") && i + 1 < argc) {
+            samples = atoi(argv[++i]);
+            if (samples != 1 && !sample_pattern(samples)) {
+                std::cerr << "no " << samples << "x msaa, using 1 sample" << std::endl;
+                samples = 1;
             }
+        } else if (!strcmp(argv[i], "--resolve") && i + 1 < argc) {
+            i++;
+            if (!resolve_filter_from_name(argv[i], resolve)) std::cerr << "unknown resolve filter " << argv[i] << ", using " << resolve_filter_name(resolve) << std::endl;
+        } else if (!strcmp(argv[i], "--eye") && i + 3 < argc) {
+            for (int j = 0; j < 3; j++) eye[j] = atof(argv[++i]);
+            use_camera = eye.norm() > 0;
+            if (!use_camera) std::cerr << "eye at the origin, using no camera" << std::endl;
+        } else if (!strcmp(argv[i], "--light") && i + 3 < argc) {
+            for (int j = 0; j < 3; j++) light[j] = atof(argv[++i]);
+            light_set = light.norm() > 0;
+            if (!light_set) std::cerr << "light direction of zero length, using a headlight" << std::endl;
+        } else if (!strcmp(argv[i], "--shadows")) {
+            shadow_size = 1024;
+        } else if (!strcmp(argv[i], "--shadow-size") && i + 1 < argc) {
+            shadow_size = std::max(1, atoi(argv[++i]));
+        } else if (!strcmp(argv[i], "--ssao")) {
+            ssao = true;
+        } else if (!strcmp(argv[i], "--ssao-radius") && i + 1 < argc) {
+            ssao = true;
+            ssao_radius = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "--backend") && i + 1 < argc) {
+            i++;
+            if (!strcmp(argv[i], "ray")) ray = true;
+            else if (!strcmp(argv[i], "raster")) ray = false;
+            else std::cerr << "unknown backend " << argv[i] << ", using " << (ray ? "ray" : "raster") << std::endl;
+        } else if (!strcmp(argv[i], "--threads") && i + 1 < argc) {
+            nthreads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--filter") && i + 1 < argc) {
+            i++;
+            if (!texture_filter_from_name(argv[i], filter)) std::cerr << "unknown texture filter " << argv[i] << ", using " << texture_filter_name(filter) << std::endl;
+        } else if (!strcmp(argv[i], "--texture-layout") && i + 1 < argc) {
+            i++;
+            if (!texture_layout_from_name(argv[i], layout)) std::cerr << "unknown texture layout " << argv[i] << ", using " << texture_layout_name(layout) << std::endl;
+        } else if (!strcmp(argv[i], "--shader") && i + 1 < argc) {
+            i++;
+            if (!shader_kind_from_name(argv[i], shader)) std::cerr << "unknown shader " << argv[i] << ", using " << shader_kind_name(shader) << std::endl;
+        } else if (!strcmp(argv[i], "--raster") && i + 1 < argc) {
+            i++;
+            if (!strcmp(argv[i], "reference")) mode = RASTER_REFERENCE;
+            else if (!strcmp(argv[i], "scalar")) mode = RASTER_SCALAR;
+            else if (!strcmp(argv[i], "avx2") && best_raster_mode() == RASTER_AVX2) mode = RASTER_AVX2;
+            else std::cerr << "raster mode " << argv[i] << " not available, using " << raster_mode_name(mode) << std::endl;
+        } else if (!strncmp(argv[i], "--", 2)) {
+            std::cerr << "unknown or incomplete argument " << argv[i] << std::endl;
+            print_usage(argv[0]);
+            return 1;
+        } else {
+            model_path = argv[i];
         }
     }
-}
+    if (samples > 1 && !ray && depth_format != DEPTH_FLOAT) {
+        std::cerr << "multisampled targets keep float depth per sample, ignoring --depth " << depth_format_name(depth_format) << std::endl;
+        depth_format = DEPTH_FLOAT;
+    }
+    if (manifest) {
+        BatchRenderer batch;
+        batch.set_optimize(optimize);
+        batch.set_hiz(use_hiz);
+        batch.set_mode(mode);
+        batch.set_cull_backfaces(cull);
+        batch.set_deferred(deferred);
+        batch.set_depth_format(depth_format);
+        batch.set_msaa(samples, resolve);
+        batch.set_filter(filter);
+        batch.set_layout(layout);
+        batch.set_shader(shader);
+        BatchTiming timing;
+        if (!batch.load_manifest(manifest)) return 1;
+        bool ok = batch.run(serial ? 1 : nthreads, timing);
+        double render = timing.wall - timing.load;
+        int njobs = std::max(timing.jobs, 1);
+        std::cerr << "# " << timing.jobs << " jobs (" << timing.failed << " failed) in " << render << "s, " << timing.jobs / render << " jobs/s" << std::endl;
+        std::cerr << "# load " << timing.load * 1e3 << "ms, per job: clear " << timing.clear * 1e3 / njobs << "ms transform " << timing.transform * 1e3 / njobs << "ms raster " << timing.raster * 1e3 / njobs << "ms write " << timing.write * 1e3 / njobs << "ms" << std::endl;
+        print_stats(timing.stats);
+        write_profile(profile_json, profile_trace);
+        return ok ? 0 : 1;
+    }
 
-int main(int argc, char **argv) {
-    if (2 == argc) {
-        model = new Model(argv[1]);
-    } else {
-        model = new Model("obj/african_head/african_head.obj");
+    model = new Model(model_path);
+    if (model->nfaces() == 0) {
+        std::cerr << "no faces in " << model_path << std::endl;
+        delete model;
+        return 1;
+    }
+    if (optimize && !model->indexed()) {
+        float before, after;
+        int nverts = model->nverts();
+        model->optimize(16, &before, &after);
+        std::cerr << "# welded " << nverts << " -> " << model->nverts() << " verts, acmr " << before << " -> " << after << std::endl;
     }
 
-    float *zbuffer = new float[OUTPUT_WIDTH * OUTPUT_HEIGHT];
-    for (int i = OUTPUT_WIDTH * OUTPUT_HEIGHT; i--; zbuffer[i] = -std::numeric_limits<float>::max());
-    TGAImage image(OUTPUT_WIDTH, OUTPUT_HEIGHT, TGAImage::RGB);
-    TGAImage texture(TEXTURE_WIDTH, TEXTURE_HEIGHT, TGAImage::RGB);
-    texture.read_tga_file("obj/african_head/african_head_diffuse.tga");
+    if (ray && samples > 1) {
+        std::cerr << "the ray backend casts one ray per pixel, using 1 sample" << std::endl;
+        samples = 1;
+    }
+    RenderTarget target(width, height, depth_format, samples);
+    target.set_resolve_filter(resolve);
+    TGAImage texture;
+    texture.read_tga_file((std::string(TEXTURE_BASE) + "_diffuse.tga").c_str());
     texture.flip_vertically();
+    Texture sampler(texture, layout);
+    sampler.set_filter(filter);
+    // normalmap reads the object-space _nm, material packs _nm_tangent and
+    // _spec into its surface map
+    Texture normal_map;
+    TGAImage nm, spec;
+    if (shader == SHADER_NORMALMAP) {
+        if (read_map("_nm.tga", nm)) normal_map.load(nm);
+        else std::cerr << "# no normal map, using vertex normals" << std::endl;
+    }
+    if (shader == SHADER_MATERIAL) {
+        bool has_nm = read_map("_nm_tangent.tga", nm);
+        bool has_spec = read_map("_spec.tga", spec);
+        if (!has_nm) std::cerr << "# no tangent-space normal map, using vertex normals" << std::endl;
+        if (!has_spec) std::cerr << "# no specular map, using a fixed exponent" << std::endl;
+        TGAImage surface;
+        if (pack_surface_map(has_nm ? &nm : NULL, has_spec ? &spec : NULL, 10.f, surface)) normal_map.load(surface);
+    }
+    normal_map.set_filter(filter);
+    // --eye looks at the origin from there, with a perspective of that distance
+    Mat4 camera = Mat4::identity();
+    if (use_camera) camera = Mat4::projection(eye.norm()) * Mat4::lookat(eye, Vec3f(0, 0, 0), Vec3f(0, 1, 0));
+    // --light is a direction in model space, the shaders take it in view
+    // space; without it the light sits at the eye
     Vec3f light_dir(0, 0, 1);
-    for (int i = 0; i < model->nfaces(); i++) {
-        std::vector<int> face = model->face(i);
-        Vec3f pts[3], world_coords[3];
-        Vec3f uv_coords[3];
-        Vec3f vn_coords[3];
-        for (int j = 0; j < 3; j++) {
-            Vec3f v = model->vert(face[j * 3]);
-            world_coords[j] = v;
-            pts[j] = world2screen(v);
-            Vec3f origin_uv = model->uv_vert(face[j * 3 + 1]);
-            uv_coords[j] = Vec3f(origin_uv[0], origin_uv[1], origin_uv[2]);
-            vn_coords[j] = model->vn_vert(face[j * 3 + 2]);
+    if (light_set) {
+        light_dir = proj<3>(camera * embed<4>(light, 0.f));
+        light_dir.normalize();
+    } else if (use_camera) {
+        light = eye;
+    }
+    ShaderUniforms uniforms = {&sampler, normal_map.nlevels() ? &normal_map : NULL, camera.inverse_transpose(), light_dir};
+    TileRasterizer rasterizer(width, height, 64, serial ? 1 : nthreads);
+    HiZBuffer hiz(width, height);
+    RasterStats stats;
+    ScreenVerts screen_verts;
+    rasterizer.set_mode(mode);
+    rasterizer.set_cull_backfaces(cull);
+    rasterizer.set_deferred(deferred);
+    // the ray backend traces with the SIMD paths the rasterizer is allowed;
+    // its pool only gets workers when it is used
+    BVH bvh;
+    RayCaster caster(width, height, 16, serial || !ray ? 1 : nthreads);
+    RayStats ray_stats;
+    if (ray) {
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        bvh.build(*model);
+        double build = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        std::cerr << "# bvh " << bvh.nnodes() << " nodes, depth " << bvh.depth() << ", sah cost " << bvh.sah_cost() << ", built in " << build * 1e3 << "ms" << std::endl;
+        caster.set_mode(mode == RASTER_AVX2 ? TRACE_AVX2 : TRACE_SCALAR);
+        caster.set_cull_backfaces(cull);
+    }
+    // the shadow map covers the model's bounding sphere around the origin
+    ShadowMap shadow_map(std::max(shadow_size, 1));
+    if (shadow_size) {
+        float radius = 0;
+        for (int i = 0; i < model->nverts(); i++) radius = std::max(radius, std::sqrt(model->vert(i) * model->vert(i)));
+        shadow_map.set_light(light, radius * 1.01f);
+        TileRasterizer shadow_rasterizer(shadow_size, shadow_size, 64, serial ? 1 : nthreads);
+        HiZBuffer shadow_hiz(shadow_size, shadow_size);
+        RasterStats shadow_stats;
+        shadow_rasterizer.set_mode(mode);
+        shadow_rasterizer.set_cull_backfaces(cull);
+        render_shadow_map(*model, shadow_rasterizer, screen_verts, serial, shadow_map, use_hiz ? &shadow_hiz : NULL, shadow_stats);
+        std::cerr << "# shadow map " << shadow_size << "x" << shadow_size << ", " << shadow_stats.passed << " faces, " << shadow_stats.pixels_shaded << " depth writes" << std::endl;
+    }
+    Mat4 shadow_lookup = shadow_map.from_screen(camera, width, height);
+    bool written;
+    {
+        PROFILE_SCOPE("frame");
+        // rows are encoded and written while the tiles above them still
+        // render, unless ssao has to see the whole frame first
+        TGAWriter writer;
+        if (!writer.open("output.tga", target.color())) {
+            delete model;
+            return 1;
+        }
+        if (!ssao && !ray) rasterizer.set_row_callback([&writer](int rows) { writer.rows_ready(rows); });
+        auto draw = [&](const auto &s) {
+            if (ray) {
+                raycast_model(*model, bvh, caster, screen_verts, target, use_camera ? &camera : NULL, s, ray_stats);
+            } else if (use_camera) {
+                transform_model(*model, screen_verts, width, height, &camera);
+                rasterize_model(*model, rasterizer, screen_verts, serial, target, use_hiz ? &hiz : NULL, s, stats);
+            } else {
+                draw_model(*model, rasterizer, screen_verts, serial, target, use_hiz ? &hiz : NULL, s, stats);
+            }
+        };
+        with_shader(shader, uniforms, [&](const auto &s) {
+            if (shadow_size) draw(ShadowedShader<std::decay_t<decltype(s)>>(s, shadow_map, shadow_lookup));
+            else draw(s);
+        });
+        if (ssao) {
+            AmbientOcclusion ao(width, height, serial ? 1 : nthreads);
+            if (ssao_radius > 0) ao.set_radius(ssao_radius);
+            ao.apply(target);
+            std::cerr << "# ssao " << ao.samples() << " samples, radius " << ao.radius() << " px" << std::endl;
         }
-        // Vec3f n = cross((world_coords[2] - world_coords[0]), (world_coords[1] - world_coords[0]));
-        // TGAColor random = TGAColor(rand() % 255 * intensity, rand() % 255 * intensity, rand() % 255 * intensity, 255);
-        // TGAColor white = TGAColor(255 * intensity, 255 * intensity, 255 * intensity, 255);
-        triangle(pts, zbuffer, uv_coords, vn_coords, light_dir, image, texture);
+        written = writer.close();
     }
-
-    image.flip_vertically();
-    image.write_tga_file("output.tga");
+    if (!written) std::cerr << "failed to write output.tga" << std::endl;
+    if (ray) {
+        unsigned long packets = std::max(ray_stats.trace.packets, 1UL);
+        std::cerr << "# raycast " << trace_mode_name(caster.mode()) << ": " << ray_stats.rays << " rays, " << ray_stats.hits << " hits in " << ray_stats.seconds * 1e3 << "ms, " << ray_stats.rays / ray_stats.seconds * 1e-6 << " Mrays/s" << std::endl;
+        std::cerr << "# per packet of " << RAY_PACKET << " rays: " << ray_stats.trace.nodes / (double)packets << " nodes, " << ray_stats.trace.triangles / (double)packets << " triangles tested" << std::endl;
+    } else {
+        print_stats(stats);
+    }
+    write_profile(profile_json, profile_trace);
     delete model;
 
-    return 0;
+    return written ? 0 : 1;
 }
\ No newline at end of file
@@ -0,0 +1,115 @@
+#include <algorithm>
+#include "meshopt.h"
+
+float acmr(const std::vector<int> &indices, int nverts, int cache_size) {
+    if (indices.size() < 3) return 0.f;
+    // FIFO cache: a vertex is resident while fewer than cache_size misses
+    // happened after it was loaded
+    std::vector<long> loaded(nverts, -(long)cache_size - 1);
+    long misses = 0;
+    for (size_t i = 0; i < indices.size(); i++) {
+        int v = indices[i];
+        if (misses - loaded[v] > cache_size) {
+            loaded[v] = misses;
+            misses++;
+        }
+    }
+    return (float)misses / (indices.size() / 3);
+}
+
+namespace {
+
+struct Tipsify {
+    const std::vector<int> &indices;
+    int nverts;
+    int cache_size;
+    std::vector<int> adj_offset; // triangles around each vertex, CSR layout
+    std::vector<int> adj;
+    std::vector<int> live;       // triangles not yet emitted per vertex
+    std::vector<int> stamp;      // time the vertex last entered the cache
+    std::vector<int> dead_end;
+    std::vector<char> emitted;
+    int time;
+    int cursor;
+
+    Tipsify(const std::vector<int> &idx, int n, int k) : indices(idx), nverts(n), cache_size(k), adj_offset(n + 1, 0), adj(idx.size()), live(n, 0), stamp(n, 0), dead_end(), emitted(idx.size() / 3, 0), time(k + 1), cursor(0) {
+        for (size_t i = 0; i < indices.size(); i++) live[indices[i]]++;
+        for (int v = 0; v < nverts; v++) adj_offset[v + 1] = adj_offset[v] + live[v];
+        std::vector<int> fill(adj_offset.begin(), adj_offset.end() - 1);
+        for (size_t i = 0; i < indices.size(); i++) adj[fill[indices[i]]++] = (int)(i / 3);
+    }
+
+    int skip_dead_end() {
+        while (!dead_end.empty()) {
+            int d = dead_end.back();
+            dead_end.pop_back();
+            if (live[d] > 0) return d;
+        }
+        for (; cursor < nverts; cursor++) {
+            if (live[cursor] > 0) return cursor;
+        }
+        return -1;
+    }
+
+    int next_vertex(const std::vector<int> &candidates) {
+        int best = -1, best_priority = -1;
+        for (size_t i = 0; i < candidates.size(); i++) {
+            int v = candidates[i];
+            if (live[v] <= 0) continue;
+            // prefer the vertex that entered the cache longest ago but will
+            // still be resident after its remaining triangles are emitted
+            int priority = 0;
+            if (time - stamp[v] + 2 * live[v] <= cache_size) priority = time - stamp[v];
+            if (priority > best_priority) {
+                best_priority = priority;
+                best = v;
+            }
+        }
+        return best >= 0 ? best : skip_dead_end();
+    }
+
+    void run(std::vector<int> &out) {
+        out.clear();
+        out.reserve(indices.size());
+        std::vector<int> candidates;
+        int fan = indices.empty() ? -1 : indices[0];
+        while (fan >= 0) {
+            candidates.clear();
+            for (int a = adj_offset[fan]; a < adj_offset[fan + 1]; a++) {
+                int t = adj[a];
+                if (emitted[t]) continue;
+                emitted[t] = 1;
+                for (int c = 0; c < 3; c++) {
+                    int v = indices[t * 3 + c];
+                    out.push_back(v);
+                    dead_end.push_back(v);
+                    candidates.push_back(v);
+                    live[v]--;
+                    if (time - stamp[v] > cache_size) stamp[v] = time++;
+                }
+            }
+            fan = next_vertex(candidates);
+        }
+    }
+};
+
+}
+
+void optimize_vertex_cache(std::vector<int> &indices, int nverts, int cache_size) {
+    std::vector<int> out;
+    Tipsify(indices, nverts, cache_size).run(out);
+    indices.swap(out);
+}
+
+void optimize_vertex_fetch(std::vector<int> &indices, int nverts, std::vector<int> &remap) {
+    remap.assign(nverts, -1);
+    int next = 0;
+    for (size_t i = 0; i < indices.size(); i++) {
+        int &r = remap[indices[i]];
+        if (r < 0) r = next++;
+        indices[i] = r;
+    }
+    for (int v = 0; v < nverts; v++) {
+        if (remap[v] < 0) remap[v] = next++;
+    }
+}
@@ -0,0 +1,22 @@
+#ifndef __MESHOPT_H__
+#define __MESHOPT_H__
+
+#include <vector>
+
+// Index-buffer passes on triangle lists (3 indices per triangle, vertices
+// numbered [0, nverts)).
+
+// average cache miss ratio: misses per triangle of a FIFO post-transform
+// cache holding cache_size vertices; 0.5 is about the best a big regular
+// mesh can get, 3 means no reuse at all
+float acmr(const std::vector<int> &indices, int nverts, int cache_size = 16);
+
+// reorders triangles for post-transform cache locality (Tipsify, Sander,
+// Nehab and Barczak 2007); linear in the number of triangles
+void optimize_vertex_cache(std::vector<int> &indices, int nverts, int cache_size = 16);
+
+// renumbers vertices in the order the index buffer first touches them;
+// remap[old] = new, unreferenced vertices go to the end
+void optimize_vertex_fetch(std::vector<int> &indices, int nverts, std::vector<int> &remap);
+
+#endif //__MESHOPT_H__
@@ -0,0 +1,24 @@
+#ifndef __MMAPFILE_H__
+#define __MMAPFILE_H__
+
+#include <cstddef>
+
+// Read-only memory mapping of a whole file (POSIX mmap).
+class MappedFile {
+private:
+	const char *data_;
+	size_t size_;
+
+	MappedFile(const MappedFile &);
+	MappedFile & operator =(const MappedFile &);
+public:
+	MappedFile();
+	~MappedFile();
+	bool open(const char *filename);
+	void close();
+	bool is_open() const { return data_ != NULL; }
+	const char *data() const { return data_; }
+	size_t size() const { return size_; }
+};
+
+#endif //__MMAPFILE_H__
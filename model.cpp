@@ -3,12 +3,78 @@
 #include <fstream>
 #include <sstream>
 #include <vector>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <unordered_map>
+#include <stdint.h>
 #include "model.h"
+#include "threadpool.h"
+#include "meshopt.h"
+#include "profile.h"
 
-Model::Model(const char *filename) : verts_(), faces_(), uv_verts_(), vn_verts_() {
+Model::Model() : verts_(), uv_verts_(), vn_verts_(), tangents_(), face_verts_(), face_uvs_(), face_norms_(), cache_() {
+    attach_vectors();
+}
+
+Model::Model(const char *filename) : verts_(), uv_verts_(), vn_verts_(), tangents_(), face_verts_(), face_uvs_(), face_norms_(), cache_() {
+    PROFILE_SCOPE("load_model");
+    attach_vectors();
+    size_t len = strlen(filename);
+    if (len > 6 && !strcmp(filename + len - 6, ".lmesh")) {
+        load_cache(filename);
+    } else {
+        load_obj(filename);
+    }
+    std::cerr << "# v# " << nverts_ << " f# "  << nfaces_ << " uv# " << nuv_verts_ << " vn# " << nvn_verts_ << std::endl;
+}
+
+Model::~Model() {
+}
+
+void Model::reset() {
+    verts_.clear();
+    uv_verts_.clear();
+    vn_verts_.clear();
+    tangents_.clear();
+    face_verts_.clear();
+    face_uvs_.clear();
+    face_norms_.clear();
+    cache_.close();
+    attach_vectors();
+}
+
+void Model::attach_vectors() {
+    vert_data_ = verts_.empty() ? NULL : &verts_[0];
+    uv_data_ = uv_verts_.empty() ? NULL : &uv_verts_[0];
+    vn_data_ = vn_verts_.empty() ? NULL : &vn_verts_[0];
+    tangent_data_ = tangents_.empty() ? NULL : &tangents_[0];
+    face_vert_data_ = face_verts_.empty() ? NULL : &face_verts_[0];
+    face_uv_data_ = face_uvs_.empty() ? NULL : &face_uvs_[0];
+    face_norm_data_ = face_norms_.empty() ? NULL : &face_norms_[0];
+    nverts_ = (int)verts_.size();
+    nuv_verts_ = (int)uv_verts_.size();
+    nvn_verts_ = (int)vn_verts_.size();
+    nfaces_ = (int)face_verts_.size() / 3;
+}
+
+// fans a polygon given as v/vt/vn triplets into triangles
+static void push_polygon(const int *f, int ncorners, std::vector<int> &verts, std::vector<int> &uvs, std::vector<int> &norms) {
+    for (int k = 2; k < ncorners; k++) {
+        int corners[3] = {0, k - 1, k};
+        for (int c = 0; c < 3; c++) {
+            verts.push_back(f[corners[c] * 3]);
+            uvs.push_back(f[corners[c] * 3 + 1]);
+            norms.push_back(f[corners[c] * 3 + 2]);
+        }
+    }
+}
+
+bool Model::load_obj_stream(const char *filename) {
+    reset();
     std::ifstream in;
     in.open (filename, std::ifstream::in);
-    if (in.fail()) return;
+    if (in.fail()) return false;
     std::string line;
     while (!in.eof()) {
         std::getline(in, line);
@@ -33,7 +99,7 @@ Model::Model(const char *filename) : verts_(), faces_(), uv_verts_(), vn_verts_(
                 f.push_back(idxvt);
                 f.push_back(idxvn);
             }
-            faces_.push_back(f);
+            if (!f.empty()) push_polygon(&f[0], (int)f.size() / 3, face_verts_, face_uvs_, face_norms_);
         } else if (!line.compare(0, 4, "vt  ")) {
             // 2 char
             iss >> trash;
@@ -41,7 +107,6 @@ Model::Model(const char *filename) : verts_(), faces_(), uv_verts_(), vn_verts_(
             Vec3f v;
             for (int i=0;i<3;i++) {
                 iss >> v[i];
-                // std::cerr << "vt: " << v[i] << std::endl;
             }
             uv_verts_.push_back(v);
         } else if (!line.compare(0, 4, "vn  ")) {
@@ -51,45 +116,489 @@ Model::Model(const char *filename) : verts_(), faces_(), uv_verts_(), vn_verts_(
             Vec3f v;
             for (int i=0;i<3;i++) {
                 iss >> v[i];
-                // std::cerr << "vt: " << v[i] << std::endl;
             }
             vn_verts_.push_back(v);
         }
     }
-    std::cerr << "# v# " << verts_.size() << " f# "  << faces_.size() << " uv# " << uv_verts_.size() << " vn# " << vn_verts_.size() << std::endl;
+    check_faces();
+    attach_vectors();
+    compute_tangents();
+    return true;
 }
 
-Model::~Model() {
+/////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct ObjChunk {
+    std::vector<Vec3f> verts;
+    std::vector<Vec3f> uv_verts;
+    std::vector<Vec3f> vn_verts;
+    std::vector<int> face_verts;
+    std::vector<int> face_uvs;
+    std::vector<int> face_norms;
+    std::vector<int> corners;   // scratch for the face being parsed
+};
+
+inline bool is_blank(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
 }
 
-int Model::nverts() {
-    return (int)verts_.size();
+inline const char *skip_blanks(const char *p, const char *end) {
+    while (p < end && is_blank(*p)) p++;
+    return p;
 }
 
-int Model::nfaces() {
-    return (int)faces_.size();
+inline const char *skip_line(const char *p, const char *end) {
+    const char *nl = (const char *)memchr(p, '\n', end - p);
+    return nl ? nl + 1 : end;
 }
 
-int Model::nuv_verts() {
-    return (int)uv_verts_.size();
+const double pow10_table[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+                              1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+// [-+]digits[.digits][(e|E)[-+]digits], returns false if there is no number at p
+bool parse_float(const char *&p, const char *end, float &out) {
+    const char *s = p;
+    bool neg = false;
+    if (s < end && (*s == '-' || *s == '+')) neg = (*s++ == '-');
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int ndigits = 0;
+    for (; s < end && *s >= '0' && *s <= '9'; s++, ndigits++) {
+        if (mantissa < 100000000000000000ULL) mantissa = mantissa * 10 + (*s - '0');
+        else exponent++;
+    }
+    if (s < end && *s == '.') {
+        for (s++; s < end && *s >= '0' && *s <= '9'; s++, ndigits++) {
+            if (mantissa < 100000000000000000ULL) {
+                mantissa = mantissa * 10 + (*s - '0');
+                exponent--;
+            }
+        }
+    }
+    if (!ndigits) return false;
+    if (s < end && (*s == 'e' || *s == 'E')) {
+        const char *e = s + 1;
+        bool eneg = false;
+        if (e < end && (*e == '-' || *e == '+')) eneg = (*e++ == '-');
+        if (e < end && *e >= '0' && *e <= '9') {
+            int ev = 0;
+            for (; e < end && *e >= '0' && *e <= '9'; e++) {
+                if (ev < 10000) ev = ev * 10 + (*e - '0');
+            }
+            exponent += eneg ? -ev : ev;
+            s = e;
+        }
+    }
+    double v = (double)mantissa;
+    while (exponent > 22) { v *= 1e22; exponent -= 22; }
+    while (exponent < -22) { v /= 1e22; exponent += 22; }
+    v = exponent < 0 ? v / pow10_table[-exponent] : v * pow10_table[exponent];
+    out = (float)(neg ? -v : v);
+    p = s;
+    return true;
 }
 
-int Model::nvn_verts() {
-    return (int)vn_verts_.size();
+bool parse_int(const char *&p, const char *end, int &out) {
+    const char *s = p;
+    bool neg = false;
+    if (s < end && (*s == '-' || *s == '+')) neg = (*s++ == '-');
+    if (s >= end || *s < '0' || *s > '9') return false;
+    int v = 0;
+    for (; s < end && *s >= '0' && *s <= '9'; s++) v = v * 10 + (*s - '0');
+    out = neg ? -v : v;
+    p = s;
+    return true;
+}
+
+void parse_vec(const char *p, const char *end, std::vector<Vec3f> &dst) {
+    Vec3f v;
+    for (int i = 0; i < 3; i++) {
+        p = skip_blanks(p, end);
+        if (!parse_float(p, end, v[i])) break;
+    }
+    dst.push_back(v);
 }
 
-std::vector<int> Model::face(int idx) {
-    return faces_[idx];
+// v, v/vt, v//vn or v/vt/vn per corner; missing indices become -1
+void parse_face(const char *p, const char *end, ObjChunk &chunk) {
+    chunk.corners.clear();
+    int n = 0;
+    for (;;) {
+        p = skip_blanks(p, end);
+        int idx[3] = {0, 0, 0};
+        if (!parse_int(p, end, idx[0])) break;
+        for (int k = 1; k < 3 && p < end && *p == '/'; k++) {
+            p++;
+            parse_int(p, end, idx[k]);
+        }
+        for (int k = 0; k < 3; k++) {
+            chunk.corners.push_back(idx[k] - 1); // in wavefront obj all indices start at 1, not zero
+        }
+        n++;
+    }
+    push_polygon(chunk.corners.data(), n, chunk.face_verts, chunk.face_uvs, chunk.face_norms);
 }
 
-Vec3f Model::vert(int i) {
-    return verts_[i];
+void parse_chunk(const char *p, const char *end, ObjChunk &chunk) {
+    while (p < end) {
+        const char *line_end = (const char *)memchr(p, '\n', end - p);
+        if (!line_end) line_end = end;
+        const char *s = skip_blanks(p, line_end);
+        if (line_end - s >= 2) {
+            if (s[0] == 'v' && is_blank(s[1])) {
+                parse_vec(s + 2, line_end, chunk.verts);
+            } else if (s[0] == 'v' && s[1] == 't' && line_end - s >= 3 && is_blank(s[2])) {
+                parse_vec(s + 3, line_end, chunk.uv_verts);
+            } else if (s[0] == 'v' && s[1] == 'n' && line_end - s >= 3 && is_blank(s[2])) {
+                parse_vec(s + 3, line_end, chunk.vn_verts);
+            } else if (s[0] == 'f' && is_blank(s[1])) {
+                parse_face(s + 2, line_end, chunk);
+            }
+        }
+        p = line_end < end ? line_end + 1 : end;
+    }
 }
 
-Vec3f Model::uv_vert(int i) {
-    return uv_verts_[i];
+template <class T>
+void append(std::vector<T> &dst, const std::vector<T> &src) {
+    dst.insert(dst.end(), src.begin(), src.end());
 }
 
-Vec3f Model::vn_vert(int i) {
-    return vn_verts_[i];
-}
\ No newline at end of file
+struct LMeshHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t nverts;
+    uint32_t nuv_verts;
+    uint32_t nvn_verts;
+    uint32_t nfaces;
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(Vec3f) == 3 * sizeof(float), "lmesh maps Vec3f arrays directly");
+static_assert(sizeof(Vec4f) == 4 * sizeof(float), "lmesh maps Vec4f arrays directly");
+
+const char lmesh_magic[4] = {'L', 'M', 'S', 'H'};
+const uint32_t lmesh_version = 5;
+const uint32_t lmesh_indexed = 1; // one index stream shared by all attributes
+
+// every one of the n indices at idx is below count (negative ones are not)
+bool indices_below(const int *idx, size_t n, uint32_t count) {
+    for (size_t i = 0; i < n; i++) {
+        if ((uint32_t)idx[i] >= count) return false;
+    }
+    return true;
+}
+
+}
+
+bool Model::load_obj(const char *filename, int nthreads) {
+    reset();
+    MappedFile file;
+    if (!file.open(filename)) return false;
+    const char *begin = file.data();
+    const char *end = begin + file.size();
+
+    // newline-aligned chunks of at least 256KB, a few per thread
+    const size_t min_chunk = 256 * 1024;
+    ThreadPool pool(file.size() > min_chunk ? nthreads : 1);
+    size_t nchunks = std::min<size_t>(pool.size() * 4, file.size() / min_chunk + 1);
+    std::vector<const char *> bounds(nchunks + 1, end);
+    bounds[0] = begin;
+    for (size_t i = 1; i < nchunks; i++) {
+        const char *p = std::max(bounds[i - 1], begin + file.size() / nchunks * i);
+        bounds[i] = p < end ? skip_line(p, end) : end;
+    }
+    std::vector<ObjChunk> chunks(nchunks);
+    pool.parallel_for((int)nchunks, [&](int i) {
+        parse_chunk(bounds[i], bounds[i + 1], chunks[i]);
+    });
+
+    size_t nv = 0, nuv = 0, nvn = 0, nf = 0;
+    for (size_t i = 0; i < nchunks; i++) {
+        nv += chunks[i].verts.size();
+        nuv += chunks[i].uv_verts.size();
+        nvn += chunks[i].vn_verts.size();
+        nf += chunks[i].face_verts.size();
+    }
+    verts_.reserve(nv);
+    uv_verts_.reserve(nuv);
+    vn_verts_.reserve(nvn);
+    face_verts_.reserve(nf);
+    face_uvs_.reserve(nf);
+    face_norms_.reserve(nf);
+    for (size_t i = 0; i < nchunks; i++) {
+        append(verts_, chunks[i].verts);
+        append(uv_verts_, chunks[i].uv_verts);
+        append(vn_verts_, chunks[i].vn_verts);
+        append(face_verts_, chunks[i].face_verts);
+        append(face_uvs_, chunks[i].face_uvs);
+        append(face_norms_, chunks[i].face_norms);
+    }
+    check_faces();
+    attach_vectors();
+    compute_tangents();
+    return true;
+}
+
+bool Model::load_cache(const char *filename) {
+    reset();
+    if (!cache_.open(filename)) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    LMeshHeader header;
+    if (cache_.size() < sizeof(header)) {
+        std::cerr << "bad lmesh file " << filename << "\n";
+        cache_.close();
+        return false;
+    }
+    memcpy(&header, cache_.data(), sizeof(header));
+    size_t vec_bytes = sizeof(Vec3f) * ((size_t)header.nverts + header.nuv_verts + header.nvn_verts) + sizeof(Vec4f) * (size_t)header.nvn_verts;
+    size_t nstreams = (header.flags & lmesh_indexed) ? 1 : 3;
+    size_t expected = sizeof(header) + vec_bytes + sizeof(int) * 3 * nstreams * (size_t)header.nfaces;
+    if (memcmp(header.magic, lmesh_magic, 4) || header.version != lmesh_version || cache_.size() != expected) {
+        std::cerr << "bad lmesh file " << filename << "\n";
+        cache_.close();
+        return false;
+    }
+    const char *p = cache_.data() + sizeof(header);
+    vert_data_ = (const Vec3f *)p;
+    p += sizeof(Vec3f) * header.nverts;
+    uv_data_ = (const Vec3f *)p;
+    p += sizeof(Vec3f) * header.nuv_verts;
+    vn_data_ = (const Vec3f *)p;
+    p += sizeof(Vec3f) * header.nvn_verts;
+    tangent_data_ = (const Vec4f *)p;
+    p += sizeof(Vec4f) * header.nvn_verts;
+    face_vert_data_ = (const int *)p;
+    face_uv_data_ = face_vert_data_ + (nstreams == 3 ? 3 * (size_t)header.nfaces : 0);
+    face_norm_data_ = face_uv_data_ + (nstreams == 3 ? 3 * (size_t)header.nfaces : 0);
+    // a stale or corrupt cache must not turn into out-of-bounds reads later
+    size_t nindices = 3 * (size_t)header.nfaces;
+    if (!indices_below(face_vert_data_, nindices, header.nverts) || !indices_below(face_uv_data_, nindices, header.nuv_verts) || !indices_below(face_norm_data_, nindices, header.nvn_verts)) {
+        std::cerr << "bad lmesh file " << filename << ": face index out of range\n";
+        reset();
+        return false;
+    }
+    nverts_ = header.nverts;
+    nuv_verts_ = header.nuv_verts;
+    nvn_verts_ = header.nvn_verts;
+    nfaces_ = header.nfaces;
+    return true;
+}
+
+bool Model::write_cache(const char *filename) {
+    std::ofstream out;
+    out.open(filename, std::ios::binary);
+    if (!out.is_open()) {
+        std::cerr << "can't open file " << filename << "\n";
+        return false;
+    }
+    LMeshHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, lmesh_magic, 4);
+    header.version = lmesh_version;
+    header.nverts = nverts_;
+    header.nuv_verts = nuv_verts_;
+    header.nvn_verts = nvn_verts_;
+    header.nfaces = nfaces_;
+    header.flags = indexed() ? lmesh_indexed : 0;
+    out.write((const char *)&header, sizeof(header));
+    out.write((const char *)vert_data_, sizeof(Vec3f) * nverts_);
+    out.write((const char *)uv_data_, sizeof(Vec3f) * nuv_verts_);
+    out.write((const char *)vn_data_, sizeof(Vec3f) * nvn_verts_);
+    out.write((const char *)tangent_data_, sizeof(Vec4f) * nvn_verts_);
+    out.write((const char *)face_vert_data_, sizeof(int) * 3 * nfaces_);
+    if (!indexed()) {
+        out.write((const char *)face_uv_data_, sizeof(int) * 3 * nfaces_);
+        out.write((const char *)face_norm_data_, sizeof(int) * 3 * nfaces_);
+    }
+    if (!out.good()) {
+        std::cerr << "can't dump the lmesh file\n";
+        return false;
+    }
+    return true;
+}
+
+namespace {
+
+struct Corner {
+    int v, vt, vn;
+    bool operator==(const Corner &o) const { return v == o.v && vt == o.vt && vn == o.vn; }
+};
+
+struct CornerHash {
+    size_t operator()(const Corner &c) const {
+        uint64_t h = (uint32_t)c.v * 0x9E3779B97F4A7C15ULL;
+        h = (h ^ (uint32_t)c.vt) * 0xC2B2AE3D27D4EB4FULL;
+        h = (h ^ (uint32_t)c.vn) * 0x165667B19E3779F9ULL;
+        return (size_t)(h ^ (h >> 32));
+    }
+};
+
+}
+
+bool Model::indexed() {
+    return face_vert_data_ == face_uv_data_ && face_uv_data_ == face_norm_data_;
+}
+
+void Model::optimize(int cache_size, float *acmr_before, float *acmr_after) {
+    PROFILE_SCOPE("optimize_mesh");
+    int n = nfaces_ * 3;
+    std::vector<int> indices(n);
+    std::vector<int> corner_of;  // first corner that produced each welded vertex
+    std::unordered_map<Corner, int, CornerHash> welded;
+    welded.reserve(n);
+    for (int i = 0; i < n; i++) {
+        Corner key = {face_vert_data_[i], face_uv_data_[i], face_norm_data_[i]};
+        std::pair<std::unordered_map<Corner, int, CornerHash>::iterator, bool> ins = welded.insert(std::make_pair(key, (int)corner_of.size()));
+        if (ins.second) corner_of.push_back(i);
+        indices[i] = ins.first->second;
+    }
+    int nunique = (int)corner_of.size();
+    if (acmr_before) *acmr_before = acmr(indices, nunique, cache_size);
+    optimize_vertex_cache(indices, nunique, cache_size);
+    std::vector<int> remap;
+    optimize_vertex_fetch(indices, nunique, remap);
+    if (acmr_after) *acmr_after = acmr(indices, nunique, cache_size);
+
+    std::vector<Vec3f> verts(nunique), uvs(nunique), norms(nunique);
+    for (int v = 0; v < nunique; v++) {
+        int c = corner_of[v];
+        int vt = face_uv_data_[c], vn = face_norm_data_[c];
+        verts[remap[v]] = vert_data_[face_vert_data_[c]];
+        uvs[remap[v]] = vt >= 0 ? uv_data_[vt] : Vec3f();
+        norms[remap[v]] = vn >= 0 ? vn_data_[vn] : Vec3f();
+    }
+    reset();
+    verts_.swap(verts);
+    uv_verts_.swap(uvs);
+    vn_verts_.swap(norms);
+    face_verts_.swap(indices);
+    attach_vectors();
+    // a single stream serves all three attributes
+    face_uv_data_ = face_vert_data_;
+    face_norm_data_ = face_vert_data_;
+    compute_tangents();
+}
+
+// Corners the file gives no vt or vn (parse_face() stores -1 for a missing
+// one) are pointed at one appended default uv and at their face's geometric
+// normal, appended once per face, so the renderer can fetch every corner's
+// attributes without checking. Faces with any other index out of range,
+// relative (negative) ones included, are dropped with a message.
+void Model::check_faces() {
+    int nv = (int)verts_.size(), nuv = (int)uv_verts_.size(), nvn = (int)vn_verts_.size();
+    int default_uv = -1;
+    size_t kept = 0, nfaces = face_verts_.size() / 3;
+    for (size_t f = 0; f < nfaces; f++) {
+        int *fv = &face_verts_[f * 3], *ft = &face_uvs_[f * 3], *fn = &face_norms_[f * 3];
+        bool valid = true;
+        for (int k = 0; k < 3; k++) {
+            valid &= fv[k] >= 0 && fv[k] < nv && ft[k] >= -1 && ft[k] < nuv && fn[k] >= -1 && fn[k] < nvn;
+        }
+        if (!valid) continue;
+        int face_normal = -1;
+        for (int k = 0; k < 3; k++) {
+            if (ft[k] < 0) {
+                if (default_uv < 0) {
+                    default_uv = (int)uv_verts_.size();
+                    uv_verts_.push_back(Vec3f(0, 0, 0));
+                }
+                ft[k] = default_uv;
+            }
+            if (fn[k] < 0) {
+                if (face_normal < 0) {
+                    Vec3f n(0, 0, 1);
+                    Vec3f c = cross(verts_[fv[1]] - verts_[fv[0]], verts_[fv[2]] - verts_[fv[0]]);
+                    if (c.norm() > 0) n = c.normalize();
+                    face_normal = (int)vn_verts_.size();
+                    vn_verts_.push_back(n);
+                }
+                fn[k] = face_normal;
+            }
+        }
+        for (int k = 0; k < 3; k++) {
+            face_verts_[kept * 3 + k] = fv[k];
+            face_uvs_[kept * 3 + k] = ft[k];
+            face_norms_[kept * 3 + k] = fn[k];
+        }
+        kept++;
+    }
+    if (kept < nfaces) {
+        std::cerr << "dropped " << nfaces - kept << " faces with out-of-range or relative indices\n";
+        face_verts_.resize(kept * 3);
+        face_uvs_.resize(kept * 3);
+        face_norms_.resize(kept * 3);
+    }
+}
+
+// MikkTSpace-style accumulation: each face's uv-space tangent and bitangent,
+// normalized, are added to its three corners weighted by the corner angle;
+// every normal then keeps the sum made orthonormal to it, with the
+// handedness of the bitangent sum in w. Faces without a usable uv mapping
+// add nothing, and a normal left without a tangent gets an arbitrary
+// perpendicular one.
+void Model::compute_tangents() {
+    std::vector<Vec3f> tan(nvn_verts_), bitan(nvn_verts_);
+    for (int f = 0; f < nfaces_; f++) {
+        const int *fv = face_verts(f), *ft = face_uvs(f), *fn = face_norms(f);
+        bool valid = true;
+        for (int k = 0; k < 3; k++) {
+            valid &= fv[k] >= 0 && fv[k] < nverts_ && ft[k] >= 0 && ft[k] < nuv_verts_ && fn[k] >= 0 && fn[k] < nvn_verts_;
+        }
+        if (!valid) continue;
+        Vec3f p[3] = {vert_data_[fv[0]], vert_data_[fv[1]], vert_data_[fv[2]]};
+        Vec3f e1 = p[1] - p[0], e2 = p[2] - p[0];
+        float du1 = uv_data_[ft[1]].x - uv_data_[ft[0]].x, dv1 = uv_data_[ft[1]].y - uv_data_[ft[0]].y;
+        float du2 = uv_data_[ft[2]].x - uv_data_[ft[0]].x, dv2 = uv_data_[ft[2]].y - uv_data_[ft[0]].y;
+        float det = du1 * dv2 - du2 * dv1;
+        if (std::abs(det) < 1e-12f) continue;
+        Vec3f t = (e1 * dv2 - e2 * dv1) * (1.f / det);
+        Vec3f b = (e2 * du1 - e1 * du2) * (1.f / det);
+        if (t.norm() == 0 || b.norm() == 0) continue;
+        t.normalize();
+        b.normalize();
+        for (int k = 0; k < 3; k++) {
+            Vec3f a = p[(k + 1) % 3] - p[k], c = p[(k + 2) % 3] - p[k];
+            float len = a.norm() * c.norm();
+            if (len == 0) continue;
+            float angle = std::acos(std::max(-1.f, std::min(1.f, a * c / len)));
+            tan[fn[k]] = tan[fn[k]] + t * angle;
+            bitan[fn[k]] = bitan[fn[k]] + b * angle;
+        }
+    }
+    tangents_.resize(nvn_verts_);
+    for (int i = 0; i < nvn_verts_; i++) {
+        Vec3f n = vn_data_[i];
+        if (n.norm() > 0) n.normalize();
+        Vec3f t = tan[i] - n * (n * tan[i]);
+        if (t.norm() < 1e-6f) {
+            // any unit vector perpendicular to n
+            t = std::abs(n.x) < .9f ? cross(n, Vec3f(1, 0, 0)) : cross(n, Vec3f(0, 1, 0));
+            if (t.norm() == 0) t = Vec3f(1, 0, 0);
+        }
+        t.normalize();
+        tangents_[i] = embed<4>(t, cross(n, t) * bitan[i] < 0 ? -1.f : 1.f);
+    }
+    tangent_data_ = tangents_.empty() ? NULL : &tangents_[0];
+}
+
+int Model::nverts() {
+    return nverts_;
+}
+
+int Model::nfaces() {
+    return nfaces_;
+}
+
+int Model::nuv_verts() {
+    return nuv_verts_;
+}
+
+int Model::nvn_verts() {
+    return nvn_verts_;
+}
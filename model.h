@@ -3,24 +3,78 @@
 
 #include <vector>
 #include "geometry.h"
+#include "mmapfile.h"
 
 class Model {
 private:
 	std::vector<Vec3f> verts_;
-	std::vector<std::vector<int> > faces_;
 	std::vector<Vec3f> uv_verts_;
 	std::vector<Vec3f> vn_verts_;
+	// tangent frame of each normal: xyz the tangent (orthonormal to it), w
+	// the bitangent sign, bitangent = w * cross(normal, tangent)
+	std::vector<Vec4f> tangents_;
+	// faces are triangles (polygons are fanned at load time) stored as three
+	// index streams with 3 entries per face; corners the file leaves without
+	// a uv or normal get a default one at load time, and every index is in
+	// range
+	std::vector<int> face_verts_;
+	std::vector<int> face_uvs_;
+	std::vector<int> face_norms_;
+	// all data is read through these; they point either into the vectors
+	// above or straight into a mapped .lmesh cache
+	MappedFile cache_;
+	const Vec3f *vert_data_;
+	const Vec3f *uv_data_;
+	const Vec3f *vn_data_;
+	const Vec4f *tangent_data_;
+	const int *face_vert_data_;
+	const int *face_uv_data_;
+	const int *face_norm_data_;
+	int nverts_;
+	int nuv_verts_;
+	int nvn_verts_;
+	int nfaces_;
+
+	void reset();
+	void attach_vectors();
+	void check_faces();
+	void compute_tangents();
 public:
+	Model();
+	// .lmesh files are read as a binary cache, anything else as wavefront obj
 	Model(const char *filename);
 	~Model();
+	// the original std::getline/istringstream parser
+	bool load_obj_stream(const char *filename);
+	// mmaps the file and parses newline-aligned chunks in parallel
+	bool load_obj(const char *filename, int nthreads = 0);
+	bool load_cache(const char *filename);
+	bool write_cache(const char *filename);
+	// Welds every distinct (v, vt, vn) corner into one vertex, reorders the
+	// triangles for the post-transform cache and the vertices into fetch
+	// order. Afterwards the three face streams are identical. Reports the
+	// ACMR of the welded mesh before and after the reordering.
+	void optimize(int cache_size = 16, float *acmr_before = NULL, float *acmr_after = NULL);
+	// every face stream uses the same index for a corner
+	bool indexed();
 	int nverts();
 	int nfaces();
 	int nuv_verts();
 	int nvn_verts();
-	Vec3f vert(int i);
-	std::vector<int> face(int idx);
-	Vec3f uv_vert(int i);
-	Vec3f vn_vert(int i);
+	const Vec3f &vert(int i) { return vert_data_[i]; }
+	const Vec3f &uv_vert(int i) { return uv_data_[i]; }
+	const Vec3f &vn_vert(int i) { return vn_data_[i]; }
+	// indexed like the normals, computed at load time (and again by
+	// optimize(), when the welded corners split them at uv seams)
+	const Vec4f &tangent(int i) { return tangent_data_[i]; }
+	// the 3 position / uv / normal indices of face idx
+	const int *face_verts(int idx) { return face_vert_data_ + idx * 3; }
+	const int *face_uvs(int idx) { return face_uv_data_ + idx * 3; }
+	const int *face_norms(int idx) { return face_norm_data_ + idx * 3; }
+	// attributes of the nth corner of face iface
+	const Vec3f &vert(int iface, int nth) { return vert_data_[face_vert_data_[iface * 3 + nth]]; }
+	const Vec3f &uv_vert(int iface, int nth) { return uv_data_[face_uv_data_[iface * 3 + nth]]; }
+	const Vec3f &vn_vert(int iface, int nth) { return vn_data_[face_norm_data_[iface * 3 + nth]]; }
 };
 
-#endif //__MODEL_H__
\ No newline at end of file
+#endif //__MODEL_H__
@@ -0,0 +1,90 @@
+#include <utility>
+#include "primitive.h"
+
+namespace {
+
+const int NPLANES = 5;
+const int MAX_POLY = 3 + NPLANES;
+
+struct ClipVertex {
+    Vec4f clip;
+    Vec3f screen;
+    Vec3f uv;
+    Vec3f vn;
+    Vec4f tn;
+    float rhw;
+};
+
+// signed distance to plane p, >= 0 inside; the near plane goes first so the
+// guard planes only ever see w > 0
+inline float plane_distance(int p, const Vec4f &c) {
+    switch (p) {
+        case 0: return c[3] - CLIP_NEAR_W;
+        case 1: return GUARD_BAND * c[3] - c[0];
+        case 2: return GUARD_BAND * c[3] + c[0];
+        case 3: return GUARD_BAND * c[3] - c[1];
+        default: return GUARD_BAND * c[3] + c[1];
+    }
+}
+
+// always interpolated from the inside vertex a toward the outside vertex b,
+// so both faces sharing an edge create the same vertex on it
+ClipVertex intersect(const ClipVertex &a, float da, const ClipVertex &b, float db, const Viewport &vp) {
+    float t = da / (da - db);
+    ClipVertex v;
+    v.clip = a.clip + (b.clip - a.clip) * t;
+    v.uv = a.uv + (b.uv - a.uv) * t;
+    v.vn = a.vn + (b.vn - a.vn) * t;
+    v.tn = a.tn + (b.tn - a.tn) * t;
+    v.screen = to_screen(v.clip, vp);
+    v.rhw = 1.f / v.clip[3];
+    return v;
+}
+
+}
+
+int clip_triangle(const Triangle &t, const Vec3f *obj, const ScreenVerts &sv, Triangle *out) {
+    ClipVertex buf[2][MAX_POLY];
+    ClipVertex *poly = buf[0], *next = buf[1];
+    int n = 3;
+    for (int i = 0; i < 3; i++) {
+        poly[i].clip = to_clip(sv.mvp, obj[i]);
+        poly[i].screen = t.pts[i];
+        poly[i].uv = t.uv[i];
+        poly[i].vn = t.vn[i];
+        poly[i].tn = t.tn[i];
+        poly[i].rhw = t.rhw[i];
+    }
+    for (int p = 0; p < NPLANES && n > 0; p++) {
+        float d[MAX_POLY];
+        bool all_inside = true;
+        for (int i = 0; i < n; i++) {
+            d[i] = plane_distance(p, poly[i].clip);
+            all_inside &= d[i] >= 0;
+        }
+        if (all_inside) continue;
+        int m = 0;
+        for (int i = 0; i < n; i++) {
+            int j = (i + 1) % n;
+            if (d[i] >= 0) next[m++] = poly[i];
+            if ((d[i] >= 0) != (d[j] >= 0)) {
+                next[m++] = d[i] >= 0 ? intersect(poly[i], d[i], poly[j], d[j], sv.viewport) : intersect(poly[j], d[j], poly[i], d[i], sv.viewport);
+            }
+        }
+        std::swap(poly, next);
+        n = m;
+    }
+    int ntris = 0;
+    for (int i = 1; i + 1 < n; i++) {
+        const ClipVertex *v[3] = {&poly[0], &poly[i], &poly[i + 1]};
+        for (int j = 0; j < 3; j++) {
+            out[ntris].pts[j] = v[j]->screen;
+            out[ntris].uv[j] = v[j]->uv;
+            out[ntris].vn[j] = v[j]->vn;
+            out[ntris].tn[j] = v[j]->tn;
+            out[ntris].rhw[j] = v[j]->rhw;
+        }
+        ntris++;
+    }
+    return ntris;
+}
@@ -0,0 +1,73 @@
+#ifndef __PRIMITIVE_H__
+#define __PRIMITIVE_H__
+
+#include "geometry.h"
+#include "shader.h"
+#include "vertex.h"
+#include "rasterizer.h"
+
+// A triangle clipped against the near plane and the four guard-band planes
+// is a convex polygon of at most 3 + 5 vertices, fanned into this many
+// triangles.
+const int MAX_CLIPPED_TRIANGLES = 6;
+
+// Twice the signed area of the triangle with its vertices snapped the way
+// setup_edges() snaps them. Faces turned toward the viewer (counter-clockwise
+// with y up) come out negative.
+inline int snapped_area(const Vec3f *pts) {
+	int px[3], py[3];
+	for (int i = 0; i < 3; i++) {
+		px[i] = (int)std::floor(pts[i].x + .5f);
+		py[i] = (int)std::floor(pts[i].y + .5f);
+	}
+	return (px[2] - px[0]) * (py[1] - py[0]) - (px[1] - px[0]) * (py[2] - py[0]);
+}
+
+// Clips t against the near plane and the guard band and writes the result,
+// in screen space, to out. obj are the model-space positions of t's corners;
+// the clip-space positions are recomputed from them with sv.mvp and new
+// vertices are mapped with sv.viewport. Corners that survive keep their
+// pts from t, so edges shared with unclipped faces stay watertight.
+// Returns the number of triangles written, 0 if nothing is left.
+int clip_triangle(const Triangle &t, const Vec3f *obj, const ScreenVerts &sv, Triangle *out);
+
+// Primitive assembly for one face: rejects it when all three corners lie
+// outside the same frustum plane, clips it when a corner is behind the near
+// plane or outside the guard band, and with cull_backfaces drops triangles
+// whose snapped area says they face away. Writes what is left to out,
+// returns how many, and counts the face in exactly one of the culled_*
+// counters or passed (plus clipped when it went through the clipper).
+inline int assemble_triangle(const Triangle &t, const Vec3f *obj, const int *outcode, const ScreenVerts &sv, bool cull_backfaces, Triangle *out, RasterStats &stats) {
+	// CLIP_GUARD is not a plane: corners past the band on different sides
+	// may still span the screen
+	if (outcode[0] & outcode[1] & outcode[2] & ~CLIP_GUARD) {
+		stats.culled_frustum++;
+		return 0;
+	}
+	int n = 1;
+	if ((outcode[0] | outcode[1] | outcode[2]) & (CLIP_NEAR | CLIP_GUARD)) {
+		stats.clipped++;
+		n = clip_triangle(t, obj, sv, out);
+		if (n == 0) {
+			stats.culled_frustum++;
+			return 0;
+		}
+	} else {
+		out[0] = t;
+	}
+	if (cull_backfaces) {
+		int kept = 0;
+		for (int i = 0; i < n; i++) {
+			if (snapped_area(out[i].pts) <= 0) out[kept++] = out[i];
+		}
+		if (kept == 0) {
+			stats.culled_backface++;
+			return 0;
+		}
+		n = kept;
+	}
+	stats.passed++;
+	return n;
+}
+
+#endif //__PRIMITIVE_H__
@@ -0,0 +1,163 @@
+#include <iostream>
+#include "profile.h"
+
+#ifdef RENDER_PROFILE
+
+#include <chrono>
+#include <vector>
+#include <map>
+#include <string>
+#include <mutex>
+#include <fstream>
+#include <algorithm>
+
+namespace {
+
+const char *counter_names[PROF_NCOUNTERS] = {
+    "triangles_in", "triangles_culled", "triangles_clipped", "pixels_tested",
+    "pixels_depth_rejected", "pixels_shaded", "texture_fetches", "bytes_written"
+};
+
+struct Event {
+    const char *name;
+    uint64_t start;
+    uint64_t end;
+};
+
+struct ThreadProfile {
+    int tid;
+    std::vector<Event> events;
+    uint64_t counters[PROF_NCOUNTERS];
+};
+
+// registered on a thread's first event and never freed, so what a pool
+// worker recorded is still there after the pool is gone
+std::mutex threads_mutex;
+std::vector<ThreadProfile *> threads;
+thread_local ThreadProfile *current = NULL;
+
+ThreadProfile &thread_profile() {
+    if (!current) {
+        current = new ThreadProfile();
+        std::fill(current->counters, current->counters + PROF_NCOUNTERS, 0);
+        std::lock_guard<std::mutex> lock(threads_mutex);
+        current->tid = (int)threads.size();
+        threads.push_back(current);
+    }
+    return *current;
+}
+
+}
+
+uint64_t profile_now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void profile_event(const char *name, uint64_t start_ns, uint64_t end_ns) {
+    Event e = {name, start_ns, end_ns};
+    thread_profile().events.push_back(e);
+}
+
+void profile_count(ProfileCounter counter, uint64_t n) {
+    thread_profile().counters[counter] += n;
+}
+
+bool profile_enabled() {
+    return true;
+}
+
+bool profile_write_json(const char *filename) {
+    struct Stage {
+        unsigned long calls;
+        uint64_t total;
+        uint64_t max;
+    };
+    std::map<std::string, Stage> stages;
+    uint64_t counters[PROF_NCOUNTERS] = {0};
+    std::lock_guard<std::mutex> lock(threads_mutex);
+    for (size_t t = 0; t < threads.size(); t++) {
+        const std::vector<Event> &events = threads[t]->events;
+        for (size_t i = 0; i < events.size(); i++) {
+            Stage &s = stages.insert(std::make_pair(std::string(events[i].name), Stage())).first->second;
+            uint64_t d = events[i].end - events[i].start;
+            s.calls++;
+            s.total += d;
+            s.max = std::max(s.max, d);
+        }
+        for (int c = 0; c < PROF_NCOUNTERS; c++) counters[c] += threads[t]->counters[c];
+    }
+    std::ofstream out(filename);
+    if (!out.is_open()) {
+        std::cerr << "can't open file " << filename << std::endl;
+        return false;
+    }
+    out << "{\n  \"stages\": {";
+    for (std::map<std::string, Stage>::iterator it = stages.begin(); it != stages.end(); ++it) {
+        out << (it == stages.begin() ? "\n" : ",\n") << "    \"" << it->first << "\": {\"calls\": " << it->second.calls
+            << ", \"total_ms\": " << it->second.total * 1e-6 << ", \"max_ms\": " << it->second.max * 1e-6 << "}";
+    }
+    out << "\n  },\n  \"counters\": {";
+    for (int c = 0; c < PROF_NCOUNTERS; c++) {
+        out << (c ? ",\n" : "\n") << "    \"" << counter_names[c] << "\": " << counters[c];
+    }
+    out << "\n  }\n}\n";
+    return out.good();
+}
+
+bool profile_write_trace(const char *filename) {
+    std::lock_guard<std::mutex> lock(threads_mutex);
+    uint64_t origin = UINT64_MAX, last = 0;
+    for (size_t t = 0; t < threads.size(); t++) {
+        const std::vector<Event> &events = threads[t]->events;
+        for (size_t i = 0; i < events.size(); i++) {
+            origin = std::min(origin, events[i].start);
+            last = std::max(last, events[i].end);
+        }
+    }
+    std::ofstream out(filename);
+    if (!out.is_open()) {
+        std::cerr << "can't open file " << filename << std::endl;
+        return false;
+    }
+    // complete ("X") events in microseconds, then the counter totals as one
+    // counter ("C") sample at the end of the trace
+    out << "{\"traceEvents\": [";
+    bool first = true;
+    out.precision(3);
+    out << std::fixed;
+    for (size_t t = 0; t < threads.size(); t++) {
+        const std::vector<Event> &events = threads[t]->events;
+        for (size_t i = 0; i < events.size(); i++) {
+            out << (first ? "\n" : ",\n") << "{\"name\": \"" << events[i].name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << threads[t]->tid
+                << ", \"ts\": " << (events[i].start - origin) * 1e-3 << ", \"dur\": " << (events[i].end - events[i].start) * 1e-3 << "}";
+            first = false;
+        }
+    }
+    for (int c = 0; c < PROF_NCOUNTERS; c++) {
+        uint64_t total = 0;
+        for (size_t t = 0; t < threads.size(); t++) total += threads[t]->counters[c];
+        out << (first ? "\n" : ",\n") << "{\"name\": \"" << counter_names[c] << "\", \"ph\": \"C\", \"pid\": 1, \"ts\": "
+            << (threads.empty() || last < origin ? 0 : (last - origin) * 1e-3) << ", \"args\": {\"value\": " << total << "}}";
+        first = false;
+    }
+    out << "\n]}\n";
+    return out.good();
+}
+
+#else
+
+bool profile_enabled() {
+    return false;
+}
+
+bool profile_write_json(const char *filename) {
+    std::cerr << "not built with RENDER_PROFILE, no profile for " << filename << std::endl;
+    return false;
+}
+
+bool profile_write_trace(const char *filename) {
+    std::cerr << "not built with RENDER_PROFILE, no trace for " << filename << std::endl;
+    return false;
+}
+
+#endif
@@ -0,0 +1,59 @@
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <stdint.h>
+
+// Compile-time optional instrumentation. Built with -DRENDER_PROFILE (make
+// PROFILE=1), PROFILE_SCOPE records a steady_clock timed event for the rest
+// of the enclosing block and PROFILE_COUNT adds to one of the counters
+// below. Both record into buffers owned by the calling thread, so they take
+// no lock. Without RENDER_PROFILE the macros expand to nothing.
+enum ProfileCounter {
+	PROF_TRIANGLES_IN,
+	PROF_TRIANGLES_CULLED,
+	PROF_TRIANGLES_CLIPPED,
+	PROF_PIXELS_TESTED,
+	PROF_PIXELS_DEPTH_REJECTED, // failed the depth test or were discarded
+	PROF_PIXELS_SHADED,
+	PROF_TEXTURE_FETCHES,
+	PROF_BYTES_WRITTEN,
+	PROF_NCOUNTERS
+};
+
+#ifdef RENDER_PROFILE
+
+uint64_t profile_now_ns();
+void profile_event(const char *name, uint64_t start_ns, uint64_t end_ns);
+void profile_count(ProfileCounter counter, uint64_t n);
+
+// name must outlive the profile (a string literal)
+class ProfileScope {
+	const char *name_;
+	uint64_t start_;
+public:
+	ProfileScope(const char *name) : name_(name), start_(profile_now_ns()) {}
+	~ProfileScope() { profile_event(name_, start_, profile_now_ns()); }
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+#define PROFILE_COUNT(counter, n) profile_count(counter, n)
+
+#else
+
+#define PROFILE_SCOPE(name) ((void)0)
+#define PROFILE_COUNT(counter, n) ((void)0)
+
+#endif
+
+// These exist in every build; without RENDER_PROFILE there is nothing to
+// write and they return false.
+bool profile_enabled();
+// per-event-name call count, total and max time, and the counter totals
+bool profile_write_json(const char *filename);
+// every recorded event in Chrome trace-event format, one track per thread,
+// for chrome://tracing or Perfetto
+bool profile_write_trace(const char *filename);
+
+#endif //__PROFILE_H__
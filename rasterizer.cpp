@@ -0,0 +1,286 @@
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <cassert>
+#include "rasterizer.h"
+
+
+Vec3f barycentric(Vec3f *pts, Vec3f P)
+{
+    Vec3f u = cross(Vec3f(pts[2][0] - pts[0][0], pts[1][0] - pts[0][0], pts[0][0] - P[0]), Vec3f(pts[2][1] - pts[0][1], pts[1][1] - pts[0][1], pts[0][1] - P[1]));
+    if (std::abs(u.z) <= 1e-2)
+        return Vec3f(-1, 1, 1);
+    return Vec3f(1.f - (u.x + u.y) / u.z, u.y / u.z, u.x / u.z);
+}
+
+namespace {
+
+using raster_detail::EdgeSetup;
+
+struct DepthContext {
+    DepthView depth;
+    HiZBuffer *hiz;
+};
+
+// the depth half of block_scalar, with the same arithmetic so the stored
+// depth is bit-identical
+int block_depth_scalar(const EdgeSetup &s, DepthContext &ctx, int bx, int by, int cx0, int cy0, int cx1, int cy1, bool full, RasterStats &stats) {
+    (void)bx;
+    (void)by;
+    int written = 0;
+    int row[3];
+    for (int i = 0; i < 3; i++) {
+        row[i] = s.A[i] * cx0 + s.B[i] * cy0 + s.C[i];
+    }
+    for (int y = cy0; y <= cy1; y++) {
+        int e0 = row[0], e1 = row[1], e2 = row[2];
+        for (int x = cx0; x <= cx1; x++, e0 += s.A[0], e1 += s.A[1], e2 += s.A[2]) {
+            if (!full && (e0 | e1 | e2) < 0) continue;
+            stats.pixels_tested++;
+            float z = s.z[0] * (e0 * s.inv_area) + s.z[1] * (e1 * s.inv_area) + s.z[2] * (e2 * s.inv_area);
+            float &depth = ctx.depth.at(x, y);
+            if (depth < z) {
+                depth = z;
+                written++;
+            }
+        }
+        for (int i = 0; i < 3; i++) row[i] += s.B[i];
+    }
+    stats.pixels_shaded += written;
+    return written;
+}
+
+#ifdef RASTER_HAS_AVX2
+// block_avx2 without the shading loop: the passing lanes are stored with
+// one masked write per row
+__attribute__((target("avx2")))
+int block_depth_avx2(const EdgeSetup &s, DepthContext &ctx, int bx, int by, int cx0, int cy0, int cx1, int cy1, bool full, RasterStats &stats) {
+    (void)by;
+    int written = 0;
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    __m256i xs = _mm256_add_epi32(_mm256_set1_epi32(bx), lane);
+    __m256i clip = _mm256_and_si256(_mm256_cmpgt_epi32(xs, _mm256_set1_epi32(cx0 - 1)), _mm256_cmpgt_epi32(_mm256_set1_epi32(cx1 + 1), xs));
+    __m256i e[3], dy[3];
+    __m256 z[3];
+    for (int i = 0; i < 3; i++) {
+        e[i] = _mm256_add_epi32(_mm256_set1_epi32(s.A[i] * bx + s.B[i] * cy0 + s.C[i]), _mm256_mullo_epi32(lane, _mm256_set1_epi32(s.A[i])));
+        dy[i] = _mm256_set1_epi32(s.B[i]);
+        z[i] = _mm256_set1_ps(s.z[i]);
+    }
+    __m256 inv_area = _mm256_set1_ps(s.inv_area);
+    for (int y = cy0; y <= cy1; y++) {
+        __m256i mask = clip;
+        if (!full) {
+            __m256i outside = _mm256_cmpgt_epi32(_mm256_setzero_si256(), _mm256_or_si256(e[0], _mm256_or_si256(e[1], e[2])));
+            mask = _mm256_andnot_si256(outside, mask);
+        }
+        if (!_mm256_testz_si256(mask, mask)) {
+            stats.pixels_tested += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(mask)));
+            __m256 b0 = _mm256_mul_ps(_mm256_cvtepi32_ps(e[0]), inv_area);
+            __m256 b1 = _mm256_mul_ps(_mm256_cvtepi32_ps(e[1]), inv_area);
+            __m256 b2 = _mm256_mul_ps(_mm256_cvtepi32_ps(e[2]), inv_area);
+            __m256 zz = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(z[0], b0), _mm256_mul_ps(z[1], b1)), _mm256_mul_ps(z[2], b2));
+            float *zrow = &ctx.depth.at(bx, y);
+            __m256 depth = _mm256_maskload_ps(zrow, mask);
+            __m256 pass = _mm256_and_ps(_mm256_castsi256_ps(mask), _mm256_cmp_ps(depth, zz, _CMP_LT_OQ));
+            int bits = _mm256_movemask_ps(pass);
+            if (bits) {
+                _mm256_maskstore_ps(zrow, _mm256_castps_si256(pass), zz);
+                written += __builtin_popcount(bits);
+            }
+        }
+        for (int i = 0; i < 3; i++) e[i] = _mm256_add_epi32(e[i], dy[i]);
+    }
+    stats.pixels_shaded += written;
+    return written;
+}
+#endif
+
+}
+
+RasterMode best_raster_mode() {
+#ifdef RASTER_HAS_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return RASTER_AVX2;
+#endif
+    return RASTER_SCALAR;
+}
+
+const char *raster_mode_name(RasterMode mode) {
+    switch (mode) {
+        case RASTER_REFERENCE: return "reference";
+        case RASTER_SCALAR: return "scalar";
+        case RASTER_AVX2: return "avx2";
+    }
+    return "unknown";
+}
+
+RasterStats::RasterStats() : culled_backface(0), culled_frustum(0), clipped(0), passed(0), tiles_rejected(0), pixels_tested(0), pixels_shaded(0), fragments(0), pixels_visible(0) {
+}
+
+void RasterStats::add(const RasterStats &o) {
+    culled_backface += o.culled_backface;
+    culled_frustum += o.culled_frustum;
+    clipped += o.clipped;
+    passed += o.passed;
+    tiles_rejected += o.tiles_rejected;
+    pixels_tested += o.pixels_tested;
+    pixels_shaded += o.pixels_shaded;
+    fragments += o.fragments;
+    pixels_visible += o.pixels_visible;
+}
+
+void triangle_depth(RasterMode mode, const Triangle &t, const DepthView &depth, int x0, int y0, int x1, int y1, HiZBuffer *hiz, RasterStats *stats) {
+    EdgeSetup s;
+    if (!raster_detail::setup_edges(t.pts, x0, y0, x1, y1, s)) return;
+    DepthContext ctx = {depth, hiz};
+    RasterStats local;
+#ifdef RASTER_HAS_AVX2
+    if (mode == RASTER_AVX2) {
+        raster_detail::traverse_blocks<HiZBuffer::TILE>(s, ctx, local, block_depth_avx2);
+    } else
+#endif
+    raster_detail::traverse_blocks<HiZBuffer::TILE>(s, ctx, local, block_depth_scalar);
+    (void)mode;
+    if (stats) stats->add(local);
+}
+
+TileRasterizer::TileRasterizer(int width, int height, int tile_size, int nthreads) : width_(width), height_(height), tile_size_(tile_size), mode_(best_raster_mode()), cull_backfaces_(true), deferred_(false), hiz_(NULL), stats_(), tris_(), bins_(), row_pending_(), rows_done_(0), row_callback_(), vis_(), pool_(nthreads) {
+    tiles_x_ = (width_ + tile_size_ - 1) / tile_size_;
+    tiles_y_ = (height_ + tile_size_ - 1) / tile_size_;
+    bins_.resize(tiles_x_ * tiles_y_);
+    row_pending_.resize(tiles_y_);
+}
+
+void TileRasterizer::set_mode(RasterMode mode) {
+    mode_ = mode;
+}
+
+RasterMode TileRasterizer::mode() {
+    return mode_;
+}
+
+void TileRasterizer::set_cull_backfaces(bool cull) {
+    cull_backfaces_ = cull;
+}
+
+bool TileRasterizer::cull_backfaces() {
+    return cull_backfaces_;
+}
+
+void TileRasterizer::set_deferred(bool deferred) {
+    deferred_ = deferred;
+    if (deferred_) vis_.resize(width_, height_);
+}
+
+bool TileRasterizer::deferred() {
+    return deferred_;
+}
+
+void TileRasterizer::set_hiz(HiZBuffer *hiz) {
+    // a hiz region must never straddle two tiles, or two workers would
+    // refresh the same entry
+    assert(!hiz || tile_size_ % HiZBuffer::REGION == 0);
+    hiz_ = hiz;
+}
+
+const RasterStats &TileRasterizer::stats() {
+    return stats_;
+}
+
+int TileRasterizer::nthreads() {
+    return pool_.size();
+}
+
+int TileRasterizer::ntiles() {
+    return tiles_x_ * tiles_y_;
+}
+
+void TileRasterizer::set_row_callback(const std::function<void(int)> &callback) {
+    row_callback_ = callback;
+}
+
+void TileRasterizer::begin() {
+    tris_.clear();
+    stats_ = RasterStats();
+    for (size_t i = 0; i < bins_.size(); i++) {
+        bins_[i].clear();
+    }
+}
+
+void TileRasterizer::submit(const Triangle &t) {
+    float minx = std::min(t.pts[0].x, std::min(t.pts[1].x, t.pts[2].x));
+    float maxx = std::max(t.pts[0].x, std::max(t.pts[1].x, t.pts[2].x));
+    float miny = std::min(t.pts[0].y, std::min(t.pts[1].y, t.pts[2].y));
+    float maxy = std::max(t.pts[0].y, std::max(t.pts[1].y, t.pts[2].y));
+    if (maxx < 0 || maxy < 0 || minx > width_ - 1 || miny > height_ - 1) return;
+    int tx0 = std::max(0, (int)std::floor(minx) / tile_size_);
+    int ty0 = std::max(0, (int)std::floor(miny) / tile_size_);
+    int tx1 = std::min(tiles_x_ - 1, (int)std::ceil(maxx) / tile_size_);
+    int ty1 = std::min(tiles_y_ - 1, (int)std::ceil(maxy) / tile_size_);
+    int idx = (int)tris_.size();
+    tris_.push_back(t);
+    for (int ty = ty0; ty <= ty1; ty++) {
+        for (int tx = tx0; tx <= tx1; tx++) {
+            bins_[tx + ty * tiles_x_].push_back(idx);
+        }
+    }
+}
+
+void TileRasterizer::begin_flush(int jobs_per_band) {
+    std::fill(row_pending_.begin(), row_pending_.end(), jobs_per_band);
+    rows_done_ = 0;
+}
+
+void TileRasterizer::flush_depth(const DepthView &depth) {
+    pool_.parallel_for(ntiles(), [this, &depth](int tile) {
+        PROFILE_SCOPE("depth_tile");
+        const std::vector<int> &bin = bins_[tile];
+        int x0 = (tile % tiles_x_) * tile_size_;
+        int y0 = (tile / tiles_x_) * tile_size_;
+        int x1 = std::min(x0 + tile_size_, width_);
+        int y1 = std::min(y0 + tile_size_, height_);
+        RasterStats local;
+        for (size_t i = 0; i < bin.size(); i++) {
+            triangle_depth(mode_, tris_[bin[i]], depth, x0, y0, x1, y1, hiz_, &local);
+        }
+        add_stats(local);
+    });
+}
+
+DepthView TileRasterizer::map_tile(RenderTarget &target, int x0, int y0, int x1, int y1) {
+    static thread_local std::vector<float> scratch;
+    if (scratch.size() < (size_t)(tile_size_ * tile_size_)) scratch.resize(tile_size_ * tile_size_);
+    DepthView depth = target.map_depth(x0, y0, x1, y1, scratch.data());
+    // decoded depth is quantized, so the hiz tiles are rebuilt from it for
+    // their test to stay conservative
+    if (hiz_ && target.depth_format() != DEPTH_FLOAT) {
+        for (int ty = y0 / HiZBuffer::TILE; ty * HiZBuffer::TILE < y1; ty++) {
+            for (int tx = x0 / HiZBuffer::TILE; tx * HiZBuffer::TILE < x1; tx++) {
+                hiz_->update_tile(depth, tx, ty);
+            }
+        }
+    }
+    return depth;
+}
+
+void TileRasterizer::add_stats(const RasterStats &local) {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.add(local);
+}
+
+void TileRasterizer::tile_done(int tile, const RasterStats &local) {
+    band_done(tile / tiles_x_, local);
+}
+
+void TileRasterizer::band_done(int band, const RasterStats &local) {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.add(local);
+    // jobs are handed out in row order, so the finished rows advance as
+    // a front behind the workers
+    if (--row_pending_[band] == 0 && row_callback_) {
+        int rows = rows_done_;
+        while (rows_done_ < tiles_y_ && row_pending_[rows_done_] == 0) rows_done_++;
+        if (rows_done_ != rows) row_callback_(std::min(rows_done_ * tile_size_, height_));
+    }
+}
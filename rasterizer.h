@@ -0,0 +1,142 @@
+#ifndef __RASTERIZER_H__
+#define __RASTERIZER_H__
+
+#include <vector>
+#include <functional>
+#include "geometry.h"
+#include "tgaimage.h"
+#include "threadpool.h"
+#include "hiz.h"
+#include "rendertarget.h"
+#include "texture.h"
+#include "shader.h"
+#include "visibility.h"
+#include "profile.h"
+
+enum RasterMode {
+	RASTER_REFERENCE, // per-pixel barycentric() over the bbox, the original path
+	RASTER_SCALAR,    // integer edge functions stepped incrementally, 8x8 blocks
+	RASTER_AVX2       // edge functions evaluated 8 lanes at a time, 8x8 blocks
+};
+
+// AVX2 when the CPU has it, the scalar edge-function path otherwise
+RasterMode best_raster_mode();
+const char *raster_mode_name(RasterMode mode);
+
+// Primitive counters of the assembly stage (every face lands in exactly one
+// of culled_backface, culled_frustum and passed; clipped counts the faces
+// that went through the clipper) and overdraw counters of the edge-function
+// modes. fragments / pixels_visible is the number of shader invocations per
+// pixel left on screen.
+struct RasterStats {
+	unsigned long culled_backface;
+	unsigned long culled_frustum;
+	unsigned long clipped;
+	unsigned long passed;
+	unsigned long tiles_rejected; // 8x8 tiles skipped by the hiz test
+	unsigned long pixels_tested;  // covered pixels that reached the depth test
+	unsigned long pixels_shaded;  // pixels that passed it and were written
+	unsigned long fragments;      // fragment() invocations
+	unsigned long pixels_visible; // pixels covered once the frame is done
+
+	RasterStats();
+	void add(const RasterStats &o);
+};
+
+Vec3f barycentric(Vec3f *pts, Vec3f P);
+// Rasterizes t into the pixels inside [x0, x1) x [y0, y1), shading with a
+// copy of shader (see IShader). depth must cover the rectangle, and the
+// block modes expect x0 and y0 to be multiples of HiZBuffer::TILE. hiz and
+// stats are optional and ignored by RASTER_REFERENCE.
+template <class Shader>
+void triangle(RasterMode mode, const Triangle &t, const DepthView &depth, TGAImage &image, const Shader &shader, int x0, int y0, int x1, int y1, HiZBuffer *hiz = NULL, RasterStats *stats = NULL);
+
+// triangle() into the samples of a multisampled target (see
+// RenderTarget): coverage and depth per sample, the shader once per pixel.
+// RASTER_REFERENCE takes the scalar path. The color image is left to
+// RenderTarget::resolve().
+template <class Shader>
+void triangle_multisample(RasterMode mode, const Triangle &t, RenderTarget &target, const Shader &shader, int x0, int y0, int x1, int y1, RasterStats *stats = NULL);
+
+// triangle() for depth-only passes such as shadow maps: coverage and the
+// depth test, no shader, nothing interpolated but depth and no color
+// written. Leaves the same depth as triangle() in the same mode;
+// RASTER_REFERENCE takes the scalar path.
+void triangle_depth(RasterMode mode, const Triangle &t, const DepthView &depth, int x0, int y0, int x1, int y1, HiZBuffer *hiz = NULL, RasterStats *stats = NULL);
+
+// Binned rasterizer: submit() sorts triangles into fixed-size screen tiles,
+// flush() rasterizes the tiles in parallel. Tiles cover disjoint pixel
+// rectangles of the render target, so workers never write to the
+// same pixel and each tile replays its triangles in submission order; the
+// result is bit-identical to calling triangle() serially with the same mode.
+//
+// In deferred mode flush() runs in two passes: the tiles are first
+// rasterized into a visibility buffer (depth, triangle id and barycentrics,
+// no shading), then every covered pixel is shaded exactly once, in bands of
+// rows. The output matches the forward path up to the 16-bit barycentrics.
+class TileRasterizer {
+private:
+	int width_;
+	int height_;
+	int tile_size_;
+	int tiles_x_;
+	int tiles_y_;
+	RasterMode mode_;
+	bool cull_backfaces_;
+	bool deferred_;
+	HiZBuffer *hiz_;
+	RasterStats stats_;
+	std::mutex stats_mutex_;
+	std::vector<Triangle> tris_;
+	std::vector<std::vector<int> > bins_;
+	std::vector<int> row_pending_;
+	int rows_done_;
+	std::function<void(int)> row_callback_;
+	VisibilityBuffer vis_;
+	ThreadPool pool_;
+
+	void begin_flush(int jobs_per_band);
+	void add_stats(const RasterStats &local);
+	// a job covering one tile / one band of tile_size rows has finished
+	void tile_done(int tile, const RasterStats &local);
+	void band_done(int band, const RasterStats &local);
+	// float depth of one tile of the target, decoded into a per-thread
+	// scratch tile when the target packs it
+	DepthView map_tile(RenderTarget &target, int x0, int y0, int x1, int y1);
+	template <class Shader>
+	void flush_deferred(RenderTarget &target, const Shader &shader);
+	template <class Shader>
+	void flush_multisample(RenderTarget &target, const Shader &shader);
+public:
+	TileRasterizer(int width, int height, int tile_size = 64, int nthreads = 0);
+	void set_mode(RasterMode mode);
+	RasterMode mode();
+	// whether primitive assembly drops faces turned away from the viewer (on
+	// by default); the rasterizer itself draws both windings
+	void set_cull_backfaces(bool cull);
+	bool cull_backfaces();
+	// two-pass visibility buffer shading in flush(), off by default and
+	// ignored for multisampled targets
+	void set_deferred(bool deferred);
+	bool deferred();
+	// tile_size must be a multiple of HiZBuffer::REGION
+	void set_hiz(HiZBuffer *hiz);
+	const RasterStats &stats();
+	// called during flush, in order, with n once image rows [0, n) are final
+	void set_row_callback(const std::function<void(int)> &callback);
+	void begin();
+	void submit(const Triangle &t);
+	// target must have the size the rasterizer was created with; a
+	// multisampled target is rasterized per sample and resolved
+	template <class Shader>
+	void flush(RenderTarget &target, const Shader &shader);
+	// flush() through triangle_depth() into a float depth buffer of the
+	// rasterizer's size (the row callback is not called)
+	void flush_depth(const DepthView &depth);
+	int nthreads();
+	int ntiles();
+};
+
+#include "rasterizer_impl.h"
+
+#endif //__RASTERIZER_H__
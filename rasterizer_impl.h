@@ -0,0 +1,662 @@
+#ifndef __RASTERIZER_IMPL_H__
+#define __RASTERIZER_IMPL_H__
+
+// Template half of rasterizer.h: the edge-function kernels are instantiated
+// per shader type so the shader's fragment() inlines into the pixel loop.
+// Only included from rasterizer.h.
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RASTER_HAS_AVX2 1
+#endif
+
+namespace raster_detail {
+
+// Edge-function rasterizer. Vertices are snapped to integer pixel positions
+// (the vertex stage already rounds), so the three edge functions are exact in
+// int32 and can be stepped with one add per pixel. Pixels are sampled at
+// integer coordinates with inclusive edges like barycentric(), and weights
+// use one reciprocal per triangle instead of three divides per pixel. This
+// agrees with the reference path only within the golden tolerances: the
+// reference takes its weights from float divides, where 1 - (u.x + u.y) / u.z
+// can round below zero on an edge, drops faces with a tiny cross product,
+// and interpolates depth with other rounding, so edge pixels and depth ties
+// between faces can come out differently.
+struct EdgeSetup {
+	int A[3], B[3], C[3];       // e_i(x, y) = A[i]*x + B[i]*y + C[i]
+	float inv_area;
+	float z[3];
+	float zmax;                 // nearest vertex depth, padded for the hiz test
+	int minx, miny, maxx, maxy; // bbox clamped to the clip rectangle
+	float rhw[3];               // 1/w of the vertices
+	bool perspective;           // false when the w are equal and weights need no correction
+};
+
+template <class Shader>
+struct ShadeContext {
+	DepthView depth;
+	TGAImage *image;
+	HiZBuffer *hiz;
+	Shader shader;
+};
+
+inline bool setup_edges(const Vec3f *pts, int x0, int y0, int x1, int y1, EdgeSetup &s) {
+	int px[3], py[3];
+	for (int i = 0; i < 3; i++) {
+		px[i] = (int)std::floor(pts[i].x + .5f);
+		py[i] = (int)std::floor(pts[i].y + .5f);
+		s.z[i] = pts[i].z;
+	}
+	s.zmax = hiz_conservative_depth(std::max(s.z[0], std::max(s.z[1], s.z[2])));
+	s.minx = std::max(x0, std::min(px[0], std::min(px[1], px[2])));
+	s.miny = std::max(y0, std::min(py[0], std::min(py[1], py[2])));
+	s.maxx = std::min(x1 - 1, std::max(px[0], std::max(px[1], px[2])));
+	s.maxy = std::min(y1 - 1, std::max(py[0], std::max(py[1], py[2])));
+	if (s.minx > s.maxx || s.miny > s.maxy) return false;
+	int area = (px[2] - px[0]) * (py[1] - py[0]) - (px[1] - px[0]) * (py[2] - py[0]);
+	if (area == 0) return false;
+	// weight of vertex 1 and 2, same terms as barycentric() (u.y and u.x)
+	s.A[1] = -(py[2] - py[0]);
+	s.B[1] = px[2] - px[0];
+	s.C[1] = px[0] * (py[2] - py[0]) - (px[2] - px[0]) * py[0];
+	s.A[2] = py[1] - py[0];
+	s.B[2] = -(px[1] - px[0]);
+	s.C[2] = (px[1] - px[0]) * py[0] - px[0] * (py[1] - py[0]);
+	s.A[0] = -s.A[1] - s.A[2];
+	s.B[0] = -s.B[1] - s.B[2];
+	s.C[0] = area - s.C[1] - s.C[2];
+	if (area < 0) {
+		for (int i = 0; i < 3; i++) {
+			s.A[i] = -s.A[i];
+			s.B[i] = -s.B[i];
+			s.C[i] = -s.C[i];
+		}
+		area = -area;
+	}
+	s.inv_area = 1.f / area;
+	return true;
+}
+
+inline void setup_perspective(const Triangle &t, EdgeSetup &s) {
+	for (int i = 0; i < 3; i++) s.rhw[i] = t.rhw[i];
+	s.perspective = s.rhw[0] != s.rhw[1] || s.rhw[0] != s.rhw[2];
+}
+
+// Screen-space weights to perspective-correct ones: each weight over its
+// vertex w, renormalized. Only the weights handed to the shader go through
+// this; depth is linear on screen and keeps the screen-space ones.
+inline void perspective_correct(const EdgeSetup &s, float &b0, float &b1, float &b2) {
+	float q0 = b0 * s.rhw[0], q1 = b1 * s.rhw[1], q2 = b2 * s.rhw[2];
+	float r = 1.f / (q0 + q1 + q2);
+	b0 = q0 * r;
+	b1 = q1 * r;
+	b2 = q2 * r;
+}
+
+// Depth test and write for one covered pixel. The fragment runs before the
+// depth write so a discarded pixel leaves both buffers untouched.
+template <class Shader>
+inline bool shade_pixel(ShadeContext<Shader> &ctx, float &depth, float z, int x, int y, float b0, float b1, float b2) {
+	TGAColor color;
+	if (ctx.shader.fragment(Vec3f(b0, b1, b2), color)) return false;
+	depth = z;
+	ctx.image->set(x, y, color);
+	return true;
+}
+
+// the visibility pass: depth plus what is needed to shade the pixel later
+inline bool shade_pixel(ShadeContext<VisibilityShader> &ctx, float &depth, float z, int x, int y, float b0, float b1, float b2) {
+	(void)b0;
+	depth = z;
+	ctx.shader.store(x, y, b1, b2);
+	return true;
+}
+
+inline TriangleSetup triangle_setup(const Triangle &t, const EdgeSetup &s) {
+	TriangleSetup setup = {&t, {(float)s.A[0], (float)s.A[1], (float)s.A[2]}, {(float)s.B[0], (float)s.B[1], (float)s.B[2]}, s.inv_area};
+	return setup;
+}
+
+// Walks the bbox in N x N blocks aligned to multiples of N. Each edge is
+// evaluated at the block corners: a block with every corner outside one edge
+// is skipped, a block with every corner inside all edges is handed to the
+// kernel as fully covered so it can drop the per-pixel edge test. With a hiz
+// buffer (N must then be its tile size) blocks behind the stored depth are
+// skipped before any per-pixel work, and the tile is refreshed after writes.
+template <int N, class Context, class Kernel>
+void traverse_blocks(const EdgeSetup &s, Context &ctx, RasterStats &stats, Kernel kernel) {
+	if (ctx.hiz && ctx.hiz->rect_occluded(s.minx, s.miny, s.maxx, s.maxy, s.zmax)) {
+		stats.tiles_rejected += ((s.maxx / N) - (s.minx / N) + 1) * ((s.maxy / N) - (s.miny / N) + 1);
+		return;
+	}
+	int bx0 = s.minx & ~(N - 1);
+	int by0 = s.miny & ~(N - 1);
+	for (int by = by0; by <= s.maxy; by += N) {
+		for (int bx = bx0; bx <= s.maxx; bx += N) {
+			bool reject = false;
+			bool full = true;
+			for (int i = 0; i < 3 && !reject; i++) {
+				int e00 = s.A[i] * bx + s.B[i] * by + s.C[i];
+				int e10 = e00 + s.A[i] * (N - 1);
+				int e01 = e00 + s.B[i] * (N - 1);
+				int e11 = e10 + s.B[i] * (N - 1);
+				int inside = (e00 >= 0) + (e10 >= 0) + (e01 >= 0) + (e11 >= 0);
+				reject = (inside == 0);
+				full = full && (inside == 4);
+			}
+			if (reject) continue;
+			if (ctx.hiz && ctx.hiz->tile_occluded(bx / N, by / N, s.zmax)) {
+				stats.tiles_rejected++;
+				continue;
+			}
+			int cx0 = std::max(bx, s.minx);
+			int cy0 = std::max(by, s.miny);
+			int cx1 = std::min(bx + N - 1, s.maxx);
+			int cy1 = std::min(by + N - 1, s.maxy);
+			if (kernel(s, ctx, bx, by, cx0, cy0, cx1, cy1, full, stats) && ctx.hiz) {
+				ctx.hiz->update_tile(ctx.depth, bx / N, by / N);
+			}
+		}
+	}
+}
+
+template <class Shader>
+int block_scalar(const EdgeSetup &s, ShadeContext<Shader> &ctx, int bx, int by, int cx0, int cy0, int cx1, int cy1, bool full, RasterStats &stats) {
+	(void)bx;
+	(void)by;
+	int shaded = 0;
+	int invoked = 0;
+	int row[3];
+	for (int i = 0; i < 3; i++) {
+		row[i] = s.A[i] * cx0 + s.B[i] * cy0 + s.C[i];
+	}
+	for (int y = cy0; y <= cy1; y++) {
+		int e0 = row[0], e1 = row[1], e2 = row[2];
+		for (int x = cx0; x <= cx1; x++, e0 += s.A[0], e1 += s.A[1], e2 += s.A[2]) {
+			if (!full && (e0 | e1 | e2) < 0) continue;
+			stats.pixels_tested++;
+			float b0 = e0 * s.inv_area;
+			float b1 = e1 * s.inv_area;
+			float b2 = e2 * s.inv_area;
+			float z = s.z[0] * b0 + s.z[1] * b1 + s.z[2] * b2;
+			float &depth = ctx.depth.at(x, y);
+			if (depth < z) {
+				invoked++;
+				if (s.perspective) perspective_correct(s, b0, b1, b2);
+				if (shade_pixel(ctx, depth, z, x, y, b0, b1, b2)) shaded++;
+			}
+		}
+		for (int i = 0; i < 3; i++) row[i] += s.B[i];
+	}
+	stats.fragments += invoked;
+	stats.pixels_shaded += shaded;
+	return shaded;
+}
+
+#ifdef RASTER_HAS_AVX2
+// one 8x8 block, a row of 8 pixels per iteration: coverage, depth
+// interpolation and the depth test are done for all lanes at once, only the
+// surviving pixels are shaded
+template <class Shader>
+__attribute__((target("avx2")))
+int block_avx2(const EdgeSetup &s, ShadeContext<Shader> &ctx, int bx, int by, int cx0, int cy0, int cx1, int cy1, bool full, RasterStats &stats) {
+	(void)by;
+	int shaded = 0;
+	int invoked = 0;
+	const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	__m256i xs = _mm256_add_epi32(_mm256_set1_epi32(bx), lane);
+	__m256i clip = _mm256_and_si256(_mm256_cmpgt_epi32(xs, _mm256_set1_epi32(cx0 - 1)), _mm256_cmpgt_epi32(_mm256_set1_epi32(cx1 + 1), xs));
+	__m256i e[3], dy[3];
+	__m256 z[3];
+	for (int i = 0; i < 3; i++) {
+		e[i] = _mm256_add_epi32(_mm256_set1_epi32(s.A[i] * bx + s.B[i] * cy0 + s.C[i]), _mm256_mullo_epi32(lane, _mm256_set1_epi32(s.A[i])));
+		dy[i] = _mm256_set1_epi32(s.B[i]);
+		z[i] = _mm256_set1_ps(s.z[i]);
+	}
+	__m256 inv_area = _mm256_set1_ps(s.inv_area);
+	float b[3][8], zs[8];
+	for (int y = cy0; y <= cy1; y++) {
+		__m256i mask = clip;
+		if (!full) {
+			__m256i outside = _mm256_cmpgt_epi32(_mm256_setzero_si256(), _mm256_or_si256(e[0], _mm256_or_si256(e[1], e[2])));
+			mask = _mm256_andnot_si256(outside, mask);
+		}
+		if (!_mm256_testz_si256(mask, mask)) {
+			stats.pixels_tested += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(mask)));
+			__m256 b0 = _mm256_mul_ps(_mm256_cvtepi32_ps(e[0]), inv_area);
+			__m256 b1 = _mm256_mul_ps(_mm256_cvtepi32_ps(e[1]), inv_area);
+			__m256 b2 = _mm256_mul_ps(_mm256_cvtepi32_ps(e[2]), inv_area);
+			__m256 zz = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(z[0], b0), _mm256_mul_ps(z[1], b1)), _mm256_mul_ps(z[2], b2));
+			float *zrow = &ctx.depth.at(bx, y);
+			__m256 depth = _mm256_maskload_ps(zrow, mask);
+			__m256 pass = _mm256_and_ps(_mm256_castsi256_ps(mask), _mm256_cmp_ps(depth, zz, _CMP_LT_OQ));
+			int bits = _mm256_movemask_ps(pass);
+			if (bits) {
+				invoked += __builtin_popcount(bits);
+				if (s.perspective) {
+					__m256 q0 = _mm256_mul_ps(b0, _mm256_set1_ps(s.rhw[0]));
+					__m256 q1 = _mm256_mul_ps(b1, _mm256_set1_ps(s.rhw[1]));
+					__m256 q2 = _mm256_mul_ps(b2, _mm256_set1_ps(s.rhw[2]));
+					__m256 r = _mm256_div_ps(_mm256_set1_ps(1.f), _mm256_add_ps(_mm256_add_ps(q0, q1), q2));
+					b0 = _mm256_mul_ps(q0, r);
+					b1 = _mm256_mul_ps(q1, r);
+					b2 = _mm256_mul_ps(q2, r);
+				}
+				_mm256_storeu_ps(b[0], b0);
+				_mm256_storeu_ps(b[1], b1);
+				_mm256_storeu_ps(b[2], b2);
+				_mm256_storeu_ps(zs, zz);
+				for (; bits; bits &= bits - 1) {
+					int l = __builtin_ctz(bits);
+					if (shade_pixel(ctx, zrow[l], zs[l], bx + l, y, b[0][l], b[1][l], b[2][l])) shaded++;
+				}
+			}
+		}
+		for (int i = 0; i < 3; i++) e[i] = _mm256_add_epi32(e[i], dy[i]);
+	}
+	stats.fragments += invoked;
+	stats.pixels_shaded += shaded;
+	return shaded;
+}
+#endif
+
+// The original per-pixel traversal: barycentric() at every pixel of the
+// clamped bbox. Kept as the baseline the goldens are rendered with; the
+// block kernels match it in the interior of faces but can differ on edge
+// pixels (see EdgeSetup).
+template <class Shader>
+void reference_triangle(const Triangle &t, const EdgeSetup &s, ShadeContext<Shader> &ctx, int x0, int y0, int x1, int y1) {
+	const Vec3f *pts = t.pts;
+	Vec2f bboxmin(std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+	Vec2f bboxmax(-std::numeric_limits<float>::max(), -std::numeric_limits<float>::max());
+	Vec2f clampmin(x0, y0);
+	Vec2f clampmax(x1 - 1, y1 - 1);
+	for (int i = 0; i < 3; i++) {
+		for (int j = 0; j < 2; j++) {
+			bboxmin[j] = std::max(clampmin[j], std::min(bboxmin[j], pts[i][j]));
+			bboxmax[j] = std::min(clampmax[j], std::max(bboxmax[j], pts[i][j]));
+		}
+	}
+	Vec3f P;
+	for (P.x = bboxmin.x; P.x <= bboxmax.x; P.x++) {
+		for (P.y = bboxmin.y; P.y <= bboxmax.y; P.y++) {
+			Vec3f bc_screen = barycentric(const_cast<Vec3f *>(pts), P);
+			if (bc_screen.x < 0 || bc_screen.y < 0 || bc_screen.z < 0)
+				continue;
+			P.z = 0;
+			for (int i = 0; i < 3; i++) {
+				P.z += pts[i][2] * bc_screen[i];
+			}
+			float &depth = ctx.depth.at(int(P.x), int(P.y));
+			if (depth < P.z) {
+				if (s.perspective) perspective_correct(s, bc_screen.x, bc_screen.y, bc_screen.z);
+				shade_pixel(ctx, depth, P.z, P.x, P.y, bc_screen.x, bc_screen.y, bc_screen.z);
+			}
+		}
+	}
+}
+
+// Multisampled rasterization. Vertices sit on the integer pixel grid, so
+// the sample at offset o (in 1/16 pixel) of pixel p is inside edge i exactly
+// when e_i(p) >= ceil(-(A[i]*o.x + B[i]*o.y) / 16): coverage stays an int32
+// compare of the same edge values the single-sample kernels use, against a
+// threshold per sample. Depth is interpolated and tested per sample; the
+// fragment runs once per pixel, at the pixel center, when any sample passes
+// and its color goes to every sample that passed.
+template <int S, class Shader>
+struct SampleContext {
+	float *depth;    // S floats per pixel
+	uint32_t *color; // S BGRA colors per pixel
+	int width;
+	Shader shader;
+};
+
+template <int S>
+struct SampleSetup {
+	int thresh[3][S];   // smallest e_i(p) that covers sample s
+	float offset[3][S]; // e_i at sample s minus e_i(p)
+	int min_thresh[3];
+	int max_thresh[3];
+};
+
+template <int S>
+void setup_samples(const EdgeSetup &s, SampleSetup<S> &ss) {
+	const int *pattern = sample_pattern(S);
+	for (int i = 0; i < 3; i++) {
+		ss.min_thresh[i] = std::numeric_limits<int>::max();
+		ss.max_thresh[i] = std::numeric_limits<int>::min();
+		for (int k = 0; k < S; k++) {
+			int d = s.A[i] * pattern[2 * k] + s.B[i] * pattern[2 * k + 1];
+			// ceil(-d / 16), with >> flooring negative values
+			ss.thresh[i][k] = -(d >> 4);
+			ss.offset[i][k] = d * (1.f / 16.f);
+			ss.min_thresh[i] = std::min(ss.min_thresh[i], ss.thresh[i][k]);
+			ss.max_thresh[i] = std::max(ss.max_thresh[i], ss.thresh[i][k]);
+		}
+	}
+}
+
+template <int S, class Shader>
+inline bool shade_samples(SampleContext<S, Shader> &ctx, int x, int y, float b0, float b1, float b2, unsigned pass, const float *z) {
+	TGAColor color;
+	if (ctx.shader.fragment(Vec3f(b0, b1, b2), color)) return false;
+	size_t base = (size_t)(x + y * ctx.width) * S;
+	for (; pass; pass &= pass - 1) {
+		int k = __builtin_ctz(pass);
+		ctx.depth[base + k] = z[k];
+		ctx.color[base + k] = color.val;
+	}
+	return true;
+}
+
+// traverse_blocks for samples: a block is skipped when no sample of it can
+// be inside an edge and fully covered when every sample is (no hiz)
+template <int N, int S, class Context, class Kernel>
+void traverse_sample_blocks(const EdgeSetup &s, const SampleSetup<S> &ss, Context &ctx, RasterStats &stats, Kernel kernel) {
+	int bx0 = s.minx & ~(N - 1);
+	int by0 = s.miny & ~(N - 1);
+	for (int by = by0; by <= s.maxy; by += N) {
+		for (int bx = bx0; bx <= s.maxx; bx += N) {
+			bool reject = false;
+			bool full = true;
+			for (int i = 0; i < 3 && !reject; i++) {
+				int e00 = s.A[i] * bx + s.B[i] * by + s.C[i];
+				int e10 = e00 + s.A[i] * (N - 1);
+				int e01 = e00 + s.B[i] * (N - 1);
+				int e11 = e10 + s.B[i] * (N - 1);
+				int lo = ss.min_thresh[i], hi = ss.max_thresh[i];
+				reject = e00 < lo && e10 < lo && e01 < lo && e11 < lo;
+				full = full && e00 >= hi && e10 >= hi && e01 >= hi && e11 >= hi;
+			}
+			if (reject) continue;
+			int cx0 = std::max(bx, s.minx);
+			int cy0 = std::max(by, s.miny);
+			int cx1 = std::min(bx + N - 1, s.maxx);
+			int cy1 = std::min(by + N - 1, s.maxy);
+			kernel(s, ss, ctx, cx0, cy0, cx1, cy1, full, stats);
+		}
+	}
+}
+
+template <int S, class Shader>
+void block_samples_scalar(const EdgeSetup &s, const SampleSetup<S> &ss, SampleContext<S, Shader> &ctx, int cx0, int cy0, int cx1, int cy1, bool full, RasterStats &stats) {
+	int row[3];
+	for (int i = 0; i < 3; i++) {
+		row[i] = s.A[i] * cx0 + s.B[i] * cy0 + s.C[i];
+	}
+	float z[S];
+	for (int y = cy0; y <= cy1; y++) {
+		int e[3] = {row[0], row[1], row[2]};
+		for (int x = cx0; x <= cx1; x++, e[0] += s.A[0], e[1] += s.A[1], e[2] += s.A[2]) {
+			unsigned cover = 0;
+			for (int k = 0; k < S; k++) {
+				if (full || (e[0] >= ss.thresh[0][k] && e[1] >= ss.thresh[1][k] && e[2] >= ss.thresh[2][k])) cover |= 1u << k;
+			}
+			if (!cover) continue;
+			stats.pixels_tested++;
+			const float *depth = ctx.depth + (size_t)(x + y * ctx.width) * S;
+			unsigned pass = 0;
+			for (unsigned bits = cover; bits; bits &= bits - 1) {
+				int k = __builtin_ctz(bits);
+				z[k] = (s.z[0] * (e[0] + ss.offset[0][k]) + s.z[1] * (e[1] + ss.offset[1][k]) + s.z[2] * (e[2] + ss.offset[2][k])) * s.inv_area;
+				if (depth[k] < z[k]) pass |= 1u << k;
+			}
+			if (!pass) continue;
+			stats.fragments++;
+			float b0 = e[0] * s.inv_area, b1 = e[1] * s.inv_area, b2 = e[2] * s.inv_area;
+			if (s.perspective) perspective_correct(s, b0, b1, b2);
+			if (shade_samples(ctx, x, y, b0, b1, b2, pass, z)) stats.pixels_shaded++;
+		}
+		for (int i = 0; i < 3; i++) row[i] += s.B[i];
+	}
+}
+
+#ifdef RASTER_HAS_AVX2
+// 8 samples per vector: one pixel at 8x, two adjacent pixels at 4x
+template <int S, class Shader>
+__attribute__((target("avx2")))
+void block_samples_avx2(const EdgeSetup &s, const SampleSetup<S> &ss, SampleContext<S, Shader> &ctx, int cx0, int cy0, int cx1, int cy1, bool full, RasterStats &stats) {
+	const int P = 8 / S;
+	const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i pixel = _mm256_srli_epi32(lane, S == 8 ? 3 : 2);
+	__m256i thresh[3], step[3];
+	__m256 offset[3], z[3];
+	int t[8];
+	float o[8];
+	for (int i = 0; i < 3; i++) {
+		for (int l = 0; l < 8; l++) {
+			t[l] = ss.thresh[i][l % S] - 1;
+			o[l] = ss.offset[i][l % S];
+		}
+		thresh[i] = _mm256_loadu_si256((const __m256i *)t);
+		offset[i] = _mm256_loadu_ps(o);
+		step[i] = _mm256_mullo_epi32(pixel, _mm256_set1_epi32(s.A[i]));
+		z[i] = _mm256_set1_ps(s.z[i]);
+	}
+	__m256 inv_area = _mm256_set1_ps(s.inv_area);
+	float zs[8];
+	for (int y = cy0; y <= cy1; y++) {
+		int row[3];
+		for (int i = 0; i < 3; i++) row[i] = s.A[i] * cx0 + s.B[i] * y + s.C[i];
+		for (int x = cx0; x <= cx1; x += P) {
+			__m256i e[3];
+			for (int i = 0; i < 3; i++) e[i] = _mm256_add_epi32(_mm256_set1_epi32(row[i] + s.A[i] * (x - cx0)), step[i]);
+			__m256i mask = _mm256_cmpgt_epi32(_mm256_set1_epi32(cx1 - x + 1), pixel);
+			if (!full) {
+				for (int i = 0; i < 3; i++) mask = _mm256_and_si256(mask, _mm256_cmpgt_epi32(e[i], thresh[i]));
+			}
+			int cover = _mm256_movemask_ps(_mm256_castsi256_ps(mask));
+			if (!cover) continue;
+			__m256 zz = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(
+				_mm256_mul_ps(z[0], _mm256_add_ps(_mm256_cvtepi32_ps(e[0]), offset[0])),
+				_mm256_mul_ps(z[1], _mm256_add_ps(_mm256_cvtepi32_ps(e[1]), offset[1]))),
+				_mm256_mul_ps(z[2], _mm256_add_ps(_mm256_cvtepi32_ps(e[2]), offset[2]))), inv_area);
+			float *depth = ctx.depth + (size_t)(x + y * ctx.width) * S;
+			__m256 stored = _mm256_maskload_ps(depth, mask);
+			int pass = _mm256_movemask_ps(_mm256_and_ps(_mm256_castsi256_ps(mask), _mm256_cmp_ps(stored, zz, _CMP_LT_OQ)));
+			if (pass) _mm256_storeu_ps(zs, zz);
+			for (int p = 0; p < P; p++) {
+				unsigned pixel_cover = (cover >> (p * S)) & ((1u << S) - 1);
+				unsigned pixel_pass = (pass >> (p * S)) & ((1u << S) - 1);
+				if (!pixel_cover) continue;
+				stats.pixels_tested++;
+				if (!pixel_pass) continue;
+				stats.fragments++;
+				int px = x + p;
+				float b0 = (row[0] + s.A[0] * (px - cx0)) * s.inv_area;
+				float b1 = (row[1] + s.A[1] * (px - cx0)) * s.inv_area;
+				float b2 = (row[2] + s.A[2] * (px - cx0)) * s.inv_area;
+				if (s.perspective) perspective_correct(s, b0, b1, b2);
+				if (shade_samples(ctx, px, y, b0, b1, b2, pixel_pass, zs + p * S)) stats.pixels_shaded++;
+			}
+		}
+	}
+}
+#endif
+
+template <int S, class Shader>
+void triangle_samples(RasterMode mode, const Triangle &t, RenderTarget &target, const Shader &shader, int x0, int y0, int x1, int y1, RasterStats &stats) {
+	EdgeSetup s;
+	if (!setup_edges(t.pts, x0, y0, x1, y1, s)) return;
+	setup_perspective(t, s);
+	SampleSetup<S> ss;
+	setup_samples(s, ss);
+	SampleContext<S, Shader> ctx = {target.sample_depth(), target.sample_color(), target.width(), shader};
+	ctx.shader.begin(triangle_setup(t, s));
+#ifdef RASTER_HAS_AVX2
+	if (mode == RASTER_AVX2) {
+		traverse_sample_blocks<8>(s, ss, ctx, stats, block_samples_avx2<S, Shader>);
+		return;
+	}
+#endif
+	(void)mode;
+	traverse_sample_blocks<8>(s, ss, ctx, stats, block_samples_scalar<S, Shader>);
+}
+
+// Second pass of deferred shading over rows [y0, y1): one fragment() per
+// covered pixel. begin() runs whenever the triangle changes along the row,
+// with the setup recomputed from the stored triangle.
+template <class Shader>
+void resolve_rows(const VisibilityBuffer &vis, const Triangle *tris, int y0, int y1, TGAImage &image, Shader shader, RasterStats &stats) {
+	int width = vis.width();
+	uint32_t current = VisibilityBuffer::EMPTY;
+	for (int y = y0; y < y1; y++) {
+		for (int x = 0; x < width; x++) {
+			const VisSample &v = vis.at(x, y);
+			if (v.id == VisibilityBuffer::EMPTY) continue;
+			if (v.id != current) {
+				EdgeSetup s;
+				setup_edges(tris[v.id].pts, 0, 0, width, vis.height(), s);
+				shader.begin(triangle_setup(tris[v.id], s));
+				current = v.id;
+			}
+			float b1 = v.b1 * (1.f / 65535.f);
+			float b2 = v.b2 * (1.f / 65535.f);
+			TGAColor color;
+			stats.fragments++;
+			if (!shader.fragment(Vec3f(1.f - b1 - b2, b1, b2), color)) image.set(x, y, color);
+		}
+	}
+}
+
+}
+
+template <class Shader>
+void triangle(RasterMode mode, const Triangle &t, const DepthView &depth, TGAImage &image, const Shader &shader, int x0, int y0, int x1, int y1, HiZBuffer *hiz, RasterStats *stats)
+{
+	using namespace raster_detail;
+	EdgeSetup s;
+	if (!setup_edges(t.pts, x0, y0, x1, y1, s)) return;
+	setup_perspective(t, s);
+	ShadeContext<Shader> ctx = {depth, &image, hiz, shader};
+	ctx.shader.begin(triangle_setup(t, s));
+	if (mode == RASTER_REFERENCE) {
+		reference_triangle(t, s, ctx, x0, y0, x1, y1);
+		return;
+	}
+	RasterStats local;
+#ifdef RASTER_HAS_AVX2
+	if (mode == RASTER_AVX2) {
+		traverse_blocks<HiZBuffer::TILE>(s, ctx, local, block_avx2<Shader>);
+	} else
+#endif
+	traverse_blocks<HiZBuffer::TILE>(s, ctx, local, block_scalar<Shader>);
+	if (stats) stats->add(local);
+}
+
+template <class Shader>
+void triangle_multisample(RasterMode mode, const Triangle &t, RenderTarget &target, const Shader &shader, int x0, int y0, int x1, int y1, RasterStats *stats)
+{
+	RasterStats local;
+	if (target.samples() == 8) {
+		raster_detail::triangle_samples<8>(mode, t, target, shader, x0, y0, x1, y1, local);
+	} else if (target.samples() == 4) {
+		raster_detail::triangle_samples<4>(mode, t, target, shader, x0, y0, x1, y1, local);
+	}
+	if (stats) stats->add(local);
+}
+
+template <class Shader>
+void TileRasterizer::flush(RenderTarget &target, const Shader &shader) {
+	if (target.samples() > 1) {
+		flush_multisample(target, shader);
+		return;
+	}
+	if (deferred_) {
+		flush_deferred(target, shader);
+		return;
+	}
+	// the job captures two pointers so it fits std::function's small buffer
+	// and the flush does not allocate
+	struct { RenderTarget *target; const Shader *shader; } args = {&target, &shader};
+	begin_flush(tiles_x_);
+	pool_.parallel_for(ntiles(), [this, &args](int tile) {
+		PROFILE_SCOPE("tile");
+		const std::vector<int> &bin = bins_[tile];
+		int x0 = (tile % tiles_x_) * tile_size_;
+		int y0 = (tile / tiles_x_) * tile_size_;
+		int x1 = std::min(x0 + tile_size_, width_);
+		int y1 = std::min(y0 + tile_size_, height_);
+		RasterStats local;
+		DepthView depth = map_tile(*args.target, x0, y0, x1, y1);
+		for (size_t i = 0; i < bin.size(); i++) {
+			triangle(mode_, tris_[bin[i]], depth, args.target->color(), *args.shader, x0, y0, x1, y1, hiz_, &local);
+		}
+		args.target->unmap_depth(depth, x1, y1);
+		tile_done(tile, local);
+	});
+}
+
+template <class Shader>
+void TileRasterizer::flush_deferred(RenderTarget &target, const Shader &shader) {
+	struct { RenderTarget *target; const Shader *shader; } args = {&target, &shader};
+	pool_.parallel_for(ntiles(), [this, &args](int tile) {
+		PROFILE_SCOPE("visibility_tile");
+		const std::vector<int> &bin = bins_[tile];
+		int x0 = (tile % tiles_x_) * tile_size_;
+		int y0 = (tile / tiles_x_) * tile_size_;
+		int x1 = std::min(x0 + tile_size_, width_);
+		int y1 = std::min(y0 + tile_size_, height_);
+		VisibilityShader visibility(vis_, tris_.data());
+		RasterStats local;
+		vis_.clear(x0, y0, x1, y1);
+		DepthView depth = map_tile(*args.target, x0, y0, x1, y1);
+		for (size_t i = 0; i < bin.size(); i++) {
+			triangle(mode_, tris_[bin[i]], depth, args.target->color(), visibility, x0, y0, x1, y1, hiz_, &local);
+		}
+		args.target->unmap_depth(depth, x1, y1);
+		// writing the visibility buffer is not shading
+		local.fragments = 0;
+		add_stats(local);
+	});
+	begin_flush(1);
+	pool_.parallel_for(tiles_y_, [this, &args](int band) {
+		PROFILE_SCOPE("resolve_band");
+		RasterStats local;
+		int y0 = band * tile_size_;
+		raster_detail::resolve_rows(vis_, tris_.data(), y0, std::min(y0 + tile_size_, height_), args.target->color(), *args.shader, local);
+		band_done(band, local);
+	});
+}
+
+// A box resolve only reads the tile's own samples, so each tile is resolved
+// as soon as it is rasterized; a tent resolve reads the neighbouring tiles'
+// samples too and runs as a second pass over bands of rows.
+template <class Shader>
+void TileRasterizer::flush_multisample(RenderTarget &target, const Shader &shader) {
+	struct { RenderTarget *target; const Shader *shader; } args = {&target, &shader};
+	bool tent = target.resolve_filter() == RESOLVE_TENT;
+	begin_flush(tiles_x_);
+	pool_.parallel_for(ntiles(), [this, &args, tent](int tile) {
+		PROFILE_SCOPE("msaa_tile");
+		const std::vector<int> &bin = bins_[tile];
+		int x0 = (tile % tiles_x_) * tile_size_;
+		int y0 = (tile / tiles_x_) * tile_size_;
+		int x1 = std::min(x0 + tile_size_, width_);
+		int y1 = std::min(y0 + tile_size_, height_);
+		RasterStats local;
+		for (size_t i = 0; i < bin.size(); i++) {
+			triangle_multisample(mode_, tris_[bin[i]], *args.target, *args.shader, x0, y0, x1, y1, &local);
+		}
+		if (tent) {
+			add_stats(local);
+		} else {
+			args.target->resolve(x0, y0, x1, y1);
+			tile_done(tile, local);
+		}
+	});
+	if (!tent) return;
+	begin_flush(1);
+	pool_.parallel_for(tiles_y_, [this, &args](int band) {
+		PROFILE_SCOPE("resolve_band");
+		int y0 = band * tile_size_;
+		args.target->resolve(0, y0, width_, std::min(y0 + tile_size_, height_));
+		band_done(band, RasterStats());
+	});
+}
+
+#endif //__RASTERIZER_IMPL_H__
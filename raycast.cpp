@@ -0,0 +1,68 @@
+#include <cfloat>
+#include <algorithm>
+#include "raycast.h"
+
+CameraRays::CameraRays(const Mat4 &camera, int width, int height) {
+    Mat4 inverse = camera.inverse();
+    float half_w = width * .5f, half_h = height * .5f;
+    for (int i = 0; i < 4; i++) {
+        base_[i] = inverse[i][2] + inverse[i][3] - inverse[i][0] - inverse[i][1];
+        step_x_[i] = inverse[i][0] / half_w;
+        step_y_[i] = inverse[i][1] / half_h;
+        depth_[i] = inverse[i][2];
+    }
+}
+
+// NDC z is larger nearer the viewer, so a ray runs from the point at z = 1
+// (a) to the one at z = 0 (b). camera maps a / a.w to (x, y, 1, 1) / a.w, so
+// the clip-space w there is 1 / a.w, and w is affine along the ray.
+void CameraRays::packet(int x, int y, int x1, int y1, RayPacket &p) const {
+    for (int i = 0; i < RAY_PACKET; i++) {
+        int px = x + i % PACKET_W, py = y + i / PACKET_W;
+        float a[4], b[4];
+        for (int k = 0; k < 4; k++) {
+            a[k] = base_[k] + px * step_x_[k] + py * step_y_[k];
+            b[k] = a[k] - depth_[k];
+        }
+        float wa = 1.f / a[3], wb = 1.f / b[3];
+        p.ox[i] = a[0] * wa;
+        p.oy[i] = a[1] * wa;
+        p.oz[i] = a[2] * wa;
+        p.dx[i] = b[0] * wb - p.ox[i];
+        p.dy[i] = b[1] * wb - p.oy[i];
+        p.dz[i] = b[2] * wb - p.oz[i];
+        float dw = wb - wa;
+        p.tmin[i] = dw > 0.f ? (CLIP_NEAR_W - wa) / dw : -FLT_MAX;
+        p.tmax[i] = dw < 0.f ? (CLIP_NEAR_W - wa) / dw : FLT_MAX;
+        if (px >= x1 || py >= y1) {
+            p.tmin[i] = 0.f;
+            p.tmax[i] = -1.f;
+        }
+    }
+}
+
+RayStats::RayStats() : rays(0), hits(0), fragments(0), trace(), seconds(0) {}
+
+void RayStats::add(const RayStats &o) {
+    rays += o.rays;
+    hits += o.hits;
+    fragments += o.fragments;
+    trace.add(o.trace);
+    seconds += o.seconds;
+}
+
+RayCaster::RayCaster(int width, int height, int tile_size, int nthreads) : width_(width), height_(height), tile_size_(tile_size), mode_(best_trace_mode()), cull_backfaces_(true), stats_(), pool_(nthreads) {
+    tiles_x_ = (width + tile_size - 1) / tile_size;
+    tiles_y_ = (height + tile_size - 1) / tile_size;
+}
+
+DepthView RayCaster::map_tile(RenderTarget &target, int x0, int y0, int x1, int y1) {
+    static thread_local std::vector<float> scratch;
+    if (scratch.size() < (size_t)(tile_size_ * tile_size_)) scratch.resize(tile_size_ * tile_size_);
+    return target.map_depth(x0, y0, x1, y1, scratch.data());
+}
+
+void RayCaster::add_stats(const RayStats &local) {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_.add(local);
+}
@@ -0,0 +1,199 @@
+#ifndef __RAYCAST_H__
+#define __RAYCAST_H__
+
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include "geometry.h"
+#include "model.h"
+#include "bvh.h"
+#include "vertex.h"
+#include "rasterizer.h"
+#include "threadpool.h"
+#include "profile.h"
+
+// Primary rays of a width x height frame seen through camera (object space
+// to NDC, as for the vertex stage). The ray of pixel (x, y) runs through the
+// points the vertex stage maps to screen position (x, y), which is where the
+// rasterizer samples the pixel, and starts where the clip-space w reaches
+// CLIP_NEAR_W, so it sees what the rasterizer keeps after near clipping. An
+// orthographic camera gives parallel rays with no start.
+class CameraRays {
+private:
+	// camera^-1 * (NDC x, NDC y, 1, 1) of pixel (x, y) is base_ + x * step_x_
+	// + y * step_y_, and the point at NDC z = 0 is that less depth_
+	float base_[4];
+	float step_x_[4];
+	float step_y_[4];
+	float depth_[4];
+public:
+	CameraRays(const Mat4 &camera, int width, int height);
+	// the PACKET_W x PACKET_H pixels from (x, y), lane i at (x + i % PACKET_W,
+	// y + i / PACKET_W); lanes at or past x1 or y1 are inactive
+	enum { PACKET_W = 4, PACKET_H = RAY_PACKET / PACKET_W };
+	void packet(int x, int y, int x1, int y1, RayPacket &p) const;
+};
+
+// what a ray-cast frame did, and the wall time it took
+struct RayStats {
+	unsigned long rays;
+	unsigned long hits;
+	unsigned long fragments; // fragment() invocations
+	TraceStats trace;
+	double seconds;
+
+	RayStats();
+	void add(const RayStats &o);
+};
+
+// Ray-cast counterpart of TileRasterizer: one primary ray per pixel through
+// a BVH of the model, traced in packets of 4x2 pixels, with the tiles of the
+// frame handed to the pool. A hit is shaded by the same shaders as the
+// raster path: the face is set up from its screen vertices (the model after
+// transform_model() with the same camera) whenever the face changes, and
+// fragment() gets the ray's weights, which are perspective correct by
+// construction. The depth written is the screen-space depth the rasterizer
+// would interpolate there. Only the nearest hit is shaded, so a discarded
+// fragment leaves a hole rather than showing what is behind it, and faces
+// crossing the near plane take their lod and other derivative terms from
+// unclipped screen positions.
+class RayCaster {
+private:
+	int width_;
+	int height_;
+	int tile_size_;
+	int tiles_x_;
+	int tiles_y_;
+	TraceMode mode_;
+	bool cull_backfaces_;
+	RayStats stats_;
+	std::mutex stats_mutex_;
+	ThreadPool pool_;
+
+	DepthView map_tile(RenderTarget &target, int x0, int y0, int x1, int y1);
+	void add_stats(const RayStats &local);
+public:
+	// tile_size must be a multiple of CameraRays::PACKET_W and PACKET_H
+	RayCaster(int width, int height, int tile_size = 16, int nthreads = 0);
+	void set_mode(TraceMode mode) { mode_ = mode; }
+	TraceMode mode() const { return mode_; }
+	// whether faces turned away from the viewer are skipped (on by default),
+	// as primitive assembly does for the rasterizer
+	void set_cull_backfaces(bool cull) { cull_backfaces_ = cull; }
+	bool cull_backfaces() const { return cull_backfaces_; }
+	const RayStats &stats() const { return stats_; }
+	int nthreads() { return pool_.size(); }
+	int ntiles() const { return tiles_x_ * tiles_y_; }
+	// Casts the frame into target, which must have the caster's size and a
+	// single sample and is expected to be cleared. bvh is built over model,
+	// and screen_verts holds model transformed with camera.
+	template <class Shader>
+	void render(const BVH &bvh, Model &model, const ScreenVerts &screen_verts, const Mat4 &camera, RenderTarget &target, const Shader &shader);
+};
+
+namespace ray_detail {
+
+// face of model with its screen positions, as rasterize_model() fetches it
+inline void fetch_triangle(Model &model, const ScreenVerts &screen_verts, int face, Triangle &t) {
+	const int *fv = model.face_verts(face);
+	const int *ft = model.face_uvs(face);
+	const int *fn = model.face_norms(face);
+	for (int j = 0; j < 3; j++) {
+		t.pts[j] = screen_verts[fv[j]];
+		t.uv[j] = model.uv_vert(ft[j]);
+		t.vn[j] = model.vn_vert(fn[j]);
+		t.tn[j] = model.tangent(fn[j]);
+		t.rhw[j] = screen_verts.rhw[fv[j]];
+	}
+}
+
+// the shader setup of the rasterizer; a face that covers no pixel centre on
+// screen gets no derivatives
+inline TriangleSetup face_setup(const Triangle &t, int width, int height) {
+	raster_detail::EdgeSetup s;
+	if (raster_detail::setup_edges(t.pts, 0, 0, width, height, s)) return raster_detail::triangle_setup(t, s);
+	TriangleSetup setup = {&t, {0, 0, 0}, {0, 0, 0}, 0};
+	return setup;
+}
+
+// Screen-space depth over a face from perspective-correct weights: the
+// screen weights are those times each vertex's w, renormalized.
+struct FaceDepth {
+	float z[3];
+	float w[3];
+
+	void set(const Triangle &t) {
+		for (int i = 0; i < 3; i++) {
+			z[i] = t.pts[i].z;
+			w[i] = 1.f / t.rhw[i];
+		}
+	}
+	float at(const Vec3f &bar) const {
+		float q0 = bar.x * w[0], q1 = bar.y * w[1], q2 = bar.z * w[2];
+		return (z[0] * q0 + z[1] * q1 + z[2] * q2) / (q0 + q1 + q2);
+	}
+};
+
+}
+
+template <class Shader>
+void RayCaster::render(const BVH &bvh, Model &model, const ScreenVerts &screen_verts, const Mat4 &camera, RenderTarget &target, const Shader &shader) {
+	PROFILE_SCOPE("raycast");
+	std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+	CameraRays rays(camera, width_, height_);
+	struct {
+		const BVH *bvh;
+		Model *model;
+		const ScreenVerts *screen_verts;
+		const CameraRays *rays;
+		RenderTarget *target;
+		const Shader *shader;
+	} args = {&bvh, &model, &screen_verts, &rays, &target, &shader};
+	stats_ = RayStats();
+	pool_.parallel_for(ntiles(), [this, &args](int tile) {
+		PROFILE_SCOPE("ray_tile");
+		int x0 = (tile % tiles_x_) * tile_size_;
+		int y0 = (tile / tiles_x_) * tile_size_;
+		int x1 = std::min(x0 + tile_size_, width_);
+		int y1 = std::min(y0 + tile_size_, height_);
+		DepthView depth = map_tile(*args.target, x0, y0, x1, y1);
+		TGAImage &image = args.target->color();
+		Shader shader = *args.shader;
+		RayStats local;
+		Triangle t;
+		ray_detail::FaceDepth face_depth;
+		int current = -1;
+		for (int y = y0; y < y1; y += CameraRays::PACKET_H) {
+			for (int x = x0; x < x1; x += CameraRays::PACKET_W) {
+				RayPacket packet;
+				PacketHits hits;
+				args.rays->packet(x, y, x1, y1, packet);
+				args.bvh->intersect(mode_, packet, hits, cull_backfaces_, &local.trace);
+				for (int i = 0; i < RAY_PACKET; i++) {
+					int px = x + i % CameraRays::PACKET_W, py = y + i / CameraRays::PACKET_W;
+					if (px >= x1 || py >= y1) continue;
+					local.rays++;
+					if (hits.face[i] < 0) continue;
+					local.hits++;
+					if (hits.face[i] != current) {
+						current = hits.face[i];
+						ray_detail::fetch_triangle(*args.model, *args.screen_verts, current, t);
+						shader.begin(ray_detail::face_setup(t, width_, height_));
+						face_depth.set(t);
+					}
+					Vec3f bar(1.f - hits.u[i] - hits.v[i], hits.u[i], hits.v[i]);
+					TGAColor color;
+					local.fragments++;
+					if (shader.fragment(bar, color)) continue;
+					depth.at(px, py) = face_depth.at(bar);
+					image.set(px, py, color);
+				}
+			}
+		}
+		args.target->unmap_depth(depth, x1, y1);
+		add_stats(local);
+	});
+	stats_.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+#endif //__RAYCAST_H__
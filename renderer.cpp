@@ -0,0 +1,58 @@
+#include <limits>
+#include "renderer.h"
+
+Vec3f world2screen(Vec3f v, int width, int height) {
+    // + .5 是为了能四舍五入，不加会统一向下取整
+    return Vec3f(int((v.x + 1.) * width / 2. + .5), int((v.y + 1.) * height / 2. + .5), int(v.z * DEPTH + .5));
+}
+
+void transform_model(Model &model, ScreenVerts &screen_verts, int width, int height, const Mat4 *camera) {
+    PROFILE_SCOPE("transform");
+    static const VertexMode mode = best_vertex_mode();
+    if (model.nverts() == 0) {
+        screen_verts.resize(0);
+        return;
+    }
+    // the identity is exact here: 1*x + 0*y + 0*z + 0 and a divide by 1
+    transform_vertices(mode, &model.vert(0), model.nverts(), camera ? *camera : Mat4::identity(), width, height, DEPTH, screen_verts);
+}
+
+void render_shadow_map(Model &model, TileRasterizer &rasterizer, ScreenVerts &screen_verts, bool serial, ShadowMap &map, HiZBuffer *hiz, RasterStats &stats) {
+    PROFILE_SCOPE("shadow");
+    int size = map.size();
+    transform_model(model, screen_verts, size, size, &map.light());
+    map.clear();
+    if (hiz) hiz->clear(-std::numeric_limits<float>::max());
+    DepthView depth = map.depth();
+    bool cull = rasterizer.cull_backfaces();
+    RasterStats prims;
+    stats = RasterStats();
+    rasterizer.set_hiz(hiz);
+    rasterizer.begin();
+    for (int i = 0; i < model.nfaces(); i++) {
+        const int *fv = model.face_verts(i);
+        Triangle t;
+        Vec3f obj[3];
+        int outcode[3];
+        for (int j = 0; j < 3; j++) {
+            t.pts[j] = screen_verts[fv[j]];
+            t.rhw[j] = screen_verts.rhw[fv[j]];
+            obj[j] = model.vert(fv[j]);
+            outcode[j] = screen_verts.outcode[fv[j]];
+        }
+        Triangle out[MAX_CLIPPED_TRIANGLES];
+        int n = assemble_triangle(t, obj, outcode, screen_verts, cull, out, prims);
+        for (int k = 0; k < n; k++) {
+            if (serial) {
+                triangle_depth(rasterizer.mode(), out[k], depth, 0, 0, size, size, hiz, &stats);
+            } else {
+                rasterizer.submit(out[k]);
+            }
+        }
+    }
+    if (!serial) {
+        rasterizer.flush_depth(depth);
+        stats = rasterizer.stats();
+    }
+    stats.add(prims);
+}
@@ -0,0 +1,110 @@
+#ifndef __RENDERER_H__
+#define __RENDERER_H__
+
+#include "geometry.h"
+#include "tgaimage.h"
+#include "model.h"
+#include "rasterizer.h"
+#include "vertex.h"
+#include "primitive.h"
+#include "shadow.h"
+#include "raycast.h"
+#include "profile.h"
+
+Vec3f world2screen(Vec3f v, int width, int height);
+
+// Runs the vertex stage over every model vertex into screen_verts. With a
+// camera the vertex is first taken to normalized device coordinates by
+// camera * (v, 1) and the perspective divide; without one model space is
+// already NDC.
+void transform_model(Model &model, ScreenVerts &screen_verts, int width, int height, const Mat4 *camera = NULL);
+
+// The raster half of draw_model, on already transformed screen_verts. Each
+// face goes through primitive assembly (see assemble_triangle) before it is
+// rasterized. A deferred rasterizer always bins, serial or not, and so do
+// multisampled targets and targets with packed depth, which is only decoded
+// a tile at a time.
+template <class Shader>
+void rasterize_model(Model &model, TileRasterizer &rasterizer, const ScreenVerts &screen_verts, bool serial, RenderTarget &target, HiZBuffer *hiz, const Shader &shader, RasterStats &stats) {
+	PROFILE_SCOPE("raster");
+	int width = target.width();
+	int height = target.height();
+	bool cull = rasterizer.cull_backfaces();
+	serial = serial && !rasterizer.deferred() && target.depth_format() == DEPTH_FLOAT && target.samples() == 1;
+	DepthView depth = {NULL, 0, 0, 0};
+	if (serial) depth = target.map_depth(0, 0, width, height, NULL);
+	RasterStats prims;
+	stats = RasterStats();
+	rasterizer.set_hiz(serial ? NULL : hiz);
+	rasterizer.begin();
+	for (int i = 0; i < model.nfaces(); i++) {
+		const int *fv = model.face_verts(i);
+		const int *ft = model.face_uvs(i);
+		const int *fn = model.face_norms(i);
+		Triangle t;
+		Vec3f obj[3];
+		int outcode[3];
+		for (int j = 0; j < 3; j++) {
+			t.pts[j] = screen_verts[fv[j]];
+			t.uv[j] = model.uv_vert(ft[j]);
+			t.vn[j] = model.vn_vert(fn[j]);
+			t.tn[j] = model.tangent(fn[j]);
+			t.rhw[j] = screen_verts.rhw[fv[j]];
+			obj[j] = model.vert(fv[j]);
+			outcode[j] = screen_verts.outcode[fv[j]];
+		}
+		Triangle out[MAX_CLIPPED_TRIANGLES];
+		int n = assemble_triangle(t, obj, outcode, screen_verts, cull, out, prims);
+		for (int k = 0; k < n; k++) {
+			if (serial) {
+				triangle(rasterizer.mode(), out[k], depth, target.color(), shader, 0, 0, width, height, hiz, &stats);
+			} else {
+				rasterizer.submit(out[k]);
+			}
+		}
+	}
+	if (!serial) {
+		rasterizer.flush(target, shader);
+		stats = rasterizer.stats();
+	}
+	stats.add(prims);
+	stats.pixels_visible = target.count_covered();
+	PROFILE_COUNT(PROF_TRIANGLES_IN, model.nfaces());
+	PROFILE_COUNT(PROF_TRIANGLES_CULLED, stats.culled_backface + stats.culled_frustum);
+	PROFILE_COUNT(PROF_TRIANGLES_CLIPPED, stats.clipped);
+	PROFILE_COUNT(PROF_PIXELS_TESTED, stats.pixels_tested);
+	PROFILE_COUNT(PROF_PIXELS_DEPTH_REJECTED, stats.pixels_tested - stats.pixels_shaded);
+	PROFILE_COUNT(PROF_PIXELS_SHADED, stats.pixels_shaded);
+}
+
+// Rasterizes every face of the model into the target with the
+// rasterizer's mode and the given shader. Each vertex is transformed once
+// into screen_verts (the post-transform cache, indexed like the model's
+// positions) and faces fetch their corners from it. Faces go through the
+// tile binner, or straight through triangle() on the calling thread when
+// serial is set. Once the rasterizer's buffers and screen_verts have grown
+// to the mesh size this does no heap allocation.
+template <class Shader>
+void draw_model(Model &model, TileRasterizer &rasterizer, ScreenVerts &screen_verts, bool serial, RenderTarget &target, HiZBuffer *hiz, const Shader &shader, RasterStats &stats) {
+	transform_model(model, screen_verts, target.width(), target.height());
+	rasterize_model(model, rasterizer, screen_verts, serial, target, hiz, shader, stats);
+}
+
+// The ray-cast counterpart of draw_model, and of transform_model plus
+// rasterize_model with a camera: the same vertex stage feeds the shaders
+// and caster.render() decides visibility through bvh (built over model)
+// instead of the rasterizer. target must be single-sampled.
+template <class Shader>
+void raycast_model(Model &model, const BVH &bvh, RayCaster &caster, ScreenVerts &screen_verts, RenderTarget &target, const Mat4 *camera, const Shader &shader, RayStats &stats) {
+	transform_model(model, screen_verts, target.width(), target.height(), camera);
+	caster.render(bvh, model, screen_verts, camera ? *camera : Mat4::identity(), target, shader);
+	stats = caster.stats();
+}
+
+// The depth-only counterpart of draw_model: clears the map and renders the
+// model into it from its light through triangle_depth(), fetching no
+// attributes. rasterizer must have the map's size; faces are culled and
+// clipped as in rasterize_model, against the light's view.
+void render_shadow_map(Model &model, TileRasterizer &rasterizer, ScreenVerts &screen_verts, bool serial, ShadowMap &map, HiZBuffer *hiz, RasterStats &stats);
+
+#endif //__RENDERER_H__
@@ -0,0 +1,295 @@
+#include <cstring>
+#include <cstdlib>
+#include <limits>
+#include <new>
+#include <algorithm>
+#include "rendertarget.h"
+
+namespace {
+
+const std::size_t BUFFER_ALIGN = 64;
+const float EMPTY_DEPTH = -std::numeric_limits<float>::max();
+
+// unorm codes 1..max cover [-DEPTH, DEPTH], 0 is left for the empty value
+template <int BITS>
+struct Unorm {
+    static const uint32_t MAX = (1u << BITS) - 1;
+
+    static uint32_t encode(float z) {
+        if (z == EMPTY_DEPTH) return 0;
+        float t = (z + DEPTH) * ((MAX - 1) / (2.f * DEPTH));
+        t = std::min(std::max(t, 0.f), (float)(MAX - 1));
+        return (uint32_t)(t + .5f) + 1;
+    }
+    static float decode(uint32_t code) {
+        if (!code) return EMPTY_DEPTH;
+        return (code - 1) * (2.f * DEPTH / (MAX - 1)) - DEPTH;
+    }
+};
+
+const int PATTERN_4X[8] = {-2, -6, 6, -2, -6, 2, 2, 6};
+const int PATTERN_8X[16] = {1, -3, -1, 3, 5, 1, -3, -5, -5, 5, -7, -1, 3, 7, 7, -7};
+
+void *alloc_aligned(std::size_t nbytes) {
+    return ::operator new[](nbytes, std::align_val_t(BUFFER_ALIGN));
+}
+
+void free_aligned(void *p) {
+    if (p) ::operator delete[](p, std::align_val_t(BUFFER_ALIGN));
+}
+
+typedef Unorm<16> Unorm16;
+typedef Unorm<24> Unorm24;
+
+uint32_t load24(const unsigned char *p) {
+    return p[0] | (p[1] << 8) | ((uint32_t)p[2] << 16);
+}
+
+void store24(unsigned char *p, uint32_t v) {
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+}
+
+}
+
+bool depth_format_from_name(const char *name, DepthFormat &format) {
+    if (!strcmp(name, "float")) format = DEPTH_FLOAT;
+    else if (!strcmp(name, "24")) format = DEPTH_UNORM24;
+    else if (!strcmp(name, "16")) format = DEPTH_UNORM16;
+    else return false;
+    return true;
+}
+
+const char *depth_format_name(DepthFormat format) {
+    switch (format) {
+    case DEPTH_UNORM24: return "24";
+    case DEPTH_UNORM16: return "16";
+    default: return "float";
+    }
+}
+
+bool resolve_filter_from_name(const char *name, ResolveFilter &filter) {
+    if (!strcmp(name, "box")) filter = RESOLVE_BOX;
+    else if (!strcmp(name, "tent")) filter = RESOLVE_TENT;
+    else return false;
+    return true;
+}
+
+const char *resolve_filter_name(ResolveFilter filter) {
+    return filter == RESOLVE_TENT ? "tent" : "box";
+}
+
+const int *sample_pattern(int samples) {
+    switch (samples) {
+    case 4: return PATTERN_4X;
+    case 8: return PATTERN_8X;
+    default: return NULL;
+    }
+}
+
+RenderTarget::RenderTarget(int width, int height, DepthFormat format, int samples) : width_(width), height_(height), format_(format), samples_(sample_pattern(samples) ? samples : 1), filter_(RESOLVE_BOX), color_(width, height, TGAImage::RGB), depth_(NULL), sample_depth_(NULL), sample_color_(NULL) {
+    std::size_t npixels = (std::size_t)width * height;
+    depth_ = static_cast<unsigned char *>(alloc_aligned(npixels * depth_bytespp()));
+    if (samples_ > 1) {
+        sample_depth_ = static_cast<float *>(alloc_aligned(npixels * samples_ * sizeof(float)));
+        sample_color_ = static_cast<uint32_t *>(alloc_aligned(npixels * samples_ * sizeof(uint32_t)));
+    }
+    clear();
+}
+
+RenderTarget::~RenderTarget() {
+    free_aligned(depth_);
+    free_aligned(sample_depth_);
+    free_aligned(sample_color_);
+}
+
+int RenderTarget::depth_bytespp() const {
+    switch (format_) {
+    case DEPTH_UNORM24: return 3;
+    case DEPTH_UNORM16: return 2;
+    default: return 4;
+    }
+}
+
+void RenderTarget::clear() {
+    color_.clear();
+    int n = width_ * height_;
+    if (format_ == DEPTH_FLOAT) {
+        std::fill((float *)depth_, (float *)depth_ + n, EMPTY_DEPTH);
+    } else {
+        memset(depth_, 0, (std::size_t)n * depth_bytespp());
+    }
+    if (samples_ > 1) {
+        std::fill(sample_depth_, sample_depth_ + (std::size_t)n * samples_, EMPTY_DEPTH);
+        memset(sample_color_, 0, (std::size_t)n * samples_ * sizeof(uint32_t));
+    }
+}
+
+void RenderTarget::resolve(int x0, int y0, int x1, int y1) {
+    if (samples_ == 1) return;
+    if (filter_ == RESOLVE_TENT) {
+        resolve_tent(x0, y0, x1, y1);
+        return;
+    }
+    int shift = samples_ == 8 ? 3 : 2;
+    unsigned char *out = color_.buffer();
+    for (int y = y0; y < y1; y++) {
+        for (int x = x0; x < x1; x++) {
+            const unsigned char *c = (const unsigned char *)(sample_color_ + (std::size_t)(x + y * width_) * samples_);
+            unsigned int sum[3] = {0, 0, 0};
+            for (int s = 0; s < samples_; s++, c += 4) {
+                sum[0] += c[0];
+                sum[1] += c[1];
+                sum[2] += c[2];
+            }
+            unsigned char *p = out + (x + y * width_) * 3;
+            for (int i = 0; i < 3; i++) p[i] = (sum[i] + (samples_ >> 1)) >> shift;
+        }
+    }
+}
+
+// every sample within one pixel of the center, weighted by
+// (1 - |dx|) * (1 - |dy|) in 1/256 steps; only the taps with a non-zero
+// weight are visited, and the sum is renormalized at the image border
+void RenderTarget::resolve_tent(int x0, int y0, int x1, int y1) {
+    struct Tap {
+        int dx, dy, sample, weight;
+    };
+    const int *pattern = sample_pattern(samples_);
+    Tap taps[9 * 8];
+    int ntaps = 0, total = 0;
+    for (int n = 0; n < 9; n++) {
+        for (int s = 0; s < samples_; s++) {
+            int dx = (n % 3 - 1) * 16 + pattern[2 * s];
+            int dy = (n / 3 - 1) * 16 + pattern[2 * s + 1];
+            int w = std::max(0, 16 - std::abs(dx)) * std::max(0, 16 - std::abs(dy));
+            if (!w) continue;
+            Tap t = {n % 3 - 1, n / 3 - 1, s, w};
+            taps[ntaps++] = t;
+            total += w;
+        }
+    }
+    unsigned char *out = color_.buffer();
+    for (int y = y0; y < y1; y++) {
+        bool inner_row = y > 0 && y < height_ - 1;
+        for (int x = x0; x < x1; x++) {
+            unsigned int sum[3] = {0, 0, 0};
+            int norm = total;
+            if (inner_row && x > 0 && x < width_ - 1) {
+                for (int i = 0; i < ntaps; i++) {
+                    const unsigned char *c = (const unsigned char *)(sample_color_ + (std::size_t)(x + taps[i].dx + (y + taps[i].dy) * width_) * samples_ + taps[i].sample);
+                    sum[0] += c[0] * taps[i].weight;
+                    sum[1] += c[1] * taps[i].weight;
+                    sum[2] += c[2] * taps[i].weight;
+                }
+            } else {
+                norm = 0;
+                for (int i = 0; i < ntaps; i++) {
+                    int nx = x + taps[i].dx, ny = y + taps[i].dy;
+                    if (nx < 0 || ny < 0 || nx >= width_ || ny >= height_) continue;
+                    const unsigned char *c = (const unsigned char *)(sample_color_ + (std::size_t)(nx + ny * width_) * samples_ + taps[i].sample);
+                    sum[0] += c[0] * taps[i].weight;
+                    sum[1] += c[1] * taps[i].weight;
+                    sum[2] += c[2] * taps[i].weight;
+                    norm += taps[i].weight;
+                }
+            }
+            unsigned char *p = out + (x + y * width_) * 3;
+            for (int i = 0; i < 3; i++) p[i] = (sum[i] + norm / 2) / norm;
+        }
+    }
+}
+
+DepthView RenderTarget::map_depth(int x0, int y0, int x1, int y1, float *scratch) {
+    if (format_ == DEPTH_FLOAT) {
+        DepthView view = {(float *)depth_ + x0 + y0 * width_, width_, x0, y0};
+        return view;
+    }
+    DepthView view = {scratch, x1 - x0, x0, y0};
+    for (int y = y0; y < y1; y++) {
+        float *dst = &view.at(x0, y);
+        if (format_ == DEPTH_UNORM16) {
+            const uint16_t *src = (const uint16_t *)depth_ + x0 + y * width_;
+            for (int x = 0; x < x1 - x0; x++) dst[x] = Unorm16::decode(src[x]);
+        } else {
+            const unsigned char *src = depth_ + (x0 + y * width_) * 3;
+            for (int x = 0; x < x1 - x0; x++) dst[x] = Unorm24::decode(load24(src + x * 3));
+        }
+    }
+    return view;
+}
+
+void RenderTarget::unmap_depth(const DepthView &view, int x1, int y1) {
+    if (format_ == DEPTH_FLOAT) return;
+    for (int y = view.y0; y < y1; y++) {
+        const float *src = &view.at(view.x0, y);
+        if (format_ == DEPTH_UNORM16) {
+            uint16_t *dst = (uint16_t *)depth_ + view.x0 + y * width_;
+            for (int x = 0; x < x1 - view.x0; x++) dst[x] = (uint16_t)Unorm16::encode(src[x]);
+        } else {
+            unsigned char *dst = depth_ + (view.x0 + y * width_) * 3;
+            for (int x = 0; x < x1 - view.x0; x++) store24(dst + x * 3, Unorm24::encode(src[x]));
+        }
+    }
+}
+
+float RenderTarget::depth(int x, int y) const {
+    int i = x + y * width_;
+    if (samples_ > 1) {
+        const float *z = sample_depth_ + (std::size_t)i * samples_;
+        return *std::max_element(z, z + samples_);
+    }
+    switch (format_) {
+    case DEPTH_UNORM24: return Unorm24::decode(load24(depth_ + i * 3));
+    case DEPTH_UNORM16: return Unorm16::decode(((const uint16_t *)depth_)[i]);
+    default: return ((const float *)depth_)[i];
+    }
+}
+
+unsigned long RenderTarget::count_covered() const {
+    unsigned long n = 0;
+    int npixels = width_ * height_;
+    if (samples_ > 1) {
+        for (int i = 0; i < npixels; i++) n += (depth(i % width_, i / width_) != EMPTY_DEPTH);
+    } else if (format_ == DEPTH_FLOAT) {
+        const float *z = (const float *)depth_;
+        for (int i = 0; i < npixels; i++) n += (z[i] != EMPTY_DEPTH);
+    } else if (format_ == DEPTH_UNORM16) {
+        const uint16_t *z = (const uint16_t *)depth_;
+        for (int i = 0; i < npixels; i++) n += (z[i] != 0);
+    } else {
+        for (int i = 0; i < npixels; i++) n += (load24(depth_ + i * 3) != 0);
+    }
+    return n;
+}
+
+RenderTargetPool::~RenderTargetPool() {
+    for (size_t i = 0; i < free_.size(); i++) delete free_[i];
+}
+
+RenderTarget *RenderTargetPool::acquire(int width, int height, DepthFormat format, int samples) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (size_t i = 0; i < free_.size(); i++) {
+            RenderTarget *t = free_[i];
+            if (t->width() == width && t->height() == height && t->depth_format() == format && t->samples() == (sample_pattern(samples) ? samples : 1)) {
+                free_[i] = free_.back();
+                free_.pop_back();
+                return t;
+            }
+        }
+    }
+    return new RenderTarget(width, height, format, samples);
+}
+
+void RenderTargetPool::release(RenderTarget *target) {
+    if (!target) return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(target);
+}
+
+int RenderTargetPool::nfree() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return (int)free_.size();
+}
@@ -0,0 +1,121 @@
+#ifndef __RENDERTARGET_H__
+#define __RENDERTARGET_H__
+
+#include <vector>
+#include <mutex>
+#include <cstdint>
+#include "tgaimage.h"
+
+// depth values of the renderer span [-DEPTH, DEPTH]
+const int DEPTH = 255;
+
+// How a render target stores depth. The rasterizer always tests in float;
+// the unorm formats are decoded into a float tile before it runs and encoded
+// back afterwards, so they trade precision between draws for memory and
+// bandwidth. Code 0 of a unorm format is the empty (cleared) value.
+enum DepthFormat {
+	DEPTH_FLOAT,   // 4 bytes
+	DEPTH_UNORM24, // 3 bytes
+	DEPTH_UNORM16  // 2 bytes
+};
+
+bool depth_format_from_name(const char *name, DepthFormat &format);
+const char *depth_format_name(DepthFormat format);
+
+// How a multisampled target is resolved into its color image: the mean of
+// the pixel's own samples, or a tent of radius one pixel that also weighs in
+// the nearer samples of the eight neighbours (softer, and it needs the whole
+// neighbourhood rasterized first).
+enum ResolveFilter {
+	RESOLVE_BOX,
+	RESOLVE_TENT
+};
+
+bool resolve_filter_from_name(const char *name, ResolveFilter &filter);
+const char *resolve_filter_name(ResolveFilter filter);
+
+// Sample positions of the 4x and 8x modes as x, y pairs in 1/16 pixel
+// around the pixel center (the usual rotated/sparse grids); NULL for any
+// other count.
+const int *sample_pattern(int samples);
+
+// A float depth rectangle starting at (x0, y0), addressed in target pixel
+// coordinates with the given row stride.
+struct DepthView {
+	float *data;
+	int stride;
+	int x0;
+	int y0;
+
+	float &at(int x, int y) const { return data[(x - x0) + (y - y0) * stride]; }
+};
+
+// Owns the color and depth buffers of one frame, both 64-byte aligned.
+// Depth is cleared to the farthest value, -max for float targets.
+//
+// A multisampled target (4 or 8 samples) also keeps a float depth and a
+// BGRA color per sample, stored pixel by pixel with the samples of a pixel
+// adjacent; the rasterizer writes those and resolve() turns them into the
+// color image. Its sample depth is always float, whatever the format.
+class RenderTarget {
+private:
+	int width_;
+	int height_;
+	DepthFormat format_;
+	int samples_;
+	ResolveFilter filter_;
+	TGAImage color_;
+	unsigned char *depth_;
+	float *sample_depth_;
+	uint32_t *sample_color_;
+
+	void resolve_tent(int x0, int y0, int x1, int y1);
+
+	RenderTarget(const RenderTarget &);
+	RenderTarget &operator =(const RenderTarget &);
+public:
+	// samples other than 4 or 8 give a single-sample target
+	RenderTarget(int width, int height, DepthFormat format = DEPTH_FLOAT, int samples = 1);
+	~RenderTarget();
+	int width() const { return width_; }
+	int height() const { return height_; }
+	DepthFormat depth_format() const { return format_; }
+	int depth_bytespp() const;
+	int samples() const { return samples_; }
+	void set_resolve_filter(ResolveFilter filter) { filter_ = filter; }
+	ResolveFilter resolve_filter() const { return filter_; }
+	TGAImage &color() { return color_; }
+	float *sample_depth() { return sample_depth_; }
+	uint32_t *sample_color() { return sample_color_; }
+	void clear();
+	// writes the color of the pixels in [x0, x1) x [y0, y1) from their
+	// samples (a no-op on single-sample targets)
+	void resolve(int x0, int y0, int x1, int y1);
+	// Float depth of [x0, x1) x [y0, y1), single-sample targets only. A
+	// float target hands out its own storage; otherwise the rect is decoded
+	// into scratch (at least (x1-x0)*(y1-y0) floats) and unmap_depth() must
+	// encode it back.
+	DepthView map_depth(int x0, int y0, int x1, int y1, float *scratch);
+	void unmap_depth(const DepthView &view, int x1, int y1);
+	// the nearest sample on multisampled targets
+	float depth(int x, int y) const;
+	// pixels with any depth (sample) no longer at the cleared value
+	unsigned long count_covered() const;
+};
+
+// Keeps released targets so frames of the same size, format and sample
+// count reuse their buffers instead of reallocating them. Safe to share
+// between threads.
+class RenderTargetPool {
+private:
+	std::mutex mutex_;
+	std::vector<RenderTarget *> free_;
+public:
+	~RenderTargetPool();
+	// a target left as its last user released it (clear() before drawing)
+	RenderTarget *acquire(int width, int height, DepthFormat format = DEPTH_FLOAT, int samples = 1);
+	void release(RenderTarget *target);
+	int nfree();
+};
+
+#endif //__RENDERTARGET_H__
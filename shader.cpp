@@ -0,0 +1,43 @@
+#include <cstring>
+#include <algorithm>
+#include "shader.h"
+
+static const char *shader_names[] = {"flat", "gouraud", "phong", "normalmap", "material"};
+
+bool shader_kind_from_name(const char *name, ShaderKind &kind) {
+    for (int i = SHADER_FLAT; i <= SHADER_MATERIAL; i++) {
+        if (!strcmp(name, shader_names[i])) {
+            kind = (ShaderKind)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *shader_kind_name(ShaderKind kind) {
+    return shader_names[kind];
+}
+
+bool pack_surface_map(TGAImage *normal_map, TGAImage *specular_map, float shininess, TGAImage &out) {
+    TGAImage *size = normal_map ? normal_map : specular_map;
+    if (!size) return false;
+    int w = size->get_width(), h = size->get_height();
+    out = TGAImage(w, h, TGAImage::RGBA);
+    int fixed = std::min(std::max((int)shininess - SURFACE_MIN_SHININESS, 0), 255);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            TGAColor c(128, 128, 255, fixed);
+            if (normal_map) {
+                TGAColor n = normal_map->get(x, y);
+                c.r = n.r;
+                c.g = n.g;
+                c.b = n.b;
+            }
+            if (specular_map) {
+                c.a = specular_map->get(x * specular_map->get_width() / w, y * specular_map->get_height() / h).raw[0];
+            }
+            out.set(x, y, c);
+        }
+    }
+    return true;
+}
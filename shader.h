@@ -0,0 +1,349 @@
+#ifndef __SHADER_H__
+#define __SHADER_H__
+
+#include <cmath>
+#include <algorithm>
+#include "geometry.h"
+#include "tgaimage.h"
+#include "texture.h"
+
+// screen-space triangle with its per-vertex attributes, ready for
+// rasterization; tn is the tangent frame that goes with vn (see
+// Model::tangent) and rhw is 1/w of each vertex (1 without perspective)
+struct Triangle {
+	Vec3f pts[3];
+	Vec3f uv[3];
+	Vec3f vn[3];
+	Vec4f tn[3];
+	float rhw[3];
+};
+
+// Handed to a shader once per triangle: a pixel's barycentric weight b[i]
+// changes by dx[i] * inv_area per step along x and by dy[i] * inv_area per
+// step along y, which is what derivative-based terms like the mip level need.
+struct TriangleSetup {
+	const Triangle *tri;
+	float dx[3];
+	float dy[3];
+	float inv_area;
+};
+
+// The rasterizer is templated on the shader type and calls it on a local
+// copy, so with the concrete classes marked final every call below inlines
+// into the pixel loop. begin() runs once per triangle (per tile it touches),
+// fragment() once per pixel that passed the depth test; returning true
+// discards the pixel, leaving both depth and color untouched.
+class IShader {
+public:
+	virtual ~IShader() {}
+	virtual void begin(const TriangleSetup &setup) = 0;
+	virtual bool fragment(const Vec3f &bar, TGAColor &color) = 0;
+};
+
+inline Vec3f interpolate(const Vec3f *v, const Vec3f &bar) {
+	return v[0] * bar.x + v[1] * bar.y + v[2] * bar.z;
+}
+
+// A per-vertex attribute set up once per triangle as a plane over the
+// weights of vertex 1 and 2, a0 + b1 * d1 + b2 * d2, so a fragment pays two
+// multiply-adds per component where interpolate() pays three multiplies
+// and two adds. The weights handed to fragment() are already perspective
+// correct, so the plane is too.
+template <class T>
+struct AttributePlane {
+	T a0, d1, d2;
+
+	void set(const T &v0, const T &v1, const T &v2) {
+		a0 = v0;
+		d1 = v1 - v0;
+		d2 = v2 - v0;
+	}
+	T at(const Vec3f &bar) const { return a0 + d1 * bar.y + d2 * bar.z; }
+};
+
+// Mip level of a texture over a face, from the screen-space derivatives of
+// the perspective-correct uv at each pixel. With screen weights l_i (affine
+// in x and y) the uv is N / D for N = sum l_i rhw_i uv_i and D = sum l_i
+// rhw_i, so d(uv)/dx = (dN/dx - uv dD/dx) / D, where both derivatives are
+// constant over the face and 1 / D is the perspective-correct w. When the
+// rhw are equal (or the filter ignores the level) it is constant and worked
+// out once.
+class TextureLod {
+	const Texture *texture_;
+	Vec2f nx_, ny_; // dN/dx, dN/dy
+	float dx_, dy_; // dD/dx, dD/dy
+	AttributePlane<float> w_;
+	bool constant_;
+	float lod_;
+public:
+	TextureLod() : texture_(NULL), nx_(), ny_(), dx_(0), dy_(0), w_(), constant_(true), lod_(0) {}
+	void set(const Texture &texture, const TriangleSetup &s) {
+		const Triangle &t = *s.tri;
+		texture_ = &texture;
+		nx_ = ny_ = Vec2f(0, 0);
+		dx_ = dy_ = 0;
+		for (int i = 0; i < 3; i++) {
+			float rx = t.rhw[i] * s.dx[i] * s.inv_area, ry = t.rhw[i] * s.dy[i] * s.inv_area;
+			nx_ = nx_ + Vec2f(t.uv[i].x, t.uv[i].y) * rx;
+			ny_ = ny_ + Vec2f(t.uv[i].x, t.uv[i].y) * ry;
+			dx_ += rx;
+			dy_ += ry;
+		}
+		w_.set(1.f / t.rhw[0], 1.f / t.rhw[1], 1.f / t.rhw[2]);
+		constant_ = texture.filter() != Texture::TRILINEAR || (t.rhw[0] == t.rhw[1] && t.rhw[1] == t.rhw[2]);
+		if (constant_) {
+			// dD is zero up to rounding, and D is the rhw
+			float w = w_.a0;
+			lod_ = texture.lod(nx_.x * w, nx_.y * w, ny_.x * w, ny_.y * w);
+		}
+	}
+	float at(const Vec2f &uv, const Vec3f &bar) const {
+		if (constant_) return lod_;
+		float w = w_.at(bar);
+		return texture_->lod((nx_.x - uv.x * dx_) * w, (nx_.y - uv.y * dx_) * w, (ny_.x - uv.x * dy_) * w, (ny_.y - uv.y * dy_) * w);
+	}
+};
+
+inline void set_uv_plane(AttributePlane<Vec2f> &plane, const Vec3f *uv) {
+	plane.set(Vec2f(uv[0].x, uv[0].y), Vec2f(uv[1].x, uv[1].y), Vec2f(uv[2].x, uv[2].y));
+}
+
+// intensity is clamped to [0, 1]: the interpolated Lambert term goes
+// negative on faces turned from the light, and a negative float converted
+// to unsigned char is undefined
+inline TGAColor scale_color(TGAColor color, float intensity) {
+	intensity = std::max(0.f, std::min(1.f, intensity));
+	color.r = color.r * intensity;
+	color.g = color.g * intensity;
+	color.b = color.b * intensity;
+	return color;
+}
+
+// One Lambert term for the whole face, from the mean of its vertex normals,
+// on an untextured white surface.
+class FlatShader final : public IShader {
+	Vec3f light_dir_;
+	float intensity_;
+public:
+	FlatShader(Vec3f light_dir) : light_dir_(light_dir), intensity_(0) {}
+	void begin(const TriangleSetup &s) override {
+		const Vec3f *vn = s.tri->vn;
+		Vec3f n = vn[0] + vn[1] + vn[2];
+		intensity_ = std::max(0.f, n.normalize() * light_dir_);
+	}
+	bool fragment(const Vec3f &bar, TGAColor &color) override {
+		(void)bar;
+		unsigned char c = (unsigned char)(255 * intensity_);
+		color = TGAColor(c, c, c, 255);
+		return false;
+	}
+};
+
+// Textured, with the Lambert term interpolated across the face. The term is
+// linear in the normal, so taking it from the interpolated (unnormalized)
+// normal equals interpolating the three vertex intensities, which is what
+// the plane does.
+class GouraudShader final : public IShader {
+	const Texture *texture_;
+	Vec3f light_dir_;
+	AttributePlane<Vec2f> uv_;
+	AttributePlane<float> intensity_;
+	TextureLod lod_;
+public:
+	GouraudShader(const Texture &texture, Vec3f light_dir) : texture_(&texture), light_dir_(light_dir), uv_(), intensity_(), lod_() {}
+	void begin(const TriangleSetup &s) override {
+		const Vec3f *vn = s.tri->vn;
+		set_uv_plane(uv_, s.tri->uv);
+		intensity_.set(vn[0] * light_dir_, vn[1] * light_dir_, vn[2] * light_dir_);
+		lod_.set(*texture_, s);
+	}
+	bool fragment(const Vec3f &bar, TGAColor &color) override {
+		Vec2f uv = uv_.at(bar);
+		color = scale_color(texture_->sample(uv.x, uv.y, lod_.at(uv, bar)), intensity_.at(bar));
+		return false;
+	}
+};
+
+// ambient + diffuse + specular for unit normal n and unit light_dir, with
+// the viewer on +z
+inline TGAColor phong(const Vec3f &n, const Vec3f &light_dir, float shininess, const TGAColor &albedo) {
+	float diffuse = std::max(0.f, n * light_dir);
+	Vec3f r = n * (n * light_dir * 2.f) - light_dir;
+	float specular = r.z > 0.f ? std::pow(r.z, shininess) : 0.f;
+	TGAColor color = albedo;
+	for (int i = 0; i < 3; i++) {
+		color.raw[i] = (unsigned char)std::min(5.f + albedo.raw[i] * (diffuse + .6f * specular), 255.f);
+	}
+	return color;
+}
+
+// Textured Phong: the interpolated normal is renormalized per pixel.
+class PhongShader final : public IShader {
+	const Texture *texture_;
+	Vec3f light_dir_;
+	float shininess_;
+	AttributePlane<Vec2f> uv_;
+	AttributePlane<Vec3f> vn_;
+	TextureLod lod_;
+public:
+	PhongShader(const Texture &texture, Vec3f light_dir, float shininess = 10.f) : texture_(&texture), light_dir_(light_dir), shininess_(shininess), uv_(), vn_(), lod_() {
+		light_dir_.normalize();
+	}
+	void begin(const TriangleSetup &s) override {
+		set_uv_plane(uv_, s.tri->uv);
+		vn_.set(s.tri->vn[0], s.tri->vn[1], s.tri->vn[2]);
+		lod_.set(*texture_, s);
+	}
+	bool fragment(const Vec3f &bar, TGAColor &color) override {
+		Vec2f uv = uv_.at(bar);
+		Vec3f n = vn_.at(bar);
+		color = phong(n.normalize(), light_dir_, shininess_, texture_->sample(uv.x, uv.y, lod_.at(uv, bar)));
+		return false;
+	}
+};
+
+// Phong with the normal read from an object-space normal map (rgb in
+// [0, 255] encoding xyz in [-1, 1]) and taken to view space by
+// normal_matrix, the inverse transpose of the model-view matrix. Without a
+// map it falls back to the interpolated vertex normal.
+class NormalMapShader final : public IShader {
+	const Texture *texture_;
+	const Texture *normal_map_;
+	Mat4 normal_matrix_;
+	Vec3f light_dir_;
+	float shininess_;
+	AttributePlane<Vec2f> uv_;
+	AttributePlane<Vec3f> vn_;
+	TextureLod lod_;
+	TextureLod nm_lod_;
+public:
+	NormalMapShader(const Texture &texture, const Texture *normal_map, const Mat4 &normal_matrix, Vec3f light_dir, float shininess = 10.f) : texture_(&texture), normal_map_(normal_map), normal_matrix_(normal_matrix), light_dir_(light_dir), shininess_(shininess), uv_(), vn_(), lod_(), nm_lod_() {
+		light_dir_.normalize();
+	}
+	void begin(const TriangleSetup &s) override {
+		set_uv_plane(uv_, s.tri->uv);
+		vn_.set(s.tri->vn[0], s.tri->vn[1], s.tri->vn[2]);
+		lod_.set(*texture_, s);
+		if (normal_map_) nm_lod_.set(*normal_map_, s);
+	}
+	bool fragment(const Vec3f &bar, TGAColor &color) override {
+		Vec2f uv = uv_.at(bar);
+		Vec3f n;
+		if (normal_map_) {
+			TGAColor c = normal_map_->sample(uv.x, uv.y, nm_lod_.at(uv, bar));
+			n = Vec3f(c.r / 127.5f - 1.f, c.g / 127.5f - 1.f, c.b / 127.5f - 1.f);
+		} else {
+			n = vn_.at(bar);
+		}
+		n = proj<3>(normal_matrix_ * embed<4>(n, 0.f));
+		color = phong(n.normalize(), light_dir_, shininess_, texture_->sample(uv.x, uv.y, lod_.at(uv, bar)));
+		return false;
+	}
+};
+
+// The surface map of MaterialShader: rgb a tangent-space normal ([0, 255]
+// encoding xyz in [-1, 1]), alpha the specular exponent less
+// SURFACE_MIN_SHININESS. Built from the first channel of specular_map,
+// resampled to the normal map's size; a missing normal map is filled with
+// the unperturbed normal, a missing specular map with shininess. false if
+// both are NULL.
+const int SURFACE_MIN_SHININESS = 5;
+bool pack_surface_map(TGAImage *normal_map, TGAImage *specular_map, float shininess, TGAImage &out);
+
+// Textured Phong with a tangent-space normal map (z along the vertex
+// normal) and a per-texel specular exponent, both read from one surface
+// map (see pack_surface_map). When that has the diffuse map's size and
+// layout the two are read with one sample_pair(), which works out the
+// texel addresses and weights once for both and reads the surface map
+// from the nearer mip level only. begin() takes each vertex's tangent, bitangent and normal to
+// view space by normal_matrix and sets them up as planes; a pixel only
+// evaluates them and weighs them by the sampled normal, nothing of the
+// frame is rebuilt per pixel. Without a surface map it is PhongShader.
+class MaterialShader final : public IShader {
+	const Texture *texture_;
+	const Texture *surface_map_;
+	Mat4 normal_matrix_;
+	Vec3f light_dir_;
+	float shininess_;
+	AttributePlane<Vec2f> uv_;
+	AttributePlane<Vec3f> tangent_;
+	AttributePlane<Vec3f> bitangent_;
+	AttributePlane<Vec3f> normal_;
+	bool paired_;
+	TextureLod lod_;
+	TextureLod surface_lod_;
+
+	Vec3f to_view(const Vec3f &v) const { return proj<3>(normal_matrix_ * embed<4>(v, 0.f)); }
+public:
+	MaterialShader(const Texture &texture, const Texture *surface_map, const Mat4 &normal_matrix, Vec3f light_dir, float shininess = 10.f) : texture_(&texture), surface_map_(surface_map), normal_matrix_(normal_matrix), light_dir_(light_dir), shininess_(shininess), uv_(), tangent_(), bitangent_(), normal_(), paired_(false), lod_(), surface_lod_() {
+		light_dir_.normalize();
+		paired_ = surface_map && surface_map->get_width() == texture.get_width() && surface_map->get_height() == texture.get_height() && surface_map->layout() == texture.layout();
+	}
+	void begin(const TriangleSetup &s) override {
+		Vec3f t[3], b[3], n[3];
+		for (int i = 0; i < 3; i++) {
+			const Vec4f &tn = s.tri->tn[i];
+			Vec3f tangent = proj<3>(tn);
+			n[i] = to_view(s.tri->vn[i]);
+			t[i] = to_view(tangent);
+			b[i] = to_view(cross(s.tri->vn[i], tangent) * tn[3]);
+		}
+		set_uv_plane(uv_, s.tri->uv);
+		tangent_.set(t[0], t[1], t[2]);
+		bitangent_.set(b[0], b[1], b[2]);
+		normal_.set(n[0], n[1], n[2]);
+		lod_.set(*texture_, s);
+		if (surface_map_ && !paired_) surface_lod_.set(*surface_map_, s);
+	}
+	bool fragment(const Vec3f &bar, TGAColor &color) override {
+		Vec2f uv = uv_.at(bar);
+		Vec3f n = normal_.at(bar);
+		float lod = lod_.at(uv, bar);
+		if (!surface_map_) {
+			color = phong(n.normalize(), light_dir_, shininess_, texture_->sample(uv.x, uv.y, lod));
+			return false;
+		}
+		TGAColor albedo, c;
+		if (paired_) {
+			texture_->sample_pair(*surface_map_, uv.x, uv.y, lod, albedo, c);
+		} else {
+			albedo = texture_->sample(uv.x, uv.y, lod);
+			c = surface_map_->sample(uv.x, uv.y, surface_lod_.at(uv, bar));
+		}
+		const float scale = 2.f / 255.f;
+		n = tangent_.at(bar) * (c.r * scale - 1.f) + bitangent_.at(bar) * (c.g * scale - 1.f) + n * (c.b * scale - 1.f);
+		color = phong(n.normalize(), light_dir_, SURFACE_MIN_SHININESS + c.a, albedo);
+		return false;
+	}
+};
+
+enum ShaderKind {
+	SHADER_FLAT, SHADER_GOURAUD, SHADER_PHONG, SHADER_NORMALMAP, SHADER_MATERIAL
+};
+
+// name as given on the command line, false if there is no such shader
+bool shader_kind_from_name(const char *name, ShaderKind &kind);
+const char *shader_kind_name(ShaderKind kind);
+
+// what the built-in shaders are configured from
+struct ShaderUniforms {
+	const Texture *texture;
+	const Texture *normal_map; // object space for normalmap, the surface map for material; may be NULL
+	Mat4 normal_matrix;
+	Vec3f light_dir;
+};
+
+// Calls f with the built-in shader of the given kind. f is generic over the
+// shader type, so the code it instantiates is specialized per shader.
+template <class F>
+void with_shader(ShaderKind kind, const ShaderUniforms &u, F f) {
+	switch (kind) {
+		case SHADER_FLAT: f(FlatShader(u.light_dir)); break;
+		case SHADER_GOURAUD: f(GouraudShader(*u.texture, u.light_dir)); break;
+		case SHADER_PHONG: f(PhongShader(*u.texture, u.light_dir)); break;
+		case SHADER_NORMALMAP: f(NormalMapShader(*u.texture, u.normal_map, u.normal_matrix, u.light_dir)); break;
+		case SHADER_MATERIAL: f(MaterialShader(*u.texture, u.normal_map, u.normal_matrix, u.light_dir)); break;
+	}
+}
+
+#endif //__SHADER_H__
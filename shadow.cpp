@@ -0,0 +1,48 @@
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include "shadow.h"
+
+namespace {
+
+// normalized device coordinates to the pixels and depth units of the
+// vertex stage (to_screen without the divide and the rounding)
+Mat4 screen_matrix(int width, int height) {
+    Mat4 m = Mat4::identity();
+    m[0][0] = m[0][3] = width / 2.f;
+    m[1][1] = m[1][3] = height / 2.f;
+    m[2][2] = DEPTH;
+    return m;
+}
+
+}
+
+ShadowMap::ShadowMap(int size, float bias) : size_(std::max(size, 1)), bias_(bias), light_(Mat4::identity()), depth_(size_ * size_) {
+    clear();
+}
+
+void ShadowMap::set_light(Vec3f dir, float radius) {
+    dir.normalize();
+    // any up works for an orthographic light as long as it is not along dir
+    Vec3f up = std::abs(dir.y) > .99f ? Vec3f(1, 0, 0) : Vec3f(0, 1, 0);
+    Mat4 scale = Mat4::identity();
+    for (int i = 0; i < 3; i++) scale[i][i] = 1.f / radius;
+    light_ = scale * Mat4::lookat(dir, Vec3f(0, 0, 0), up);
+}
+
+Mat4 ShadowMap::to_map() const {
+    return screen_matrix(size_, size_) * light_;
+}
+
+Mat4 ShadowMap::from_screen(const Mat4 &camera, int width, int height) const {
+    return to_map() * (screen_matrix(width, height) * camera).inverse();
+}
+
+void ShadowMap::clear() {
+    std::fill(depth_.begin(), depth_.end(), -std::numeric_limits<float>::max());
+}
+
+DepthView ShadowMap::depth() {
+    DepthView view = {depth_.data(), size_, 0, 0};
+    return view;
+}
@@ -0,0 +1,104 @@
+#ifndef __SHADOW_H__
+#define __SHADOW_H__
+
+#include <vector>
+#include <cmath>
+#include "geometry.h"
+#include "rendertarget.h"
+#include "shader.h"
+
+// Depth of the scene seen from a directional light. The light looks at the
+// origin from dir through an orthographic box of half-size radius, and the
+// map uses the vertex stage's viewport (x and y in map pixels, z in
+// [-DEPTH, DEPTH], larger is nearer the light), so it is exactly what a
+// depth pass with light() as the camera leaves in a size x size float
+// zbuffer. Meant to be kept across frames: set_light() when the light
+// moves, then clear() and a depth pass into depth() per frame.
+class ShadowMap {
+private:
+	int size_;
+	float bias_;
+	Mat4 light_;
+	std::vector<float> depth_;
+public:
+	// the default bias covers the vertex stage rounding depth to whole units
+	ShadowMap(int size = 1024, float bias = 2.f);
+	int size() const { return size_; }
+	void set_light(Vec3f dir, float radius);
+	// object space to the light's normalized device coordinates
+	const Mat4 &light() const { return light_; }
+	// object space to map coordinates
+	Mat4 to_map() const;
+	// screen positions of a width x height frame drawn with camera to map
+	// coordinates, up to the divide by w
+	Mat4 from_screen(const Mat4 &camera, int width, int height) const;
+	void set_bias(float bias) { bias_ = bias; }
+	float bias() const { return bias_; }
+	void clear();
+	DepthView depth();
+	// Fraction of the light reaching p (map coordinates): nine bilinear
+	// depth comparisons one texel apart, which comes down to the 4x4 texels
+	// around p with tent weights. Anything outside the map is lit.
+	float visibility(const Vec3f &p) const {
+		float fx = std::floor(p.x), fy = std::floor(p.y);
+		int x0 = (int)fx - 1, y0 = (int)fy - 1;
+		if (x0 < 0 || y0 < 0 || x0 + 3 >= size_ || y0 + 3 >= size_) return 1.f;
+		float tx = p.x - fx, ty = p.y - fy;
+		const float wx[4] = {1.f - tx, 1.f, 1.f, tx};
+		const float wy[4] = {1.f - ty, 1.f, 1.f, ty};
+		float z = p.z + bias_;
+		const float *texel = &depth_[x0 + y0 * size_];
+		float lit = 0;
+		for (int j = 0; j < 4; j++, texel += size_) {
+			float row = 0;
+			for (int i = 0; i < 4; i++) row += texel[i] <= z ? wx[i] : 0.f;
+			lit += row * wy[j];
+		}
+		return lit * (1.f / 9.f);
+	}
+};
+
+// what is left of a color where the light is fully blocked
+const float SHADOW_AMBIENT = .3f;
+// depth bias added per triangle on top of ShadowMap::bias(), in depth units
+// per unit of the triangle's depth slope in the map, and its cap
+const float SHADOW_SLOPE_SCALE = 1.5f;
+const float SHADOW_MAX_SLOPE_BIAS = 16.f;
+
+// Wraps a shader with a shadow map lookup: the color it returns is scaled
+// towards SHADOW_AMBIENT by the visibility of the pixel. begin() takes the
+// triangle's screen positions to map coordinates (see
+// ShadowMap::from_screen), which are then interpolated like any other
+// attribute.
+template <class Shader>
+class ShadowedShader final : public IShader {
+	Shader shader_;
+	const ShadowMap *map_;
+	Mat4 from_screen_;
+	AttributePlane<Vec3f> pos_;
+public:
+	ShadowedShader(const Shader &shader, const ShadowMap &map, const Mat4 &from_screen) : shader_(shader), map_(&map), from_screen_(from_screen), pos_() {}
+	void begin(const TriangleSetup &s) override {
+		shader_.begin(s);
+		Vec3f p[3];
+		for (int i = 0; i < 3; i++) {
+			Vec4f h = from_screen_ * embed<4>(s.tri->pts[i]);
+			p[i] = proj<3>(h / h[3]);
+		}
+		// the filter compares against texels up to two away, so faces
+		// steep to the light move towards it by their depth slope
+		Vec3f n = cross(p[1] - p[0], p[2] - p[0]);
+		float slope = std::abs(n.z) > 1e-6f ? (std::abs(n.x) + std::abs(n.y)) / std::abs(n.z) : SHADOW_MAX_SLOPE_BIAS;
+		float offset = std::min(SHADOW_SLOPE_SCALE * slope, SHADOW_MAX_SLOPE_BIAS);
+		for (int i = 0; i < 3; i++) p[i].z += offset;
+		pos_.set(p[0], p[1], p[2]);
+	}
+	bool fragment(const Vec3f &bar, TGAColor &color) override {
+		if (shader_.fragment(bar, color)) return true;
+		float lit = map_->visibility(pos_.at(bar));
+		if (lit < 1.f) color = scale_color(color, SHADOW_AMBIENT + (1.f - SHADOW_AMBIENT) * lit);
+		return false;
+	}
+};
+
+#endif //__SHADOW_H__
@@ -0,0 +1,304 @@
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include "ssao.h"
+#include "profile.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SSAO_HAS_AVX2 1
+#endif
+
+namespace {
+
+const float EMPTY_DEPTH = -std::numeric_limits<float>::max();
+const float TWO_PI = 6.28318531f;
+const float GOLDEN_ANGLE = 2.39996323f;
+
+// 4x4 ordered-dither matrix: each 2x2 quad holds four rotations a quarter
+// turn apart
+const int ROTATION[4][4] = {
+    {0, 8, 2, 10},
+    {12, 4, 14, 6},
+    {3, 11, 1, 9},
+    {15, 7, 13, 5}
+};
+
+// binomial weights of the blur, radius AmbientOcclusion::BLUR_RADIUS
+const float BLUR_WEIGHTS[5] = {1, 4, 6, 4, 1};
+
+bool use_avx2() {
+#ifdef SSAO_HAS_AVX2
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#else
+    return false;
+#endif
+}
+
+#ifdef SSAO_HAS_AVX2
+// the depth slope along one axis, with the one-sided difference rules of
+// AmbientOcclusion::normal
+__attribute__((target("avx2")))
+inline __m256 slope(__m256 c, __m256 lo, __m256 hi, __m256 empty, __m256 sign) {
+    __m256 lo_empty = _mm256_cmp_ps(lo, empty, _CMP_EQ_OQ);
+    __m256 hi_empty = _mm256_cmp_ps(hi, empty, _CMP_EQ_OQ);
+    __m256 dl = _mm256_andnot_ps(lo_empty, _mm256_sub_ps(c, lo));
+    __m256 dh = _mm256_andnot_ps(hi_empty, _mm256_sub_ps(hi, c));
+    __m256 smaller = _mm256_cmp_ps(_mm256_andnot_ps(sign, dl), _mm256_andnot_ps(sign, dh), _CMP_LT_OQ);
+    __m256 d = _mm256_blendv_ps(dh, dl, smaller);
+    d = _mm256_blendv_ps(d, dl, hi_empty);
+    return _mm256_blendv_ps(d, dh, lo_empty);
+}
+
+// occlude_rows for the 8 pixels of row y starting at x, which must be a
+// multiple of 4 with a pixel on either side of the 8 and a row above and
+// below; the same float operations in the same order, so the result is
+// bit-identical to the scalar loop
+__attribute__((target("avx2")))
+void occlude_avx2(const float *depth, int width, int height, int x, int y, const float *lanes, int samples, float radius, float *out) {
+    const __m256 empty = _mm256_set1_ps(EMPTY_DEPTH);
+    const __m256 sign = _mm256_set1_ps(-0.f);
+    const __m256 one = _mm256_set1_ps(1.f);
+    const float *row = depth + x + y * width;
+    __m256 c = _mm256_loadu_ps(row);
+    __m256 dzdx = slope(c, _mm256_loadu_ps(row - 1), _mm256_loadu_ps(row + 1), empty, sign);
+    __m256 dzdy = slope(c, _mm256_loadu_ps(row - width), _mm256_loadu_ps(row + width), empty, sign);
+    __m256 len = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dzdx, dzdx), _mm256_mul_ps(dzdy, dzdy)), one));
+    __m256 inv = _mm256_div_ps(one, len);
+    __m256 nx = _mm256_mul_ps(_mm256_xor_ps(dzdx, sign), inv);
+    __m256 ny = _mm256_mul_ps(_mm256_xor_ps(dzdy, sign), inv);
+    __m256 nz = _mm256_mul_ps(one, inv);
+    __m256 xs = _mm256_add_ps(_mm256_set1_ps((float)x), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7));
+    __m256 ys = _mm256_set1_ps((float)y);
+    __m256 xmax = _mm256_set1_ps((float)(width - 1)), ymax = _mm256_set1_ps((float)(height - 1));
+    __m256 zero = _mm256_setzero_ps(), bias = _mm256_set1_ps(.5f), r = _mm256_set1_ps(radius);
+    __m256i stride = _mm256_set1_epi32(width);
+    __m256 occluded = zero;
+    for (int k = 0; k < samples; k++, lanes += 40) {
+        __m256 px = _mm256_loadu_ps(lanes), py = _mm256_loadu_ps(lanes + 8), pz = _mm256_loadu_ps(lanes + 16);
+        __m256 dot = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px, nx), _mm256_mul_ps(py, ny)), _mm256_mul_ps(pz, nz));
+        __m256 flip = _mm256_and_ps(_mm256_cmp_ps(dot, zero, _CMP_LT_OQ), sign);
+        __m256 sx = _mm256_add_ps(xs, _mm256_xor_ps(_mm256_loadu_ps(lanes + 24), flip));
+        __m256 sy = _mm256_add_ps(ys, _mm256_xor_ps(_mm256_loadu_ps(lanes + 32), flip));
+        sx = _mm256_min_ps(_mm256_max_ps(sx, zero), xmax);
+        sy = _mm256_min_ps(_mm256_max_ps(sy, zero), ymax);
+        __m256i idx = _mm256_add_epi32(_mm256_cvttps_epi32(sx), _mm256_mullo_epi32(_mm256_cvttps_epi32(sy), stride));
+        __m256 stored = _mm256_i32gather_ps(depth, idx, 4);
+        __m256 sz = _mm256_add_ps(c, _mm256_xor_ps(pz, flip));
+        __m256 w = _mm256_min_ps(_mm256_div_ps(r, _mm256_andnot_ps(sign, _mm256_sub_ps(stored, c))), one);
+        __m256 hit = _mm256_cmp_ps(stored, _mm256_add_ps(sz, bias), _CMP_GE_OQ);
+        occluded = _mm256_add_ps(occluded, _mm256_and_ps(hit, w));
+    }
+    __m256 ao = _mm256_sub_ps(one, _mm256_div_ps(occluded, _mm256_set1_ps((float)samples)));
+    _mm256_storeu_ps(out, _mm256_blendv_ps(ao, one, _mm256_cmp_ps(c, empty, _CMP_EQ_OQ)));
+}
+
+// blur_rows for the 8 pixels at i, whose taps (step apart) must all be
+// inside the image; bit-identical to the scalar loop
+__attribute__((target("avx2")))
+void blur_avx2(const float *src, float *dst, const float *depth, int i, int step, float radius) {
+    const __m256 sign = _mm256_set1_ps(-0.f);
+    const __m256 one = _mm256_set1_ps(1.f);
+    __m256 c = _mm256_loadu_ps(depth + i);
+    __m256 r = _mm256_set1_ps(radius);
+    __m256 sum = _mm256_setzero_ps(), weight = _mm256_setzero_ps();
+    for (int k = -AmbientOcclusion::BLUR_RADIUS; k <= AmbientOcclusion::BLUR_RADIUS; k++) {
+        int j = i + k * step;
+        __m256 dz = _mm256_andnot_ps(sign, _mm256_sub_ps(_mm256_loadu_ps(depth + j), c));
+        __m256 w = _mm256_mul_ps(_mm256_set1_ps(BLUR_WEIGHTS[k + AmbientOcclusion::BLUR_RADIUS]), _mm256_sub_ps(one, _mm256_div_ps(dz, r)));
+        w = _mm256_and_ps(_mm256_cmp_ps(dz, r, _CMP_LE_OQ), w);
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(src + j), w));
+        weight = _mm256_add_ps(weight, w);
+    }
+    __m256 out = _mm256_div_ps(sum, weight);
+    _mm256_storeu_ps(dst + i, _mm256_blendv_ps(out, one, _mm256_cmp_ps(c, _mm256_set1_ps(EMPTY_DEPTH), _CMP_EQ_OQ)));
+}
+#endif
+
+}
+
+AmbientOcclusion::AmbientOcclusion(int width, int height, int nthreads) : width_(width), height_(height), samples_(16), radius_(std::min(width, height) / 50.f), strength_(1.f), kernel_(), lanes_(), depth_(width * height), ao_(width * height), blurred_(width * height), pool_(nthreads) {
+    radius_ = std::max(radius_, 1.f);
+    build_kernel();
+}
+
+void AmbientOcclusion::set_samples(int samples) {
+    samples_ = std::max(1, std::min(samples, (int)MAX_SAMPLES));
+    build_kernel();
+}
+
+void AmbientOcclusion::set_radius(float radius) {
+    radius_ = std::max(radius, 1.f);
+    build_kernel();
+}
+
+// Points spread over the sphere along a golden-angle spiral, scaled so that
+// more land close to the pixel, where occluders matter most, then rotated
+// by each of the 16 angles of the dither tile.
+void AmbientOcclusion::build_kernel() {
+    kernel_.resize(16 * samples_);
+    for (int i = 0; i < samples_; i++) {
+        float z = 1.f - 2.f * (i + .5f) / samples_;
+        float r = std::sqrt(1.f - z * z), phi = i * GOLDEN_ANGLE;
+        float s = (i + 1.f) / samples_;
+        s = (.1f + .9f * s * s) * radius_;
+        for (int rot = 0; rot < 16; rot++) {
+            float a = phi + rot * TWO_PI / 16;
+            KernelPoint &k = kernel_[rot * samples_ + i];
+            k.x = r * std::cos(a) * s;
+            k.y = r * std::sin(a) * s;
+            k.z = z * s;
+            k.dx = (int)std::floor(k.x + .5f);
+            k.dy = (int)std::floor(k.y + .5f);
+        }
+    }
+    // the same points for 8 pixels starting at a multiple of 4, per row
+    // of the tile
+    lanes_.resize(4 * samples_ * 5 * 8);
+    for (int ty = 0; ty < 4; ty++) {
+        for (int i = 0; i < samples_; i++) {
+            float *lane = &lanes_[(ty * samples_ + i) * 5 * 8];
+            for (int l = 0; l < 8; l++) {
+                const KernelPoint &k = kernel_[ROTATION[ty][l & 3] * samples_ + i];
+                lane[l] = k.x;
+                lane[8 + l] = k.y;
+                lane[16 + l] = k.z;
+                lane[24 + l] = k.dx;
+                lane[32 + l] = k.dy;
+            }
+        }
+    }
+}
+
+Vec3f AmbientOcclusion::normal(int x, int y) const {
+    const float *d = &depth_[x + y * width_];
+    // the one-sided difference with the smaller step keeps silhouettes from
+    // bending the normal; a side that is off the image or empty is skipped
+    float l = x > 0 ? d[-1] : EMPTY_DEPTH, r = x + 1 < width_ ? d[1] : EMPTY_DEPTH;
+    float b = y > 0 ? d[-width_] : EMPTY_DEPTH, t = y + 1 < height_ ? d[width_] : EMPTY_DEPTH;
+    float dl = l == EMPTY_DEPTH ? 0 : d[0] - l, dr = r == EMPTY_DEPTH ? 0 : r - d[0];
+    float db = b == EMPTY_DEPTH ? 0 : d[0] - b, dt = t == EMPTY_DEPTH ? 0 : t - d[0];
+    float dzdx = l == EMPTY_DEPTH ? dr : r == EMPTY_DEPTH ? dl : (std::abs(dl) < std::abs(dr) ? dl : dr);
+    float dzdy = b == EMPTY_DEPTH ? dt : t == EMPTY_DEPTH ? db : (std::abs(db) < std::abs(dt) ? db : dt);
+    Vec3f n(-dzdx, -dzdy, 1.f);
+    return n.normalize();
+}
+
+void AmbientOcclusion::occlude_rows(int y0, int y1) {
+    static const bool avx2 = use_avx2();
+    const float bias = .5f;
+    for (int y = y0; y < y1; y++) {
+        for (int x = 0; x < width_; x++) {
+            int i = x + y * width_;
+#ifdef SSAO_HAS_AVX2
+            // 8 pixels at a time away from the image border
+            if (avx2 && x >= 4 && x + 8 < width_ && y > 0 && y + 1 < height_) {
+                occlude_avx2(depth_.data(), width_, height_, x, y, &lanes_[(y & 3) * samples_ * 40], samples_, radius_, &ao_[i]);
+                x += 7;
+                continue;
+            }
+#endif
+            float d = depth_[i];
+            if (d == EMPTY_DEPTH) {
+                ao_[i] = 1.f;
+                continue;
+            }
+            Vec3f n = normal(x, y);
+            const KernelPoint *kernel = &kernel_[ROTATION[y & 3][x & 3] * samples_];
+            float occluded = 0;
+            for (int k = 0; k < samples_; k++) {
+                // points below the surface are mirrored above it, which
+                // keeps the sphere's even spread over the hemisphere
+                const KernelPoint &p = kernel[k];
+                bool below = p.x * n.x + p.y * n.y + p.z * n.z < 0;
+                int sx = std::min(std::max(x + (below ? -p.dx : p.dx), 0), width_ - 1);
+                int sy = std::min(std::max(y + (below ? -p.dy : p.dy), 0), height_ - 1);
+                float sz = d + (below ? -p.z : p.z);
+                float stored = depth_[sx + sy * width_];
+                // occluders much farther from the pixel's depth than the
+                // radius are a different surface and count less
+                float w = std::min(1.f, radius_ / std::abs(stored - d));
+                occluded += stored >= sz + bias ? w : 0.f;
+            }
+            ao_[i] = 1.f - occluded / samples_;
+        }
+    }
+}
+
+// one direction of the bilateral blur: taps at a depth more than the
+// kernel radius away from the pixel's, or empty, are left out
+void AmbientOcclusion::blur_rows(const float *src, float *dst, int dx, int dy, int y0, int y1) {
+    static const bool avx2 = use_avx2();
+    const int r = BLUR_RADIUS;
+    for (int y = y0; y < y1; y++) {
+        for (int x = 0; x < width_; x++) {
+            int i = x + y * width_;
+#ifdef SSAO_HAS_AVX2
+            if (avx2 && x >= r * dx && x + 8 + r * dx <= width_ && y >= r * dy && y + r * dy < height_) {
+                blur_avx2(src, dst, depth_.data(), i, dx + dy * width_, radius_);
+                x += 7;
+                continue;
+            }
+#endif
+            float d = depth_[i];
+            if (d == EMPTY_DEPTH) {
+                dst[i] = 1.f;
+                continue;
+            }
+            float sum = 0, weight = 0;
+            for (int k = -BLUR_RADIUS; k <= BLUR_RADIUS; k++) {
+                int tx = x + k * dx, ty = y + k * dy;
+                if (tx < 0 || ty < 0 || tx >= width_ || ty >= height_) continue;
+                int j = tx + ty * width_;
+                float dz = std::abs(depth_[j] - d);
+                if (dz > radius_) continue;
+                float w = BLUR_WEIGHTS[k + BLUR_RADIUS] * (1.f - dz / radius_);
+                sum += src[j] * w;
+                weight += w;
+            }
+            dst[i] = sum / weight;
+        }
+    }
+}
+
+void AmbientOcclusion::apply(RenderTarget &target) {
+    PROFILE_SCOPE("ssao");
+    // depth units to pixels: the unit cube spans DEPTH units in z and half
+    // the smaller side in x and y
+    const float scale = std::min(width_, height_) / (2.f * DEPTH);
+    int bands = (height_ + BAND - 1) / BAND;
+    pool_.parallel_for(bands, [this, &target, scale](int band) {
+        int y0 = band * BAND, y1 = std::min(y0 + BAND, height_);
+        for (int y = y0; y < y1; y++) {
+            for (int x = 0; x < width_; x++) {
+                float d = target.depth(x, y);
+                depth_[x + y * width_] = d == EMPTY_DEPTH ? EMPTY_DEPTH : d * scale;
+            }
+        }
+    });
+    pool_.parallel_for(bands, [this](int band) {
+        occlude_rows(band * BAND, std::min((band + 1) * BAND, height_));
+    });
+    pool_.parallel_for(bands, [this](int band) {
+        blur_rows(ao_.data(), blurred_.data(), 1, 0, band * BAND, std::min((band + 1) * BAND, height_));
+    });
+    pool_.parallel_for(bands, [this](int band) {
+        blur_rows(blurred_.data(), ao_.data(), 0, 1, band * BAND, std::min((band + 1) * BAND, height_));
+    });
+    TGAImage &color = target.color();
+    int bpp = color.get_bytespp();
+    int channels = std::min(bpp, 3);
+    pool_.parallel_for(bands, [this, &color, bpp, channels](int band) {
+        int y0 = band * BAND, y1 = std::min(y0 + BAND, height_);
+        for (int y = y0; y < y1; y++) {
+            unsigned char *p = color.buffer() + (size_t)y * width_ * bpp;
+            const float *ao = &ao_[y * width_];
+            for (int x = 0; x < width_; x++, p += bpp) {
+                if (ao[x] >= 1.f) continue;
+                float f = std::max(0.f, 1.f - strength_ * (1.f - ao[x]));
+                for (int c = 0; c < channels; c++) p[c] = (unsigned char)(p[c] * f);
+            }
+        }
+    });
+}
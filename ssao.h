@@ -0,0 +1,69 @@
+#ifndef __SSAO_H__
+#define __SSAO_H__
+
+#include <vector>
+#include "geometry.h"
+#include "rendertarget.h"
+#include "threadpool.h"
+
+// Screen-space ambient occlusion, a post-pass over a finished render
+// target. It only reads the depth buffer: positions are (x, y, depth)
+// with depth scaled to pixels as the vertex stage maps the unit cube, the
+// normal comes from the smaller of the one-sided depth differences, and a
+// fixed kernel of points (denser towards the pixel), flipped into the
+// normal's hemisphere, is tested against the stored depth. The kernel is
+// rotated by one of 16 angles picked from a 4x4 ordered-dither tile, so
+// neighbouring pixels sample different directions and the noise repeats
+// every 4 pixels; a separable bilateral blur of radius BLUR_RADIUS, which
+// ignores neighbours at a different depth, removes it. The color of covered
+// pixels is then scaled by the occlusion.
+//
+// Every pass runs in parallel over bands of rows, and a pixel costs the
+// same whatever the mesh: samples() depth reads within radius() pixels plus
+// 2 * (2 * BLUR_RADIUS + 1) blur taps.
+class AmbientOcclusion {
+private:
+	int width_;
+	int height_;
+	int samples_;
+	float radius_;
+	float strength_;
+	// a kernel point and its offset in whole pixels, per rotation
+	struct KernelPoint {
+		float x, y, z;
+		int dx, dy;
+	};
+	std::vector<KernelPoint> kernel_;
+	// kernel_ laid out for the AVX2 loop
+	std::vector<float> lanes_;
+	std::vector<float> depth_;
+	std::vector<float> ao_;
+	std::vector<float> blurred_;
+	ThreadPool pool_;
+
+	void build_kernel();
+	Vec3f normal(int x, int y) const;
+	void occlude_rows(int y0, int y1);
+	void blur_rows(const float *src, float *dst, int dx, int dy, int y0, int y1);
+public:
+	enum { MAX_SAMPLES = 64, BLUR_RADIUS = 2, BAND = 16 };
+
+	// nthreads as for ThreadPool
+	AmbientOcclusion(int width, int height, int nthreads = 0);
+	// kernel points per pixel, at most MAX_SAMPLES (16 by default)
+	void set_samples(int samples);
+	int samples() const { return samples_; }
+	// kernel radius in pixels (1/50 of the smaller side by default)
+	void set_radius(float radius);
+	float radius() const { return radius_; }
+	// how much of the occlusion is applied, 0 leaves the color alone
+	void set_strength(float strength) { strength_ = strength; }
+	float strength() const { return strength_; }
+	// computes the occlusion of target (which must have this size) and
+	// darkens its color image with it
+	void apply(RenderTarget &target);
+	// after apply(): per pixel, 1 unoccluded, 0 fully occluded
+	float occlusion(int x, int y) const { return ao_[x + y * width_]; }
+};
+
+#endif //__SSAO_H__
@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <cstring>
+#include "texture.h"
+
+Texture::Texture() : levels_(), bytespp_(0), filter_(TRILINEAR), layout_(ROW_MAJOR) {
+}
+
+Texture::Texture(TGAImage &img, Layout layout) : levels_(), bytespp_(0), filter_(TRILINEAR), layout_(ROW_MAJOR) {
+    load(img);
+    set_layout(layout);
+}
+
+bool Texture::load(TGAImage &img) {
+    PROFILE_SCOPE("build_mips");
+    Layout layout = layout_;
+    layout_ = ROW_MAJOR;
+    levels_.clear();
+    bytespp_ = img.get_bytespp();
+    if (!img.buffer() || img.get_width() <= 0 || img.get_height() <= 0) return false;
+
+    Level base;
+    base.width = img.get_width();
+    base.height = img.get_height();
+    base.pitch = base.width;
+    base.texels.resize(base.width * base.height);
+    const unsigned char *src = img.buffer();
+    for (size_t i = 0; i < base.texels.size(); i++) {
+        uint32_t t = 0;
+        memcpy(&t, src + i * bytespp_, bytespp_);
+        base.texels[i] = t;
+    }
+    levels_.push_back(base);
+
+    // 2x2 box filter down to 1x1; odd sizes clamp the last row/column
+    while (levels_.back().width > 1 || levels_.back().height > 1) {
+        const Level &prev = levels_.back();
+        Level next;
+        next.width = std::max(1, prev.width >> 1);
+        next.height = std::max(1, prev.height >> 1);
+        next.pitch = next.width;
+        next.texels.resize(next.width * next.height);
+        for (int y = 0; y < next.height; y++) {
+            int y0 = std::min(2 * y, prev.height - 1), y1 = std::min(2 * y + 1, prev.height - 1);
+            for (int x = 0; x < next.width; x++) {
+                int x0 = std::min(2 * x, prev.width - 1), x1 = std::min(2 * x + 1, prev.width - 1);
+                uint32_t a = prev.texels[x0 + y0 * prev.width], b = prev.texels[x1 + y0 * prev.width];
+                uint32_t c = prev.texels[x0 + y1 * prev.width], d = prev.texels[x1 + y1 * prev.width];
+                uint32_t t = 0;
+                for (int s = 0; s < 32; s += 8) {
+                    uint32_t sum = ((a >> s) & 0xff) + ((b >> s) & 0xff) + ((c >> s) & 0xff) + ((d >> s) & 0xff);
+                    t |= ((sum + 2) >> 2) << s;
+                }
+                next.texels[x + y * next.width] = t;
+            }
+        }
+        levels_.push_back(next);
+    }
+    set_layout(layout);
+    return true;
+}
+
+void Texture::relayout(Level &l, Layout from, Layout to) {
+    Level out;
+    out.width = l.width;
+    out.height = l.height;
+    size_t size;
+    if (to == BLOCK_LINEAR) {
+        out.pitch = (l.width + 3) >> 2;
+        size = (size_t)out.pitch * ((l.height + 3) >> 2) * 16;
+    } else if (to == MORTON) {
+        // Z-order needs a power-of-two square; non-square levels are padded
+        out.pitch = 1;
+        while (out.pitch < l.width || out.pitch < l.height) out.pitch <<= 1;
+        size = (size_t)out.pitch * out.pitch;
+    } else {
+        out.pitch = l.width;
+        size = (size_t)l.width * l.height;
+    }
+    out.texels.assign(size, 0);
+    for (int y = 0; y < l.height; y++) {
+        for (int x = 0; x < l.width; x++) {
+            out.texels[texel_index(to, out, x, y)] = l.texels[texel_index(from, l, x, y)];
+        }
+    }
+    l.pitch = out.pitch;
+    l.texels.swap(out.texels);
+}
+
+void Texture::set_layout(Layout layout) {
+    if (layout == layout_) return;
+    for (size_t i = 0; i < levels_.size(); i++) {
+        relayout(levels_[i], layout_, layout);
+    }
+    layout_ = layout;
+}
+
+TGAColor Texture::get(int x, int y) const {
+    if (levels_.empty() || x < 0 || y < 0 || x >= levels_[0].width || y >= levels_[0].height) {
+        return TGAColor();
+    }
+    return TGAColor((int)texel(levels_[0], x, y), bytespp_);
+}
+
+bool texture_filter_from_name(const char *name, Texture::Filter &filter) {
+    if (!strcmp(name, "nearest")) filter = Texture::NEAREST;
+    else if (!strcmp(name, "bilinear")) filter = Texture::BILINEAR;
+    else if (!strcmp(name, "trilinear")) filter = Texture::TRILINEAR;
+    else return false;
+    return true;
+}
+
+const char *texture_filter_name(Texture::Filter filter) {
+    switch (filter) {
+    case Texture::NEAREST: return "nearest";
+    case Texture::BILINEAR: return "bilinear";
+    default: return "trilinear";
+    }
+}
+
+bool texture_layout_from_name(const char *name, Texture::Layout &layout) {
+    if (!strcmp(name, "row-major")) layout = Texture::ROW_MAJOR;
+    else if (!strcmp(name, "block")) layout = Texture::BLOCK_LINEAR;
+    else if (!strcmp(name, "morton")) layout = Texture::MORTON;
+    else return false;
+    return true;
+}
+
+const char *texture_layout_name(Texture::Layout layout) {
+    switch (layout) {
+    case Texture::BLOCK_LINEAR: return "block";
+    case Texture::MORTON: return "morton";
+    default: return "row-major";
+    }
+}
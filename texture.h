@@ -0,0 +1,271 @@
+#ifndef __TEXTURE_H__
+#define __TEXTURE_H__
+
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <stdint.h>
+#include "tgaimage.h"
+#include "profile.h"
+
+// Sampled texture with a box-filtered mipmap pyramid built once from a
+// TGAImage. Texels are widened to 4 bytes (the TGAColor raw layout) so a
+// fetch is a single unchecked 32-bit load; addressing wraps. The texels of
+// every level can be stored row-major, in 4x4 blocks (one 64-byte cache line
+// each) or in Z-order, so walks along v hit the cache as well as walks
+// along u; texel() hides the layout from the filters.
+class Texture {
+public:
+	enum Filter {
+		NEAREST, BILINEAR, TRILINEAR
+	};
+
+	enum Layout {
+		ROW_MAJOR, BLOCK_LINEAR, MORTON
+	};
+
+	struct Level {
+		int width;
+		int height;
+		int pitch; // texels per row, 4x4 blocks per row, or the padded Morton side
+		std::vector<uint32_t> texels;
+	};
+private:
+	std::vector<Level> levels_;
+	int bytespp_;
+	Filter filter_;
+	Layout layout_;
+
+	static inline uint32_t part1by1(uint32_t v);
+	static void relayout(Level &l, Layout from, Layout to);
+
+	// the four texels of a bilinear lookup and their weights in [0, 256]
+	struct Footprint {
+		int x0, y0, x1, y1;
+		uint32_t tx, ty;
+	};
+
+	static inline uint32_t lerp_texel(uint32_t a, uint32_t b, uint32_t t);
+	static inline float wrap(float u);
+	static inline Footprint footprint(const Level &l, float u, float v);
+	template <int L> inline uint32_t nearest(const Level &l, float u, float v) const;
+	template <int L> static inline uint32_t bilinear(const Level &l, const Footprint &f);
+	template <int L> inline uint32_t bilinear(const Level &l, float u, float v) const;
+	template <int L> inline uint32_t filtered(float u, float v, float lod) const;
+	template <int L> inline void filtered_pair(const Texture &other, float u, float v, float lod, uint32_t &a, uint32_t &b) const;
+public:
+	Texture();
+	Texture(TGAImage &img, Layout layout = ROW_MAJOR);
+	// (re)builds the pyramid from img
+	bool load(TGAImage &img);
+	void set_filter(Filter f) { filter_ = f; }
+	Filter filter() const { return filter_; }
+	// reorders the texels of every level
+	void set_layout(Layout layout);
+	Layout layout() const { return layout_; }
+	int get_width() const { return levels_.empty() ? 0 : levels_[0].width; }
+	int get_height() const { return levels_.empty() ? 0 : levels_[0].height; }
+	int get_bytespp() const { return bytespp_; }
+	int nlevels() const { return (int)levels_.size(); }
+	const Level &level(int i) const { return levels_[i]; }
+
+	// bounds-checked level 0 fetch with the semantics of TGAImage::get
+	TGAColor get(int x, int y) const;
+
+	static inline size_t texel_index(Layout layout, const Level &l, int x, int y);
+
+	// unchecked fetch, x and y must be inside the level
+	inline uint32_t texel(const Level &l, int x, int y) const {
+		return l.texels[texel_index(layout_, l, x, y)];
+	}
+
+	template <int L> static inline uint32_t texel(const Level &l, int x, int y) {
+		return l.texels[texel_index((Layout)L, l, x, y)];
+	}
+
+	// mip level for a pixel footprint given as uv derivatives along screen x
+	// and y (the uv difference across a 2x2 pixel quad)
+	float lod(float dudx, float dvdx, float dudy, float dvdy) const {
+		if (levels_.empty()) return 0.f;
+		float w = (float)levels_[0].width, h = (float)levels_[0].height;
+		float lx = (dudx * w) * (dudx * w) + (dvdx * h) * (dvdx * h);
+		float ly = (dudy * w) * (dudy * w) + (dvdy * h) * (dvdy * h);
+		float rho2 = lx > ly ? lx : ly;
+		return rho2 > 1.f ? .5f * log2_approx(rho2) : 0.f;
+	}
+	// log2 of a positive normal x to within 2e-3: the exponent plus a cubic
+	// in the mantissa, cheap enough to pick a level per pixel
+	static float log2_approx(float x) {
+		uint32_t bits;
+		memcpy(&bits, &x, 4);
+		float e = (float)((int)(bits >> 23) - 127);
+		bits = (bits & 0x007fffff) | 0x3f800000;
+		float m;
+		memcpy(&m, &bits, 4);
+		return e + ((.15824871f * m - 1.05187502f) * m + 3.04788415f) * m - 2.15424124f;
+	}
+
+	// filtered lookup at (u, v) in [0, 1]; lod is ignored by NEAREST and
+	// BILINEAR, which read level 0
+	inline TGAColor sample(float u, float v, float lod) const;
+	// sample() of this texture and other at the same uv and lod, with this
+	// one's filter, except that a trilinear other is read from the nearer of
+	// the two levels only (half the texels; for maps whose detail matters
+	// less than their cost). The texel addresses and weights are worked out
+	// once for both. other must have the same size and layout.
+	inline void sample_pair(const Texture &other, float u, float v, float lod, TGAColor &a, TGAColor &b) const;
+};
+
+// names as given on the command line; false if there is no such filter or
+// layout
+bool texture_filter_from_name(const char *name, Texture::Filter &filter);
+const char *texture_filter_name(Texture::Filter filter);
+bool texture_layout_from_name(const char *name, Texture::Layout &layout);
+const char *texture_layout_name(Texture::Layout layout);
+
+// spreads the low 16 bits of v to the even bit positions
+inline uint32_t Texture::part1by1(uint32_t v) {
+	v &= 0x0000ffff;
+	v = (v | (v << 8)) & 0x00ff00ff;
+	v = (v | (v << 4)) & 0x0f0f0f0f;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+inline size_t Texture::texel_index(Layout layout, const Level &l, int x, int y) {
+	switch (layout) {
+		case BLOCK_LINEAR:
+			return ((size_t)(y >> 2) * l.pitch + (x >> 2)) * 16 + ((y & 3) << 2) + (x & 3);
+		case MORTON:
+			return part1by1(x) | (part1by1(y) << 1);
+		default:
+			return x + (size_t)y * l.pitch;
+	}
+}
+
+// lerps all four 8-bit channels at once, t in [0, 256]
+inline uint32_t Texture::lerp_texel(uint32_t a, uint32_t b, uint32_t t) {
+	const uint32_t m = 0x00ff00ff;
+	uint32_t rb = (((a & m) * (256 - t) + (b & m) * t + 0x00800080) >> 8) & m;
+	uint32_t ag = ((((a >> 8) & m) * (256 - t) + ((b >> 8) & m) * t + 0x00800080) >> 8) & m;
+	return rb | (ag << 8);
+}
+
+// wraps a coordinate into [0, 1)
+inline float Texture::wrap(float u) {
+	float f = u - (float)(int)u;
+	return f < 0.f ? f + 1.f : f;
+}
+
+template <int L>
+inline uint32_t Texture::nearest(const Level &l, float u, float v) const {
+	int x = (int)(wrap(u) * l.width);
+	int y = (int)(wrap(v) * l.height);
+	return texel<L>(l, x < l.width ? x : l.width - 1, y < l.height ? y : l.height - 1);
+}
+
+inline Texture::Footprint Texture::footprint(const Level &l, float u, float v) {
+	// texel centers sit at half-integer positions; x >= -.5 so the truncation
+	// of x + 1 is a floor
+	float x = wrap(u) * l.width - .5f;
+	float y = wrap(v) * l.height - .5f;
+	Footprint f;
+	f.x0 = (int)(x + 1.f) - 1;
+	f.y0 = (int)(y + 1.f) - 1;
+	f.tx = (uint32_t)((x - f.x0) * 256.f);
+	f.ty = (uint32_t)((y - f.y0) * 256.f);
+	f.x1 = f.x0 + 1;
+	f.y1 = f.y0 + 1;
+	if (f.x0 < 0) f.x0 += l.width;
+	if (f.y0 < 0) f.y0 += l.height;
+	if (f.x1 >= l.width) f.x1 -= l.width;
+	if (f.y1 >= l.height) f.y1 -= l.height;
+	return f;
+}
+
+template <int L>
+inline uint32_t Texture::bilinear(const Level &l, const Footprint &f) {
+	uint32_t top = lerp_texel(texel<L>(l, f.x0, f.y0), texel<L>(l, f.x1, f.y0), f.tx);
+	uint32_t bottom = lerp_texel(texel<L>(l, f.x0, f.y1), texel<L>(l, f.x1, f.y1), f.tx);
+	return lerp_texel(top, bottom, f.ty);
+}
+
+template <int L>
+inline uint32_t Texture::bilinear(const Level &l, float u, float v) const {
+	return bilinear<L>(l, footprint(l, u, v));
+}
+
+template <int L>
+inline uint32_t Texture::filtered(float u, float v, float lod) const {
+	if (filter_ == NEAREST) {
+		return nearest<L>(levels_[0], u, v);
+	}
+	if (filter_ == BILINEAR || lod <= 0.f) {
+		return bilinear<L>(levels_[0], u, v);
+	}
+	int last = (int)levels_.size() - 1;
+	if (lod >= last) {
+		return bilinear<L>(levels_[last], u, v);
+	}
+	int l0 = (int)lod;
+	uint32_t a = bilinear<L>(levels_[l0], u, v);
+	uint32_t b = bilinear<L>(levels_[l0 + 1], u, v);
+	return lerp_texel(a, b, (uint32_t)((lod - l0) * 256.f));
+}
+
+template <int L>
+inline void Texture::filtered_pair(const Texture &other, float u, float v, float lod, uint32_t &a, uint32_t &b) const {
+	if (filter_ == NEAREST) {
+		const Level &l = levels_[0];
+		int x = (int)(wrap(u) * l.width);
+		int y = (int)(wrap(v) * l.height);
+		size_t i = texel_index((Layout)L, l, x < l.width ? x : l.width - 1, y < l.height ? y : l.height - 1);
+		a = l.texels[i];
+		b = other.levels_[0].texels[i];
+		return;
+	}
+	int last = (int)levels_.size() - 1;
+	if (filter_ == BILINEAR || lod <= 0.f || lod >= last) {
+		int l = filter_ == BILINEAR || lod <= 0.f ? 0 : last;
+		Footprint f = footprint(levels_[l], u, v);
+		a = bilinear<L>(levels_[l], f);
+		b = bilinear<L>(other.levels_[l], f);
+		return;
+	}
+	int l0 = (int)lod;
+	uint32_t t = (uint32_t)((lod - l0) * 256.f);
+	Footprint f0 = footprint(levels_[l0], u, v);
+	Footprint f1 = footprint(levels_[l0 + 1], u, v);
+	a = lerp_texel(bilinear<L>(levels_[l0], f0), bilinear<L>(levels_[l0 + 1], f1), t);
+	b = t < 128 ? bilinear<L>(other.levels_[l0], f0) : bilinear<L>(other.levels_[l0 + 1], f1);
+}
+
+inline TGAColor Texture::sample(float u, float v, float lod) const {
+	PROFILE_COUNT(PROF_TEXTURE_FETCHES, 1);
+	if (levels_.empty()) return TGAColor();
+	switch (layout_) {
+		case BLOCK_LINEAR: return TGAColor((int)filtered<BLOCK_LINEAR>(u, v, lod), bytespp_);
+		case MORTON: return TGAColor((int)filtered<MORTON>(u, v, lod), bytespp_);
+		default: return TGAColor((int)filtered<ROW_MAJOR>(u, v, lod), bytespp_);
+	}
+}
+
+inline void Texture::sample_pair(const Texture &other, float u, float v, float lod, TGAColor &a, TGAColor &b) const {
+	PROFILE_COUNT(PROF_TEXTURE_FETCHES, 2);
+	if (levels_.empty()) {
+		a = TGAColor();
+		b = other.sample(u, v, lod);
+		return;
+	}
+	uint32_t ta, tb;
+	switch (layout_) {
+		case BLOCK_LINEAR: filtered_pair<BLOCK_LINEAR>(other, u, v, lod, ta, tb); break;
+		case MORTON: filtered_pair<MORTON>(other, u, v, lod, ta, tb); break;
+		default: filtered_pair<ROW_MAJOR>(other, u, v, lod, ta, tb); break;
+	}
+	a = TGAColor((int)ta, bytespp_);
+	b = TGAColor((int)tb, other.bytespp_);
+}
+
+#endif //__TEXTURE_H__
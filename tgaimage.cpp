@@ -3,14 +3,40 @@
 #include <string.h>
 #include <time.h>
 #include <math.h>
+#include <vector>
+#include <algorithm>
+#include <new>
 #include "tgaimage.h"
+#include "mmapfile.h"
+#include "profile.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// pixel storage is cache-line aligned so rows can be streamed with aligned
+// vector loads and a render target's color buffer never splits a line at
+// its start
+const std::size_t PIXEL_ALIGN = 64;
+
+unsigned char *alloc_pixels(unsigned long nbytes) {
+	return static_cast<unsigned char *>(::operator new[](nbytes, std::align_val_t(PIXEL_ALIGN)));
+}
+
+void free_pixels(unsigned char *p) {
+	::operator delete[](p, std::align_val_t(PIXEL_ALIGN));
+}
+
+}
 
 TGAImage::TGAImage() : data(NULL), width(0), height(0), bytespp(0) {
 }
 
 TGAImage::TGAImage(int w, int h, int bpp) : data(NULL), width(w), height(h), bytespp(bpp) {
 	unsigned long nbytes = width*height*bytespp;
-	data = new unsigned char[nbytes];
+	data = alloc_pixels(nbytes);
 	memset(data, 0, nbytes);
 }
 
@@ -19,72 +45,73 @@ TGAImage::TGAImage(const TGAImage &img) {
 	height = img.height;
 	bytespp = img.bytespp;
 	unsigned long nbytes = width*height*bytespp;
-	data = new unsigned char[nbytes];
+	data = alloc_pixels(nbytes);
 	memcpy(data, img.data, nbytes);
 }
 
 TGAImage::~TGAImage() {
-	if (data) delete [] data;
+	if (data) free_pixels(data);
 }
 
 TGAImage & TGAImage::operator =(const TGAImage &img) {
 	if (this != &img) {
-		if (data) delete [] data;
+		if (data) free_pixels(data);
 		width  = img.width;
 		height = img.height;
 		bytespp = img.bytespp;
 		unsigned long nbytes = width*height*bytespp;
-		data = new unsigned char[nbytes];
+		data = alloc_pixels(nbytes);
 		memcpy(data, img.data, nbytes);
 	}
 	return *this;
 }
 
 bool TGAImage::read_tga_file(const char *filename) {
-	if (data) delete [] data;
-	data = NULL;
-	std::ifstream in;
-	in.open (filename, std::ios::binary);
-	if (!in.is_open()) {
+	PROFILE_SCOPE("read_tga");
+	MappedFile file;
+	if (!file.open(filename)) {
 		std::cerr << "can't open file " << filename << "\n";
-		in.close();
 		return false;
 	}
+	const unsigned char *p = (const unsigned char *)file.data();
+	const unsigned char *end = p + file.size();
 	TGA_Header header;
-	in.read((char *)&header, sizeof(header));
-	if (!in.good()) {
-		in.close();
+	if (file.size() < sizeof(header)) {
 		std::cerr << "an error occured while reading the header\n";
 		return false;
 	}
-	width   = header.width;
-	height  = header.height;
-	bytespp = header.bitsperpixel>>3;
-	if (width<=0 || height<=0 || (bytespp!=GRAYSCALE && bytespp!=RGB && bytespp!=RGBA)) {
-		in.close();
+	memcpy(&header, p, sizeof(header));
+	p += sizeof(header) + (unsigned char)header.idlength;
+	int w   = header.width;
+	int h   = header.height;
+	int bpp = header.bitsperpixel>>3;
+	if (w<=0 || h<=0 || (bpp!=GRAYSCALE && bpp!=RGB && bpp!=RGBA)) {
 		std::cerr << "bad bpp (or width/height) value\n";
 		return false;
 	}
-	unsigned long nbytes = bytespp*width*height;
-	data = new unsigned char[nbytes];
+	// decode into a fresh buffer and swap it in only once the pixels are in
+	unsigned long nbytes = bpp*w*h;
+	unsigned char *pixels = alloc_pixels(nbytes);
+	bool ok = false;
 	if (3==header.datatypecode || 2==header.datatypecode) {
-		in.read((char *)data, nbytes);
-		if (!in.good()) {
-			in.close();
-			std::cerr << "an error occured while reading the data\n";
-			return false;
-		}
+		ok = p <= end && (unsigned long)(end-p) >= nbytes;
+		if (ok) memcpy(pixels, p, nbytes);
+		else std::cerr << "an error occured while reading the data\n";
 	} else if (10==header.datatypecode||11==header.datatypecode) {
-		if (!load_rle_data(in)) {
-			in.close();
-			std::cerr << "an error occured while reading the data\n";
-			return false;
-		}
+		ok = p <= end && load_rle_data(p, end, (unsigned long)w*h, bpp, pixels);
+		if (!ok) std::cerr << "an error occured while reading the data\n";
 	} else {
-		in.close();
 		std::cerr << "unknown file format " << (int)header.datatypecode << "\n";
+	}
+	if (!ok) {
+		free_pixels(pixels);
 		return false;
 	}
+	if (data) free_pixels(data);
+	data    = pixels;
+	width   = w;
+	height  = h;
+	bytespp = bpp;
 	if (!(header.imagedescriptor & 0x20)) {
 		flip_vertically();
 	}
@@ -92,63 +119,143 @@ bool TGAImage::read_tga_file(const char *filename) {
 		flip_horizontally();
 	}
 	std::cerr << width << "x" << height << "/" << bytespp*8 << "\n";
-	in.close();
 	return true;
 }
 
-bool TGAImage::load_rle_data(std::ifstream &in) {
-	unsigned long pixelcount = width*height;
+// whole packets at a time: raw packets are one memcpy, runs are filled by
+// doubling the copied span
+bool TGAImage::load_rle_data(const unsigned char *p, const unsigned char *end, unsigned long npixels, int bpp, unsigned char *dst) {
 	unsigned long currentpixel = 0;
-	unsigned long currentbyte  = 0;
-	TGAColor colorbuffer;
-	do {
-		unsigned char chunkheader = 0;
-		chunkheader = in.get();
-		if (!in.good()) {
+	while (currentpixel < npixels) {
+		if (p >= end) {
 			std::cerr << "an error occured while reading the data\n";
 			return false;
 		}
+		unsigned char chunkheader = *p++;
+		unsigned long n = (chunkheader & 0x7f) + 1;
+		if (currentpixel+n > npixels) {
+			std::cerr << "Too many pixels read\n";
+			return false;
+		}
+		unsigned long nbytes = n*bpp;
 		if (chunkheader<128) {
-			chunkheader++;
-			for (int i=0; i<chunkheader; i++) {
-				in.read((char *)colorbuffer.raw, bytespp);
-				if (!in.good()) {
-					std::cerr << "an error occured while reading the header\n";
-					return false;
-				}
-				for (int t=0; t<bytespp; t++)
-					data[currentbyte++] = colorbuffer.raw[t];
-				currentpixel++;
-				if (currentpixel>pixelcount) {
-					std::cerr << "Too many pixels read\n";
-					return false;
-				}
+			if ((unsigned long)(end-p) < nbytes) {
+				std::cerr << "an error occured while reading the data\n";
+				return false;
 			}
+			memcpy(dst, p, nbytes);
+			p += nbytes;
 		} else {
-			chunkheader -= 127;
-			in.read((char *)colorbuffer.raw, bytespp);
-			if (!in.good()) {
-				std::cerr << "an error occured while reading the header\n";
+			if (end-p < bpp) {
+				std::cerr << "an error occured while reading the data\n";
 				return false;
 			}
-			for (int i=0; i<chunkheader; i++) {
-				for (int t=0; t<bytespp; t++)
-					data[currentbyte++] = colorbuffer.raw[t];
-				currentpixel++;
-				if (currentpixel>pixelcount) {
-					std::cerr << "Too many pixels read\n";
-					return false;
+			if (1==bpp) {
+				memset(dst, *p, n);
+			} else {
+				memcpy(dst, p, bpp);
+				for (unsigned long filled=bpp; filled<nbytes; filled*=2) {
+					memcpy(dst+filled, dst, std::min(filled, nbytes-filled));
 				}
 			}
+			p += bpp;
 		}
-	} while (currentpixel < pixelcount);
+		dst += nbytes;
+		currentpixel += n;
+	}
 	return true;
 }
 
-bool TGAImage::write_tga_file(const char *filename, bool rle) {
+namespace {
+
+// number of pixels from p on that equal the first one, at most maxpix;
+// pixel k equals pixel k+1 for all k below n exactly when every byte of the
+// span equals the byte bpp further on, so the span is compared 16 bytes at
+// a time
+unsigned long run_length(const unsigned char *p, unsigned long maxpix, int bpp) {
+	unsigned long limit = (maxpix-1)*bpp;
+	unsigned long j = 0;
+#ifdef __SSE2__
+	while (j+16 <= limit) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(p+j));
+		__m128i b = _mm_loadu_si128((const __m128i *)(p+j+bpp));
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) != 0xffff) break;
+		j += 16;
+	}
+#else
+	while (j+16 <= limit && !memcmp(p+j, p+j+bpp, 16)) j += 16;
+#endif
+	while (j < limit && p[j]==p[j+bpp]) j++;
+	return 1 + j/bpp;
+}
+
+inline bool same_pixel(const unsigned char *a, const unsigned char *b, int bpp) {
+	switch (bpp) {
+		case 1: return a[0]==b[0];
+		case 3: return a[0]==b[0] && a[1]==b[1] && a[2]==b[2];
+		default: return !memcmp(a, b, bpp);
+	}
+}
+
+}
+
+unsigned long TGAImage::max_rle_size(unsigned long npixels, int bpp) {
+	return npixels*bpp + (npixels+127)/128;
+}
+
+// Encodes one scanline (packets never cross rows, as the spec asks) into
+// dst, which must hold max_rle_size(npixels, bpp) bytes. Runs of two or more
+// equal pixels become run packets, everything else raw packets.
+unsigned long TGAImage::encode_rle(const unsigned char *src, unsigned long npixels, int bpp, unsigned char *dst) {
+	const unsigned long max_chunk_length = 128;
+	unsigned char *out = dst;
+	unsigned long i = 0;
+	while (i < npixels) {
+		unsigned long run = run_length(src+i*bpp, std::min(npixels-i, max_chunk_length), bpp);
+		if (run >= 2) {
+			*out++ = (unsigned char)(run+127);
+			memcpy(out, src+i*bpp, bpp);
+			out += bpp;
+			i += run;
+			continue;
+		}
+		unsigned long n = 1;
+		while (i+n < npixels && n < max_chunk_length && !(i+n+1 < npixels && same_pixel(src+(i+n)*bpp, src+(i+n+1)*bpp, bpp))) {
+			n++;
+		}
+		*out++ = (unsigned char)(n-1);
+		memcpy(out, src+i*bpp, n*bpp);
+		out += n*bpp;
+		i += n;
+	}
+	return out-dst;
+}
+
+static void fill_header(TGA_Header &header, int width, int height, int bytespp, bool rle, bool bottom_up) {
+	memset((void *)&header, 0, sizeof(header));
+	header.bitsperpixel = bytespp<<3;
+	header.width  = width;
+	header.height = height;
+	header.datatypecode = (bytespp==TGAImage::GRAYSCALE?(rle?11:3):(rle?10:2));
+	header.imagedescriptor = bottom_up ? 0x00 : 0x20;
+}
+
+static bool write_footer(std::ofstream &out) {
 	unsigned char developer_area_ref[4] = {0, 0, 0, 0};
 	unsigned char extension_area_ref[4] = {0, 0, 0, 0};
 	unsigned char footer[18] = {'T','R','U','E','V','I','S','I','O','N','-','X','F','I','L','E','.','\0'};
+	out.write((char *)developer_area_ref, sizeof(developer_area_ref));
+	out.write((char *)extension_area_ref, sizeof(extension_area_ref));
+	out.write((char *)footer, sizeof(footer));
+	if (!out.good()) {
+		std::cerr << "can't dump the tga file\n";
+		return false;
+	}
+	return true;
+}
+
+bool TGAImage::write_tga_file(const char *filename, bool rle, bool bottom_up) {
+	PROFILE_SCOPE("write_tga");
 	std::ofstream out;
 	out.open (filename, std::ios::binary);
 	if (!out.is_open()) {
@@ -157,95 +264,110 @@ bool TGAImage::write_tga_file(const char *filename, bool rle) {
 		return false;
 	}
 	TGA_Header header;
-	memset((void *)&header, 0, sizeof(header));
-	header.bitsperpixel = bytespp<<3;
-	header.width  = width;
-	header.height = height;
-	header.datatypecode = (bytespp==GRAYSCALE?(rle?11:3):(rle?10:2));
-	header.imagedescriptor = 0x20; // top-left origin
+	fill_header(header, width, height, bytespp, rle, bottom_up);
 	out.write((char *)&header, sizeof(header));
-	if (!out.good()) {
-		out.close();
-		std::cerr << "can't dump the tga file\n";
-		return false;
-	}
 	if (!rle) {
 		out.write((char *)data, width*height*bytespp);
-		if (!out.good()) {
-			std::cerr << "can't unload raw data\n";
-			out.close();
-			return false;
-		}
 	} else {
-		if (!unload_rle_data(out)) {
-			out.close();
-			std::cerr << "can't unload rle data\n";
-			return false;
+		// encode everything into one buffer and write it in one go
+		std::vector<unsigned char> buffer(max_rle_size(width, bytespp)*height);
+		unsigned long size = 0;
+		for (int y=0; y<height; y++) {
+			size += encode_rle(data+(unsigned long)y*width*bytespp, width, bytespp, &buffer[size]);
 		}
+		out.write((char *)&buffer[0], size);
 	}
-	out.write((char *)developer_area_ref, sizeof(developer_area_ref));
 	if (!out.good()) {
 		std::cerr << "can't dump the tga file\n";
 		out.close();
 		return false;
 	}
-	out.write((char *)extension_area_ref, sizeof(extension_area_ref));
-	if (!out.good()) {
-		std::cerr << "can't dump the tga file\n";
-		out.close();
+	bool ok = write_footer(out);
+	PROFILE_COUNT(PROF_BYTES_WRITTEN, (uint64_t)out.tellp());
+	out.close();
+	return ok;
+}
+
+/////////////////////////////////////////////////////////////////////////////////
+
+TGAWriter::TGAWriter() : image_(NULL), rle_(true), ready_(0), written_(0), closing_(false), ok_(true) {
+}
+
+TGAWriter::~TGAWriter() {
+	close();
+}
+
+bool TGAWriter::open(const char *filename, TGAImage &img, bool rle, bool bottom_up) {
+	close();
+	out_.open(filename, std::ios::binary);
+	if (!out_.is_open()) {
+		std::cerr << "can't open file " << filename << "\n";
 		return false;
 	}
-	out.write((char *)footer, sizeof(footer));
-	if (!out.good()) {
-		std::cerr << "can't dump the tga file\n";
-		out.close();
-		return false;
+	TGA_Header header;
+	fill_header(header, img.get_width(), img.get_height(), img.get_bytespp(), rle, bottom_up);
+	out_.write((char *)&header, sizeof(header));
+	image_ = &img;
+	rle_ = rle;
+	ready_ = 0;
+	written_ = 0;
+	closing_ = false;
+	ok_ = out_.good();
+	buffer_.resize(TGAImage::max_rle_size(img.get_width(), img.get_bytespp()));
+	thread_ = std::thread(&TGAWriter::writer_loop, this);
+	return ok_;
+}
+
+void TGAWriter::rows_ready(int nrows) {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		if (nrows <= ready_) return;
+		ready_ = nrows;
 	}
-	out.close();
-	return true;
+	cv_.notify_one();
 }
 
-// TODO: it is not necessary to break a raw chunk for two equal pixels (for the matter of the resulting size)
-bool TGAImage::unload_rle_data(std::ofstream &out) {
-	const unsigned char max_chunk_length = 128;
-	unsigned long npixels = width*height;
-	unsigned long curpix = 0;
-	while (curpix<npixels) {
-		unsigned long chunkstart = curpix*bytespp;
-		unsigned long curbyte = curpix*bytespp;
-		unsigned char run_length = 1;
-		bool raw = true;
-		while (curpix+run_length<npixels && run_length<max_chunk_length) {
-			bool succ_eq = true;
-			for (int t=0; succ_eq && t<bytespp; t++) {
-				succ_eq = (data[curbyte+t]==data[curbyte+t+bytespp]);
-			}
-			curbyte += bytespp;
-			if (1==run_length) {
-				raw = !succ_eq;
-			}
-			if (raw && succ_eq) {
-				run_length--;
-				break;
-			}
-			if (!raw && !succ_eq) {
-				break;
-			}
-			run_length++;
-		}
-		curpix += run_length;
-		out.put(raw?run_length-1:run_length+127);
-		if (!out.good()) {
-			std::cerr << "can't dump the tga file\n";
-			return false;
+void TGAWriter::writer_loop() {
+	int width = image_->get_width();
+	int bpp = image_->get_bytespp();
+	unsigned long bytes_per_line = (unsigned long)width*bpp;
+	for (;;) {
+		int ready;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			cv_.wait(lock, [&] { return closing_ || ready_ > written_; });
+			if (ready_ <= written_) return;
+			ready = ready_;
 		}
-		out.write((char *)(data+chunkstart), (raw?run_length*bytespp:bytespp));
-		if (!out.good()) {
-			std::cerr << "can't dump the tga file\n";
-			return false;
+		PROFILE_SCOPE("write_tga_rows");
+		for (int y = written_; y < ready; y++) {
+			const unsigned char *row = image_->buffer()+y*bytes_per_line;
+			if (rle_) {
+				unsigned long size = TGAImage::encode_rle(row, width, bpp, &buffer_[0]);
+				out_.write((char *)&buffer_[0], size);
+			} else {
+				out_.write((const char *)row, bytes_per_line);
+			}
 		}
+		std::lock_guard<std::mutex> lock(mutex_);
+		written_ = ready;
 	}
-	return true;
+}
+
+bool TGAWriter::close() {
+	if (!image_) return ok_;
+	rows_ready(image_->get_height());
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		closing_ = true;
+	}
+	cv_.notify_one();
+	thread_.join();
+	ok_ = out_.good() && write_footer(out_);
+	PROFILE_COUNT(PROF_BYTES_WRITTEN, (uint64_t)out_.tellp());
+	out_.close();
+	image_ = NULL;
+	return ok_;
 }
 
 TGAColor TGAImage::get(int x, int y) {
@@ -315,7 +437,7 @@ void TGAImage::clear() {
 
 bool TGAImage::scale(int w, int h) {
 	if (w<=0 || h<=0 || !data) return false;
-	unsigned char *tdata = new unsigned char[w*h*bytespp];
+	unsigned char *tdata = alloc_pixels(w*h*bytespp);
 	int nscanline = 0;
 	int oscanline = 0;
 	int erry = 0;
@@ -343,7 +465,7 @@ bool TGAImage::scale(int w, int h) {
 			nscanline += nlinebytes;
 		}
 	}
-	delete [] data;
+	free_pixels(data);
 	data = tdata;
 	width = w;
 	height = h;
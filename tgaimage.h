@@ -2,6 +2,10 @@
 #define __IMAGE_H__
 
 #include <fstream>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #pragma pack(push,1)
 struct TGA_Header {
@@ -67,8 +71,8 @@ protected:
 	int height;
 	int bytespp;
 
-	bool   load_rle_data(std::ifstream &in);
-	bool unload_rle_data(std::ofstream &out);
+	// decodes npixels of bpp bytes from the RLE packets at p into dst
+	static bool load_rle_data(const unsigned char *p, const unsigned char *end, unsigned long npixels, int bpp, unsigned char *dst);
 public:
 	enum Format {
 		GRAYSCALE=1, RGB=3, RGBA=4
@@ -77,8 +81,10 @@ public:
 	TGAImage();
 	TGAImage(int w, int h, int bpp);
 	TGAImage(const TGAImage &img);
+	// on failure the image is left as it was
 	bool read_tga_file(const char *filename);
-	bool write_tga_file(const char *filename, bool rle=true);
+	// bottom_up marks row 0 as the bottom row instead of flipping the data
+	bool write_tga_file(const char *filename, bool rle=true, bool bottom_up=false);
 	bool flip_horizontally();
 	bool flip_vertically();
 	bool scale(int w, int h);
@@ -91,6 +97,38 @@ public:
 	int get_bytespp();
 	unsigned char *buffer();
 	void clear();
+
+	static unsigned long max_rle_size(unsigned long npixels, int bpp);
+	static unsigned long encode_rle(const unsigned char *src, unsigned long npixels, int bpp, unsigned char *dst);
+};
+
+// Streams an image to a TGA file while it is still being produced: the
+// producer calls rows_ready(n) once rows [0, n) of the image are final and a
+// background thread encodes and writes them. With bottom_up the file gets a
+// bottom-left origin, so image row 0 (the renderer's bottom row) goes first
+// and no flip is needed.
+class TGAWriter {
+private:
+	TGAImage *image_;
+	bool rle_;
+	std::ofstream out_;
+	std::vector<unsigned char> buffer_;
+	std::thread thread_;
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	int ready_;
+	int written_;
+	bool closing_;
+	bool ok_;
+
+	void writer_loop();
+public:
+	TGAWriter();
+	~TGAWriter();
+	bool open(const char *filename, TGAImage &img, bool rle = true, bool bottom_up = true);
+	void rows_ready(int nrows);
+	// writes the remaining rows and the footer
+	bool close();
 };
 
 #endif //__IMAGE_H__
\ No newline at end of file
@@ -0,0 +1,72 @@
+#include "threadpool.h"
+
+ThreadPool::ThreadPool(int nthreads) : workers_(), job_(NULL), next_(0), njobs_(0), pending_(0), generation_(0), stop_(false) {
+    if (nthreads <= 0) {
+        nthreads = (int)std::thread::hardware_concurrency();
+    }
+    if (nthreads <= 0) {
+        nthreads = 1;
+    }
+    for (int i = 1; i < nthreads; i++) {
+        workers_.push_back(std::thread(&ThreadPool::worker_loop, this));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (size_t i = 0; i < workers_.size(); i++) {
+        workers_[i].join();
+    }
+}
+
+int ThreadPool::size() {
+    return (int)workers_.size() + 1;
+}
+
+void ThreadPool::run_jobs() {
+    for (int i = next_++; i < njobs_; i = next_++) {
+        (*job_)(i);
+    }
+}
+
+void ThreadPool::worker_loop() {
+    unsigned long seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [&] { return stop_ || generation_ != seen; });
+            if (stop_) return;
+            seen = generation_;
+        }
+        run_jobs();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (--pending_ == 0) done_.notify_one();
+        }
+    }
+}
+
+void ThreadPool::parallel_for(int n, const std::function<void(int)> &f) {
+    if (n <= 0) return;
+    if (workers_.empty() || n == 1) {
+        for (int i = 0; i < n; i++) f(i);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        job_ = &f;
+        njobs_ = n;
+        next_ = 0;
+        pending_ = (int)workers_.size();
+        generation_++;
+    }
+    wake_.notify_all();
+    run_jobs();
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [&] { return pending_ == 0; });
+    job_ = NULL;
+}
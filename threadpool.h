@@ -0,0 +1,36 @@
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+// Persistent worker pool. parallel_for hands out indices [0, n) through an
+// atomic counter, so uneven work items (dense tiles vs empty ones) balance out.
+class ThreadPool {
+private:
+	std::vector<std::thread> workers_;
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::condition_variable done_;
+	const std::function<void(int)> *job_;
+	std::atomic<int> next_;
+	int njobs_;
+	int pending_;
+	unsigned long generation_;
+	bool stop_;
+
+	void worker_loop();
+	void run_jobs();
+public:
+	// nthreads counts the calling thread too; <=0 means one per hardware thread
+	ThreadPool(int nthreads = 0);
+	~ThreadPool();
+	int size();
+	void parallel_for(int n, const std::function<void(int)> &f);
+};
+
+#endif //__THREADPOOL_H__
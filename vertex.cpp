@@ -0,0 +1,107 @@
+#include <cmath>
+#include "vertex.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VERTEX_HAS_AVX2 1
+#endif
+
+VertexMode best_vertex_mode() {
+#ifdef VERTEX_HAS_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return VERTEX_AVX2;
+#endif
+    return VERTEX_SCALAR;
+}
+
+const char *vertex_mode_name(VertexMode mode) {
+    switch (mode) {
+        case VERTEX_SCALAR: return "scalar";
+        case VERTEX_AVX2: return "avx2";
+    }
+    return "unknown";
+}
+
+namespace {
+
+void transform_scalar(const Vec3f *verts, int begin, int end, const Mat4 &m, const Viewport &vp, ScreenVerts &out) {
+    for (int i = begin; i < end; i++) {
+        Vec4f clip = to_clip(m, verts[i]);
+        Vec3f p = to_screen(clip, vp);
+        out.x[i] = p.x;
+        out.y[i] = p.y;
+        out.z[i] = p.z;
+        out.rhw[i] = 1.f / clip[3];
+        out.outcode[i] = clip_outcode(clip);
+    }
+}
+
+#ifdef VERTEX_HAS_AVX2
+__attribute__((target("avx2")))
+inline __m256 row_dot(const Mat4 &m, int r, __m256 x, __m256 y, __m256 z) {
+    __m256 acc = _mm256_mul_ps(_mm256_set1_ps(m[r][0]), x);
+    acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_set1_ps(m[r][1]), y));
+    acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_set1_ps(m[r][2]), z));
+    return _mm256_add_ps(acc, _mm256_set1_ps(m[r][3]));
+}
+
+__attribute__((target("avx2")))
+void transform_avx2(const Vec3f *verts, int n, const Mat4 &m, const Viewport &vp, ScreenVerts &out) {
+    const __m256 one = _mm256_set1_ps(1.f), half = _mm256_set1_ps(.5f);
+    const __m256 half_w = _mm256_set1_ps(vp.half_w), half_h = _mm256_set1_ps(vp.half_h), depth = _mm256_set1_ps(vp.depth);
+    const int round = _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC;
+    const __m256 near_w = _mm256_set1_ps(CLIP_NEAR_W), guard_band = _mm256_set1_ps(GUARD_BAND), sign = _mm256_set1_ps(-0.f);
+    __m256 bits[6];
+    for (int b = 0; b < 6; b++) bits[b] = _mm256_castsi256_ps(_mm256_set1_epi32(1 << b));
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        // AoS to SoA: lanes 0-3 come from the low 128-bit halves (vertices
+        // i..i+3), lanes 4-7 from the high halves
+        const float *p = &verts[i].x;
+        __m256 m03 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p)), _mm_loadu_ps(p + 12), 1);
+        __m256 m14 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p + 4)), _mm_loadu_ps(p + 16), 1);
+        __m256 m25 = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(p + 8)), _mm_loadu_ps(p + 20), 1);
+        __m256 xy = _mm256_shuffle_ps(m14, m25, _MM_SHUFFLE(2, 1, 3, 2));
+        __m256 yz = _mm256_shuffle_ps(m03, m14, _MM_SHUFFLE(1, 0, 2, 1));
+        __m256 x = _mm256_shuffle_ps(m03, xy, _MM_SHUFFLE(2, 0, 3, 0));
+        __m256 y = _mm256_shuffle_ps(yz, xy, _MM_SHUFFLE(3, 1, 2, 0));
+        __m256 z = _mm256_shuffle_ps(yz, m25, _MM_SHUFFLE(3, 0, 3, 1));
+
+        __m256 cx = row_dot(m, 0, x, y, z), cy = row_dot(m, 1, x, y, z), cz = row_dot(m, 2, x, y, z), cw = row_dot(m, 3, x, y, z);
+        __m256 sx = _mm256_add_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_div_ps(cx, cw), one), half_w), half);
+        __m256 sy = _mm256_add_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_div_ps(cy, cw), one), half_h), half);
+        __m256 sz = _mm256_add_ps(_mm256_mul_ps(_mm256_div_ps(cz, cw), depth), half);
+        _mm256_storeu_ps(&out.x[i], _mm256_round_ps(sx, round));
+        _mm256_storeu_ps(&out.y[i], _mm256_round_ps(sy, round));
+        _mm256_storeu_ps(&out.z[i], _mm256_round_ps(sz, round));
+        _mm256_storeu_ps(&out.rhw[i], _mm256_div_ps(one, cw));
+
+        __m256 neg_w = _mm256_sub_ps(_mm256_setzero_ps(), cw), guard = _mm256_mul_ps(guard_band, cw);
+        __m256 abs_x = _mm256_andnot_ps(sign, cx), abs_y = _mm256_andnot_ps(sign, cy);
+        __m256 code = _mm256_and_ps(_mm256_cmp_ps(cx, neg_w, _CMP_LT_OQ), bits[0]);
+        code = _mm256_or_ps(code, _mm256_and_ps(_mm256_cmp_ps(cx, cw, _CMP_GT_OQ), bits[1]));
+        code = _mm256_or_ps(code, _mm256_and_ps(_mm256_cmp_ps(cy, neg_w, _CMP_LT_OQ), bits[2]));
+        code = _mm256_or_ps(code, _mm256_and_ps(_mm256_cmp_ps(cy, cw, _CMP_GT_OQ), bits[3]));
+        code = _mm256_or_ps(code, _mm256_and_ps(_mm256_cmp_ps(cw, near_w, _CMP_LT_OQ), bits[4]));
+        code = _mm256_or_ps(code, _mm256_and_ps(_mm256_or_ps(_mm256_cmp_ps(abs_x, guard, _CMP_GT_OQ), _mm256_cmp_ps(abs_y, guard, _CMP_GT_OQ)), bits[5]));
+        _mm256_storeu_si256((__m256i *)&out.outcode[i], _mm256_castps_si256(code));
+    }
+    transform_scalar(verts, i, n, m, vp, out);
+}
+#endif
+
+}
+
+void transform_vertices(VertexMode mode, const Vec3f *verts, int n, const Mat4 &mvp, int width, int height, int depth, ScreenVerts &out) {
+    out.resize(n);
+    Viewport vp = {width * .5f, height * .5f, (float)depth};
+    out.mvp = mvp;
+    out.viewport = vp;
+#ifdef VERTEX_HAS_AVX2
+    if (mode == VERTEX_AVX2) {
+        transform_avx2(verts, n, mvp, vp, out);
+        return;
+    }
+#endif
+    transform_scalar(verts, 0, n, mvp, vp, out);
+}
@@ -0,0 +1,81 @@
+#ifndef __VERTEX_H__
+#define __VERTEX_H__
+
+#include <vector>
+#include <cmath>
+#include "geometry.h"
+
+// Clip-space outcode bits. A vertex is outside the view volume when
+// x or y leaves [-w, w] or w drops below CLIP_NEAR_W (the near plane; the
+// zbuffer is float, so there is no far plane). CLIP_GUARD flags vertices
+// beyond GUARD_BAND times the screen extent, where the integer edge
+// functions of the rasterizer would lose range.
+enum {
+	CLIP_LEFT = 1, CLIP_RIGHT = 2, CLIP_BOTTOM = 4, CLIP_TOP = 8, CLIP_NEAR = 16, CLIP_GUARD = 32
+};
+const float CLIP_NEAR_W = 1e-3f;
+const float GUARD_BAND = 4.f;
+
+struct Viewport {
+	float half_w, half_h, depth;
+};
+
+// m * (v, 1), summed in the order the AVX2 kernel uses
+inline Vec4f to_clip(const Mat4 &m, const Vec3f &v) {
+	Vec4f c;
+	for (int r = 0; r < 4; r++) {
+		c[r] = m[r][0] * v.x + m[r][1] * v.y + m[r][2] * v.z + m[r][3];
+	}
+	return c;
+}
+
+inline int clip_outcode(const Vec4f &c) {
+	float guard = GUARD_BAND * c[3];
+	return (c[0] < -c[3] ? CLIP_LEFT : 0) | (c[0] > c[3] ? CLIP_RIGHT : 0) | (c[1] < -c[3] ? CLIP_BOTTOM : 0) | (c[1] > c[3] ? CLIP_TOP : 0)
+	     | (c[3] < CLIP_NEAR_W ? CLIP_NEAR : 0) | (std::abs(c[0]) > guard || std::abs(c[1]) > guard ? CLIP_GUARD : 0);
+}
+
+// The viewport mapping of the vertex stage for one clip-space position:
+// divide, map x and y from [-1, 1] to [0, width] and [0, height], scale z by
+// depth and round all three to whole pixels.
+inline Vec3f to_screen(const Vec4f &clip, const Viewport &vp) {
+	return Vec3f(std::trunc(((clip[0] / clip[3]) + 1.f) * vp.half_w + .5f),
+	             std::trunc(((clip[1] / clip[3]) + 1.f) * vp.half_h + .5f),
+	             std::trunc((clip[2] / clip[3]) * vp.depth + .5f));
+}
+
+// Vertex positions after the vertex stage, one array per coordinate so the
+// transform can store eight vertices with three vector writes, with their
+// clip outcodes and 1/w (rhw, for perspective-correct interpolation). mvp
+// and viewport record the transform that produced them so later stages can
+// redo it for vertices they create by clipping.
+struct ScreenVerts {
+	std::vector<float> x;
+	std::vector<float> y;
+	std::vector<float> z;
+	std::vector<float> rhw;
+	std::vector<int> outcode;
+	Mat4 mvp;
+	Viewport viewport;
+
+	void resize(int n) { x.resize(n); y.resize(n); z.resize(n); rhw.resize(n); outcode.resize(n); }
+	int size() const { return (int)x.size(); }
+	Vec3f operator[](int i) const { return Vec3f(x[i], y[i], z[i]); }
+};
+
+enum VertexMode {
+	VERTEX_SCALAR, // one vertex at a time, the reference
+	VERTEX_AVX2    // eight vertices per iteration, same operation order
+};
+
+// AVX2 when the CPU has it
+VertexMode best_vertex_mode();
+const char *vertex_mode_name(VertexMode mode);
+
+// Takes n model-space positions through mvp, the perspective divide and the
+// viewport (see to_screen; the edge rasterizer relies on integer vertices),
+// and computes each vertex's outcode. Both modes do the same float
+// operations in the same order, so their results are bit-identical.
+void transform_vertices(VertexMode mode, const Vec3f *verts, int n, const Mat4 &mvp, int width, int height, int depth, ScreenVerts &out);
+
+#endif //__VERTEX_H__
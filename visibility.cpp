@@ -0,0 +1,18 @@
+#include <algorithm>
+#include "visibility.h"
+
+VisibilityBuffer::VisibilityBuffer() : width_(0), height_(0), samples_() {
+}
+
+void VisibilityBuffer::resize(int width, int height) {
+    width_ = width;
+    height_ = height;
+    samples_.resize(width * height);
+}
+
+void VisibilityBuffer::clear(int x0, int y0, int x1, int y1) {
+    VisSample empty = {EMPTY, 0, 0};
+    for (int y = y0; y < y1; y++) {
+        std::fill(samples_.begin() + x0 + y * width_, samples_.begin() + x1 + y * width_, empty);
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef __VISIBILITY_H__
+#define __VISIBILITY_H__
+
+#include <vector>
+#include <cstdint>
+#include "shader.h"
+
+// One pixel of the visibility buffer: the index of the front-most triangle
+// and the barycentric weights of its vertex 1 and 2 in 16-bit fixed point
+// (vertex 0 gets what is left).
+struct VisSample {
+	uint32_t id;
+	uint16_t b1;
+	uint16_t b2;
+};
+
+// Per-pixel output of the first pass of deferred shading. Depth stays in the
+// caller's zbuffer.
+class VisibilityBuffer {
+private:
+	int width_;
+	int height_;
+	std::vector<VisSample> samples_;
+public:
+	static const uint32_t EMPTY = 0xffffffffu;
+
+	VisibilityBuffer();
+	void resize(int width, int height);
+	// marks the pixels inside [x0, x1) x [y0, y1) as uncovered
+	void clear(int x0, int y0, int x1, int y1);
+	int width() const { return width_; }
+	int height() const { return height_; }
+	VisSample &at(int x, int y) { return samples_[x + y * width_]; }
+	const VisSample &at(int x, int y) const { return samples_[x + y * width_]; }
+};
+
+// Takes the place of the shader in the first pass: the rasterizer calls
+// begin() as usual, but instead of fragment() each pixel passing the depth
+// test is handed to store() (see raster_detail::shade_pixel). Triangle ids
+// are offsets into tris, the array the triangles are rasterized from.
+class VisibilityShader {
+	VisibilityBuffer *vis_;
+	const Triangle *tris_;
+	uint32_t id_;
+public:
+	VisibilityShader(VisibilityBuffer &vis, const Triangle *tris) : vis_(&vis), tris_(tris), id_(VisibilityBuffer::EMPTY) {}
+	void begin(const TriangleSetup &s) { id_ = (uint32_t)(s.tri - tris_); }
+	void store(int x, int y, float b1, float b2) {
+		VisSample &v = vis_->at(x, y);
+		v.id = id_;
+		v.b1 = (uint16_t)(b1 * 65535.f + .5f);
+		v.b2 = (uint16_t)(b2 * 65535.f + .5f);
+	}
+};
+
+#endif //__VISIBILITY_H__